@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Compare the debug and perf firmware profiles on the step benchmark.
+
+  python bench_compare.py --port COM7            # build, flash and run both
+  python bench_compare.py --no-run               # sizes only, no board needed
+
+Builds env:bench (sdkconfig.esp32doit-devkit-v1, -Og) and env:bench_perf
+(sdkconfig.perf, -O2, IRAM-safe interrupts), reads the section sizes out of
+both firmware.elf files, then flashes each one in turn and collects its
+[bench]/[stats] report. Prints one table: memory by region, G-code parser
+throughput, highest clean step rate per axis count and the encoder cycle
+histograms.
+"""
+
+import sys, os, re, time, struct, argparse, subprocess
+
+import serial
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+PROJECT_DIR = os.path.join(HERE, "..", "roboarm2")
+
+PROFILES = [("debug", "bench"), ("perf", "bench_perf")]
+
+# Firmware regions by ELF section, as the ESP32 linker script names them.
+REGIONS = {
+	"iram": (".iram0.vectors", ".iram0.text"),
+	"dram": (".dram0.data", ".dram0.bss"),
+	"flash code": (".flash.text",),
+	"flash data": (".flash.rodata", ".flash.appdesc"),
+}
+
+GCODE_RE = re.compile(r'^\[bench\] gcode parser (\d+) lines/s')
+CLEAN_RE = re.compile(r'^\[bench\] axes=(\d+) max clean rate (\d+) steps/s')
+HIST_RE = re.compile(r'^\[stats\] (\w+) n=\d+ p50<=(\d+) p90<=\d+ p99<=(\d+) max=(\d+)')
+UNDERRUN_RE = re.compile(r'^\[stats\] underruns=(\d+)')
+DONE = "[bench] done"
+
+# ---------------------- Build ----------------------
+
+def pio(env: str, *targets: str, port: str = None):
+	cmd = ["pio", "run", "-d", PROJECT_DIR, "-e", env]
+	for t in targets:
+		cmd += ["-t", t]
+	if port:
+		cmd += ["--upload-port", port]
+	print(f"[INFO] {' '.join(cmd)}")
+	subprocess.run(cmd, check=True)
+
+def elf_sections(path: str) -> dict:
+	"""{section name: size} of an ELF32 little-endian file."""
+	with open(path, "rb") as f:
+		data = f.read()
+	if data[:4] != b"\x7fELF" or data[4] != 1 or data[5] != 1:
+		raise ValueError(f"{path}: not a 32-bit little-endian ELF")
+	shoff, = struct.unpack_from("<I", data, 0x20)
+	shentsize, shnum, shstrndx = struct.unpack_from("<HHH", data, 0x2e)
+	headers = [struct.unpack_from("<IIIIIIIIII", data, shoff + i * shentsize) for i in range(shnum)]
+	strtab = headers[shstrndx][4]
+	sections = {}
+	for name_off, _type, _flags, _addr, _off, size, *_ in headers:
+		end = data.index(b"\0", strtab + name_off)
+		sections[data[strtab + name_off:end].decode()] = size
+	return sections
+
+def region_sizes(env: str) -> dict:
+	sections = elf_sections(os.path.join(PROJECT_DIR, ".pio", "build", env, "firmware.elf"))
+	return {region: sum(sections.get(s, 0) for s in names) for region, names in REGIONS.items()}
+
+# ---------------------- Bench ----------------------
+
+def capture(port: str, baud: int, timeout: float) -> list:
+	"""Reset the board and return its lines up to the end of the benchmark."""
+	lines = []
+	with serial.Serial(port, baud, timeout=0.5) as ser:
+		# EN through RTS, like esptool, so the report is read from the start
+		ser.dtr = False
+		ser.rts = True
+		time.sleep(0.1)
+		ser.rts = False
+		deadline = time.time() + timeout
+		while time.time() < deadline:
+			line = ser.readline().decode(errors="ignore").strip()
+			if not line:
+				continue
+			if line.startswith(("[bench]", "[stats]")):
+				print(f"<< {line}")
+				lines.append(line)
+			if line == DONE:
+				return lines
+	raise TimeoutError(f"no '{DONE}' within {timeout:.0f} s")
+
+def parse_report(lines: list) -> dict:
+	metrics = {}
+	for line in lines:
+		m = GCODE_RE.match(line)
+		if m:
+			metrics["gcode lines/s"] = int(m.group(1))
+		m = CLEAN_RE.match(line)
+		if m:
+			metrics[f"clean rate {m.group(1)} axes"] = int(m.group(2))
+		m = HIST_RE.match(line)
+		if m:
+			name = m.group(1)
+			metrics[f"{name} p50"] = int(m.group(2))
+			metrics[f"{name} p99"] = int(m.group(3))
+			metrics[f"{name} max"] = int(m.group(4))
+		m = UNDERRUN_RE.match(line)
+		if m:
+			metrics["underruns"] = int(m.group(1))
+	return metrics
+
+# ---------------------- Report ----------------------
+
+def print_table(results: dict):
+	names = [p for p, _ in PROFILES]
+	keys = []
+	for metrics in results.values():
+		keys += [k for k in metrics if k not in keys]
+	width = max(len(k) for k in keys)
+	print(f"\n{'':{width}}  " + "  ".join(f"{n:>12}" for n in names) + "      change")
+	for key in keys:
+		values = [results[n].get(key) for n in names]
+		cells = "  ".join(f"{v:>12}" if v is not None else f"{'-':>12}" for v in values)
+		change = ""
+		if values[0] and values[1] is not None:
+			change = f"{(values[1] - values[0]) * 100.0 / values[0]:+10.1f}%"
+		print(f"{key:{width}}  {cells}  {change}")
+	print("\nCycle counts are CPU cycles at each profile's clock (160 vs 240 MHz).")
+
+# ---------------------- Main ----------------------
+
+def main():
+	parser = argparse.ArgumentParser(description="Size and cycle comparison of the debug and perf bench builds.")
+	parser.add_argument("--port", default="COM7")
+	parser.add_argument("--baud", type=int, default=921600, help="monitor_speed of platformio.ini")
+	parser.add_argument("--timeout", type=float, default=300.0, help="seconds for one benchmark run")
+	parser.add_argument("--no-build", action="store_true", help="use the firmware.elf files already built")
+	parser.add_argument("--no-run", action="store_true", help="compare sizes only")
+	args = parser.parse_args()
+
+	results = {}
+	try:
+		for name, env in PROFILES:
+			if not args.no_build:
+				pio(env)
+			results[name] = {f"{k} bytes": v for k, v in region_sizes(env).items()}
+			if not args.no_run:
+				pio(env, "upload", port=args.port)
+				results[name].update(parse_report(capture(args.port, args.baud, args.timeout)))
+	except (subprocess.CalledProcessError, OSError, ValueError, TimeoutError, serial.SerialException) as e:
+		print(f"[ERR] {e}", file=sys.stderr)
+		return 1
+	print_table(results)
+	return 0
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,255 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Compile a G-code job into a pre-planned block stream for home.py %%PLAY.
+
+  python gcode_compile.py job.gcode -o job.rblk
+  echo "%%PLAY job.rblk" | python home.py --binary --baud 921600
+
+%%FILE includes are expanded like home.py does. G0/G1 lines are planned with
+a port of the firmware's look-ahead planner (src/motion/planner.cpp) using
+the axis limits of config_xyza.yaml, over the whole job at once, and written
+as the lead-axis motion blocks the step engine runs. The device then only
+forwards the blocks to its feeder.
+
+The stream starts at the first move's target; %%PLAY rapids there through
+the normal planner before sending the first block.
+"""
+
+import sys, os, math, argparse
+
+from home import (_strip_inline_comment, _parse_file_path, _Modal, gcode_to_move, iter_file_lines, LINK_AXES,
+	_MAX_FILE_INCLUDE_DEPTH, STREAM_MAGIC, STREAM_VERSION, STREAM_HEADER, BLOCK_FMT)
+
+# Mirrors of firmware constants (src/motion).
+RAMP_MAX_RATE = 0xFFFF
+RAMP_TRAPEZOID = 0
+JUNCTION_DEVIATION_MM = 0.010
+
+# ---------------------- Config ----------------------
+
+def load_axis_limits(path: str):
+	"""(steps_per_mm, max_rate mm/s, accel mm/s^2) lists of X Y Z A."""
+	import yaml
+	with open(path, "r", encoding="utf-8") as f:
+		cfg = yaml.safe_load(f)
+	axes = cfg.get("axes") or {}
+	steps = [float(axes[name]["steps_per_mm"]) for name in LINK_AXES]
+	rates = [float(axes[name]["max_rate_mm_per_min"]) / 60.0 for name in LINK_AXES]
+	accels = [float(axes[name]["acceleration_mm_per_sec2"]) for name in LINK_AXES]
+	return steps, rates, accels
+
+# ---------------------- Job expansion ----------------------
+
+def expand_job(path: str, depth=0):
+	"""Yield (file, line number, G-code line) with %%FILE includes expanded."""
+	base_dir = os.path.dirname(path) or "."
+	for number, raw in enumerate(iter_file_lines(path), 1):
+		line = _strip_inline_comment(raw).strip()
+		if not line:
+			continue
+		if line.startswith("%%FILE"):
+			if depth >= _MAX_FILE_INCLUDE_DEPTH:
+				raise ValueError(f"{path}:{number}: %%FILE nesting limit ({_MAX_FILE_INCLUDE_DEPTH}) reached")
+			rest = line[len("%%FILE"):].strip()
+			if not rest:
+				raise ValueError(f"{path}:{number}: %%FILE requires a path")
+			yield from expand_job(_parse_file_path(rest, base_dir), depth + 1)
+			continue
+		if line.startswith("%%"):
+			raise ValueError(f"{path}:{number}: {line.split()[0]} cannot be precompiled")
+		yield path, number, line
+
+# ---------------------- Planner (port of planner.cpp) ----------------------
+
+class _PlanBlock:
+	__slots__ = ("steps", "lead_steps", "dir_bits", "millimeters", "acceleration",
+		"nominal_speed_sqr", "entry_speed_sqr", "max_entry_speed_sqr")
+
+class Planner:
+	"""
+	Same passes and junction model as the firmware planner, in double
+	precision and without a ring size limit: the whole job is look-ahead.
+	The firmware sends direction changes with the steps, so reversals keep
+	their junction speed unless stop_on_reversal is set.
+	"""
+	def __init__(self, steps_per_mm, max_rate, accel, junction_deviation=JUNCTION_DEVIATION_MM, stop_on_reversal=False):
+		self.steps_per_mm = steps_per_mm
+		self.max_rate = max_rate
+		self.accel = accel
+		self.junction_deviation = junction_deviation
+		self.stop_on_reversal = stop_on_reversal
+		self.blocks = []
+		self.planned = 0
+		self.position = [0] * len(steps_per_mm)
+		self.previous_unit = [0.0] * len(steps_per_mm)
+		self.previous_nominal_speed_sqr = 0.0
+		self.previous_dir_bits = 0
+		self.previous_valid = False
+
+	def set_position(self, position):
+		self.position = list(position)
+		self.previous_valid = False
+
+	@staticmethod
+	def _limit_by_axes(limits, unit):
+		return min((abs(l / u) for l, u in zip(limits, unit) if u != 0.0), default=math.inf)
+
+	def _recalculate(self):
+		blocks = self.blocks
+		index = len(blocks) - 1
+		current = blocks[index]
+		current.entry_speed_sqr = min(current.max_entry_speed_sqr, 2.0 * current.acceleration * current.millimeters)
+		if index == self.planned:
+			return
+		index -= 1
+		while index != self.planned:
+			nxt = current
+			current = blocks[index]
+			if current.entry_speed_sqr != current.max_entry_speed_sqr:
+				entry = nxt.entry_speed_sqr + 2.0 * current.acceleration * current.millimeters
+				current.entry_speed_sqr = min(entry, current.max_entry_speed_sqr)
+			index -= 1
+
+		nxt = blocks[self.planned]
+		for index in range(self.planned + 1, len(blocks)):
+			current = nxt
+			nxt = blocks[index]
+			if current.entry_speed_sqr < nxt.entry_speed_sqr:
+				entry = current.entry_speed_sqr + 2.0 * current.acceleration * current.millimeters
+				if entry < nxt.entry_speed_sqr:
+					nxt.entry_speed_sqr = entry
+					self.planned = index
+			if nxt.entry_speed_sqr == nxt.max_entry_speed_sqr:
+				self.planned = index
+
+	def buffer_line(self, target, feed):
+		"""Queue a move to `target` (steps); feed in mm/s, 0 for a rapid."""
+		n = len(self.steps_per_mm)
+		block = _PlanBlock()
+		block.steps = [abs(t - p) for t, p in zip(target, self.position)]
+		block.dir_bits = sum(1 << i for i in range(n) if target[i] < self.position[i])
+		block.lead_steps = max(block.steps)
+		if block.lead_steps == 0:
+			return
+		delta_mm = [(t - p) / k for t, p, k in zip(target, self.position, self.steps_per_mm)]
+		block.millimeters = math.sqrt(sum(d * d for d in delta_mm))
+		unit = [d / block.millimeters for d in delta_mm]
+		block.acceleration = self._limit_by_axes(self.accel, unit)
+		rapid = self._limit_by_axes(self.max_rate, unit)
+		nominal = min(feed, rapid) if feed > 0.0 else rapid
+		block.nominal_speed_sqr = nominal * nominal
+
+		junction_speed_sqr = 0.0
+		moving = sum(1 << i for i in range(n) if block.steps[i])
+		reversed_ = ((block.dir_bits ^ self.previous_dir_bits) & moving) != 0
+		if self.previous_valid and not (self.stop_on_reversal and reversed_):
+			cos_theta = -sum(p * u for p, u in zip(self.previous_unit, unit))
+			if cos_theta < -0.999999:
+				junction_speed_sqr = math.inf
+			elif cos_theta <= 0.999999:
+				junction_unit = [u - p for u, p in zip(unit, self.previous_unit)]
+				norm = math.sqrt(sum(j * j for j in junction_unit))
+				junction_unit = [j / norm for j in junction_unit]
+				junction_accel = self._limit_by_axes(self.accel, junction_unit)
+				sin_theta_d2 = math.sqrt(0.5 * (1.0 - cos_theta))
+				junction_speed_sqr = junction_accel * self.junction_deviation * sin_theta_d2 / (1.0 - sin_theta_d2)
+		block.max_entry_speed_sqr = min(junction_speed_sqr, block.nominal_speed_sqr, self.previous_nominal_speed_sqr)
+		if not self.previous_valid:
+			block.max_entry_speed_sqr = 0.0
+		block.entry_speed_sqr = 0.0
+
+		self.blocks.append(block)
+		self.position = list(target)
+		self.previous_unit = unit
+		self.previous_nominal_speed_sqr = block.nominal_speed_sqr
+		self.previous_dir_bits = (self.previous_dir_bits & ~moving) | block.dir_bits
+		self.previous_valid = True
+		self._recalculate()
+
+	def motion_blocks(self):
+		"""Convert every queued block like planner_pop() with flush; the last one ends at rest."""
+		out = []
+		for index, block in enumerate(self.blocks):
+			exit_speed_sqr = self.blocks[index + 1].entry_speed_sqr if index + 1 < len(self.blocks) else 0.0
+			steps_per_mm = block.lead_steps / block.millimeters
+			accel = block.acceleration * steps_per_mm
+			entry_sqr = block.entry_speed_sqr * steps_per_mm ** 2
+			exit_sqr = exit_speed_sqr * steps_per_mm ** 2
+			cruise_sqr = block.nominal_speed_sqr * steps_per_mm ** 2
+			accel_steps = (cruise_sqr - entry_sqr) / (2.0 * accel)
+			decel_steps = (cruise_sqr - exit_sqr) / (2.0 * accel)
+			if accel_steps + decel_steps > block.lead_steps:
+				accel_steps = max(0.0, min(block.lead_steps, (2.0 * accel * block.lead_steps + exit_sqr - entry_sqr) / (4.0 * accel)))
+				decel_steps = block.lead_steps - accel_steps
+				cruise_sqr = entry_sqr + 2.0 * accel * accel_steps
+			cruise_rate = max(_to_rate(cruise_sqr), 1)
+			decel = int(max(0.0, math.ceil(min(decel_steps - 1e-3, block.lead_steps))))
+			out.append((block.dir_bits, RAMP_TRAPEZOID, *block.steps, block.lead_steps,
+				_to_rate(entry_sqr), cruise_rate, _to_rate(exit_sqr), int(round(max(accel, 1.0))), decel))
+		self.blocks = []
+		self.planned = 0
+		self.previous_valid = False
+		return out
+
+def _to_rate(speed_sqr: float) -> int:
+	rate = math.sqrt(max(speed_sqr, 0.0))
+	return RAMP_MAX_RATE if rate >= RAMP_MAX_RATE else int(round(rate))
+
+def block_seconds(block) -> float:
+	"""Duration of one block's lead-axis trapezoid."""
+	lead, entry, cruise, exit_, accel, decel = block[6:12]
+	accel_steps = min(lead - decel, (cruise * cruise - entry * entry) / (2.0 * accel))
+	seconds = (cruise - entry) / accel + (cruise - exit_) / accel
+	return seconds + max(0.0, lead - decel - accel_steps) / cruise
+
+# ---------------------- Main ----------------------
+
+def compile_job(path: str, limits, junction_deviation: float):
+	"""Returns (start steps, blocks)."""
+	steps_per_mm, max_rate, accel = limits
+	planner = Planner(steps_per_mm, max_rate, accel, junction_deviation)
+	modal = _Modal()
+	start = None
+	for source, number, line in expand_job(path):
+		try:
+			move = gcode_to_move(line, modal)
+		except ValueError as e:
+			raise ValueError(f"{source}:{number}: {line}  ({e})")
+		if move is None:
+			continue
+		target_mm, feed, rapid = move
+		target = [round(mm * k) for mm, k in zip(target_mm, steps_per_mm)]
+		if start is None:
+			start = target
+			planner.set_position(target)
+			continue
+		planner.buffer_line(target, 0.0 if rapid else feed / 60.0)
+	if start is None:
+		raise ValueError(f"{path}: no moves")
+	return start, planner.motion_blocks()
+
+def main():
+	parser = argparse.ArgumentParser(description="Precompile G-code into a block stream for home.py %%PLAY.")
+	parser.add_argument("job")
+	parser.add_argument("-o", "--output", help="default: the job with a .rblk suffix")
+	parser.add_argument("--config", default=os.path.join(os.path.dirname(os.path.abspath(__file__)), "config_xyza.yaml"))
+	parser.add_argument("--junction-deviation", type=float, default=JUNCTION_DEVIATION_MM, help="mm, as the firmware")
+	args = parser.parse_args()
+
+	output = args.output or os.path.splitext(args.job)[0] + ".rblk"
+	try:
+		start, blocks = compile_job(args.job, load_axis_limits(args.config), args.junction_deviation)
+	except (OSError, ValueError) as e:
+		print(f"[ERR] {e}", file=sys.stderr)
+		return 1
+	with open(output, "wb") as f:
+		f.write(STREAM_HEADER.pack(STREAM_MAGIC, STREAM_VERSION, len(LINK_AXES), 0, *start))
+		for block in blocks:
+			f.write(BLOCK_FMT.pack(*block))
+	seconds = sum(block_seconds(b) for b in blocks)
+	print(f"[INFO] {len(blocks)} blocks, {os.path.getsize(output)} bytes, about {seconds:.1f} s of motion -> {output}")
+	return 0
+
+if __name__ == "__main__":
+	sys.exit(main())
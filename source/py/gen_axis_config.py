@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Generate the firmware's constexpr axis table from a FluidNC axis config.
+
+  python gen_axis_config.py                      # both build variants
+  python gen_axis_config.py config_xyza.yaml -o ../roboarm2/src/motion/axes_xyza.h
+
+Every variant in VARIANTS becomes src/motion/axes_<name>.h; axis_config.h
+includes the one ROBOARM_AXES_VARIANT selects. Run again after editing a
+YAML and commit the headers with it.
+"""
+
+import sys, os, argparse
+
+import yaml
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+MOTION_DIR = os.path.join(HERE, "..", "roboarm2", "src", "motion")
+
+# ROBOARM_AXES_VARIANT -> YAML next to this script.
+VARIANTS = ["config_xyza.yaml", "config_xyza_lpf.yaml"]
+
+AXIS_NAMES = "xyza"
+
+# The YAML's homing cycles are 0 on every axis; the order the arm needs
+# within one homing step is kept here instead (axis_homing_t::after).
+HOMING_AFTER = {"x": "z"}
+
+# ---------------------- YAML ----------------------
+
+def parse_pin(value):
+	"""(GPIO number or None, active low) of 'gpio.N', 'gpio.N:low' or NO_PIN."""
+	if value is None or str(value).strip().upper() == "NO_PIN":
+		return None, False
+	text = str(value).strip()
+	name, _, attrs = text.partition(":")
+	if not name.startswith("gpio."):
+		raise ValueError(f"unsupported pin {text!r}")
+	return int(name[len("gpio."):]), "low" in attrs.split(":")
+
+def _float(value) -> str:
+	"""C float literal keeping the YAML's digits."""
+	text = repr(float(value))
+	return (text if "." in text or "e" in text else text + ".0") + "f"
+
+def _gpio(number) -> str:
+	return "GPIO_NUM_NC" if number is None else f"GPIO_NUM_{number}"
+
+def axis_entry(name: str, axis: dict) -> str:
+	motor = axis["motor0"]
+	stepper = motor["standard_stepper"]
+	homing = axis.get("homing") or {}
+	step_pin, _ = parse_pin(stepper["step_pin"])
+	dir_pin, dir_invert = parse_pin(stepper["direction_pin"])
+	limit_pin, limit_low = None, False
+	for key in ("limit_neg_pin", "limit_pos_pin", "limit_all_pin"):
+		limit_pin, limit_low = parse_pin(motor.get(key))
+		if limit_pin is not None:
+			break
+	after = " | ".join(f"1u << {AXIS_NAMES.index(a)}" for a in HOMING_AFTER.get(name, "")) or "0"
+	return (
+		f"    {{'{name.upper()}', {_gpio(step_pin)}, {_gpio(dir_pin)}, {'true' if dir_invert else 'false'}, "
+		f"{_float(axis['steps_per_mm'])}, {_float(axis['max_rate_mm_per_min'])}, {_float(axis['acceleration_mm_per_sec2'])},\n"
+		f"     {{{_gpio(limit_pin)}, {'true' if limit_low else 'false'}, {'true' if homing.get('positive_direction') else 'false'}, "
+		f"{_float(homing.get('mpos_mm', 0.0))}, {_float(homing.get('seek_mm_per_min', 0.0))}, "
+		f"{_float(homing.get('feed_mm_per_min', 0.0))}, {_float(motor.get('pulloff_mm', 0.0))}, "
+		f"{_float(axis.get('max_travel_mm', 0.0))}, {_float(homing.get('seek_scaler', 1.1))}, "
+		f"{_float(homing.get('feed_scaler', 1.1))}, {int(homing.get('settle_ms', 0))}, {after}}}}},"
+	)
+
+def generate(path: str) -> str:
+	with open(path, "r", encoding="utf-8") as f:
+		cfg = yaml.safe_load(f)
+	axes = cfg.get("axes") or {}
+	missing = [a for a in AXIS_NAMES if a not in axes]
+	if missing:
+		raise ValueError(f"{path}: no axis {', '.join(missing)}")
+	lines = [
+		f"// Generated by source/py/gen_axis_config.py from {os.path.basename(path)}, do not edit.",
+		"// Included by axis_config.h.",
+		"#pragma once",
+		"",
+		"inline constexpr axis_config_t AXES[AXIS_COUNT] = {",
+		*(axis_entry(a, axes[a]) for a in AXIS_NAMES),
+		"};",
+		"",
+		f"inline constexpr uint32_t HOMING_RUNS = {int(axes.get('homing_runs', 1))};",
+		f"inline constexpr float JUNCTION_DEVIATION_MM = {_float(cfg.get('junction_deviation_mm', 0.01))};",
+		f"inline constexpr float ARC_TOLERANCE_MM = {_float(cfg.get('arc_tolerance_mm', 0.002))};",
+		"",
+	]
+	return "\n".join(lines)
+
+# ---------------------- Main ----------------------
+
+def main():
+	parser = argparse.ArgumentParser(description="Generate src/motion/axes_*.h from FluidNC axis configs.")
+	parser.add_argument("config", nargs="?", help="one YAML; default: every build variant")
+	parser.add_argument("-o", "--output", help="header for a single config")
+	args = parser.parse_args()
+
+	if args.config:
+		name = os.path.splitext(os.path.basename(args.config))[0]
+		jobs = [(args.config, args.output or os.path.join(MOTION_DIR, f"axes_{name[len('config_'):] or name}.h"))]
+	else:
+		jobs = [(os.path.join(HERE, v), os.path.join(MOTION_DIR, f"axes_{os.path.splitext(v)[0][len('config_'):]}.h"))
+			for v in VARIANTS]
+	for config, output in jobs:
+		try:
+			text = generate(config)
+		except (OSError, KeyError, ValueError) as e:
+			print(f"[ERR] {config}: {e}", file=sys.stderr)
+			return 1
+		with open(output, "w", encoding="utf-8", newline="\n") as f:
+			f.write(text)
+		print(f"[INFO] {os.path.basename(config)} -> {os.path.relpath(output)}")
+	return 0
+
+if __name__ == "__main__":
+	sys.exit(main())
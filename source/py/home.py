@@ -1,131 +1,41 @@
 #!/usr/bin/env python3
 # -*- coding: utf-8 -*-
+"""
+stdin-driven G-code streamer for one or more arms.
 
-import sys, time, threading, queue, argparse, traceback, re, os
-import serial
-
-# ---------------------- RX/State ----------------------
+  python home.py --port COM7
+  python home.py --port left=COM7 --port right=COM8 --stream
 
-_rxq = queue.Queue(maxsize=8192)   # acks only: "ok", "error:...", "alarm:..."
-_last_state = "Unknown"
-_stop = threading.Event()
+Every --port opens one Session; all of them run on one asyncio loop in one
+process. Lines from stdin go to every arm, or only to the arms named by an
+"@left" / "@left,right" prefix. %%FILE jobs are read once and fanned out to
+the same arms, and %%SYNC [label] holds every addressed arm until all of them
+are Idle with nothing in flight, then releases them together.
 
-ALARM_RE = re.compile(r'^alarm:?\s*(\d+)', re.IGNORECASE)
-
-def _rx_loop(ser: serial.Serial):
-	"""
-	Read lines from the controller, print everything to stdout,
-	and push acks (lowercased) into _rxq for the sender to consume.
-	Also track the <State|...> banner for Idle/Run/Home/Hold.
-	"""
-	global _last_state
-	try:
-		while not _stop.is_set():
-			try:
-				raw = ser.readline()
-				if not raw:
-					continue
-				line = raw.decode(errors='ignore').strip()
-				print(f"<< {line}")
-				# Track <State|...>
-				if line.startswith("<"):
-					bar = line.find("|")
-					if bar > 0:
-						_last_state = line[1:bar]
-					elif line.endswith(">"):
-						_last_state = line[1:-1]
-				# Feed acks into queue (lowercased)
-				lower = line.lower()
-				if lower.startswith("ok") or lower.startswith("error") or lower.startswith("alarm"):
-					try:
-						_rxq.put(lower, timeout=0.1)
-					except queue.Full:
-						print("[WARN] RX queue full; dropping ack", file=sys.stderr)
-			except Exception:
-				traceback.print_exc()
-	except Exception:
-		traceback.print_exc()
-
-# ---------------------- Polling helpers ----------------------
+--telemetry HZ asks the native firmware for binary position/velocity/queue
+samples ($TEL=HZ) and keeps the latest of them per arm in Session.telemetry,
+a ring of TelemetrySample for live plots; --telemetry-log also writes every
+sample to a CSV file.
 
-POLL_INTERVAL_S = 0.25
+%%SPOOL job.gcode (or a gcode_compile.py block stream) stores a job in the
+native firmware's flash and %%RUN runs it from there, so a long job no
+longer depends on this process and the USB link keeping up.
+"""
 
-def request_status(ser):
-	try:
-		ser.write(b"?")
-		ser.flush()
-	except Exception as e:
-		print(f"[WARN] status poll failed: {e}", file=sys.stderr)
+import sys, time, threading, argparse, re, os, struct, collections, itertools, asyncio, csv, zlib
+import concurrent.futures
+import serial
 
-def wait_until_idle(ser, timeout_s=180.0):
-	"""
-	Poll until controller reports Idle. Guarantees at least one fresh poll
-	AFTER this function begins to avoid returning on a stale 'Idle'.
-	"""
-	start = time.time()
-	request_status(ser)
-	time.sleep(POLL_INTERVAL_S)
-
-	while (time.time() - start) < timeout_s:
-		if _last_state == "Idle":
-			time.sleep(POLL_INTERVAL_S)
-			request_status(ser)
-			time.sleep(0.02)
-			if _last_state == "Idle":
-				return True
-		else:
-			time.sleep(POLL_INTERVAL_S)
-			request_status(ser)
-	print(f"[TIMEOUT] still not Idle, last state '{_last_state}' after {timeout_s}s", file=sys.stderr)
-	return False
+ALARM_RE = re.compile(r'^alarm:?\s*(\d+)', re.IGNORECASE)
 
-def wait_motion_complete(ser, leave_idle_timeout=2.0, finish_timeout=300.0):
-	"""
-	For motion/homing: first observe a transition away from Idle (Run/Home/Hold),
-	then wait until Idle again.
-	"""
-	start = time.time()
-	# phase 1: wait until we SEE non-Idle (or time out)
-	request_status(ser)
-	while (time.time() - start) < leave_idle_timeout:
-		if _last_state != "Idle":
-			break
-		time.sleep(POLL_INTERVAL_S)
-		request_status(ser)
-	# phase 2: now wait for completion
-	return wait_until_idle(ser, timeout_s=finish_timeout)
-
-# ---------------------- TX/Ack primitives ----------------------
-
-def send_line(ser: serial.Serial, s: str):
-	if not s.endswith("\n"):
-		s += "\n"
-	ser.write(s.encode("utf-8"))
-	ser.flush()
-
-def wait_ack(timeout_s=12.0):
-	deadline = time.time() + timeout_s
-	while time.time() < deadline:
-		try:
-			return _rxq.get(timeout=0.25)  # lowercased
-		except queue.Empty:
-			pass
-	return None
+# The firmware pushes a <State> line on every change; waits sleep on the
+# session's state event and only send '?' again if nothing arrives for
+# POLL_INTERVAL_S (controllers that do not push).
+POLL_INTERVAL_S = 0.25
 
-def send_gcode(ser: serial.Serial, gcode: str, retries=1, ack_timeout=12.0):
-	for attempt in range(1, retries + 1):
-		print(f">> {gcode}  (try {attempt}/{retries})")
-		send_line(ser, gcode)
-		ack = wait_ack(timeout_s=ack_timeout)
-		if ack is None:
-			print(f"[TIMEOUT] no reply for: {gcode}", file=sys.stderr)
-			continue
-		if ack.startswith("ok"):
-			return True, ack
-		print(f"[FW] {ack}  for: {gcode}", file=sys.stderr)
-		if attempt < retries:
-			time.sleep(0.2)
-	return False, ack if ack else "timeout"
+# Ports without a selectable file descriptor (Windows) are read this often,
+# from the loop, instead of through loop.add_reader.
+RX_POLL_S = 0.002
 
 def parse_alarm_code(ack_line: str):
 	"""Return int alarm code or None"""
@@ -137,153 +47,1035 @@ def parse_alarm_code(ack_line: str):
 	except ValueError:
 		return None
 
-def unlock_after_alarm(ser: serial.Serial):
-	# Typical GRBL/FluidNC unlock
-	send_line(ser, "$X")
-	time.sleep(0.2)
-	# Flush any backlog of immediate messages
-	while True:
-		try:
-			_rxq.get_nowait()
-		except queue.Empty:
-			break
+# ---------------------- Binary link (--binary) ----------------------
+#
+# Mirrors source/roboarm2/src/link/protocol.h:
+#   0xA5 0x5A | type | len | payload | crc16 (CCITT-FALSE over type..payload, LE)
+# MOVE payload: <HBBf4i  seq, flags, reserved, feed mm/min, absolute steps X Y Z A
+# ACK payload:  <HBB     last accepted seq, status, free move slots
+# BLOCK payload: <HBB4I6I seq, dir_bits, profile, steps X Y Z A, lead_steps,
+#                entry/cruise/exit rate, accel, decel_steps (link_block_t)
+# TELEMETRY payload: <I4i4i6BH time_us, position steps X Y Z A, rate steps/s
+#                X Y Z A, motion/planner blocks, moves queued, machine state,
+#                feed/rapid override %, sample seq (link_telemetry_t)
+# SPOOL payload: <HxxI seq, offset; then up to 56 bytes of the job being
+#                stored (link_spool_t)
+
+LINK_SYNC = b"\xa5\x5a"
+LINK_FRAME_MOVE = 0x01
+LINK_FRAME_PING = 0x02
+LINK_FRAME_BLOCK = 0x03
+LINK_FRAME_SPOOL = 0x04
+LINK_FRAME_ACK = 0x81
+LINK_FRAME_TELEMETRY = 0x82
+LINK_ACK_OK = 0
+LINK_ACK_RESEND = 1
+LINK_ACK_REJECTED = 2
+LINK_MOVE_RAPID = 0x01
+LINK_MOVE_FMT = struct.Struct("<HBBf4i")
+LINK_BLOCK_FMT = struct.Struct("<HBB4I6I")
+LINK_ACK_FMT = struct.Struct("<HBB")
+LINK_TELEMETRY_FMT = struct.Struct("<I4i4i6BH")
+LINK_SPOOL_FMT = struct.Struct("<HxxI")
+LINK_SPOOL_DATA = 64 - LINK_SPOOL_FMT.size
+LINK_AXES = ("x", "y", "z", "a")
+
+# machine_state_t, in firmware order
+MACHINE_STATES = ("Idle", "Run", "Home", "Hold", "Alarm")
+
+TelemetrySample = collections.namedtuple("TelemetrySample",
+	"time_us position rate motion_blocks planner_blocks moves state feed_percent rapid_percent seq")
+
+def decode_telemetry(payload: bytes):
+	"""TelemetrySample of a TELEMETRY payload, None if it is not one."""
+	if len(payload) != LINK_TELEMETRY_FMT.size:
+		return None
+	f = LINK_TELEMETRY_FMT.unpack(payload)
+	n = len(LINK_AXES)
+	state = MACHINE_STATES[f[2 * n + 4]] if f[2 * n + 4] < len(MACHINE_STATES) else "Unknown"
+	return TelemetrySample(f[0], f[1:1 + n], f[1 + n:1 + 2 * n], f[2 * n + 1], f[2 * n + 2], f[2 * n + 3],
+		state, f[2 * n + 5], f[2 * n + 6], f[2 * n + 7])
+
+TELEMETRY_LOG_HEADER = (["arm", "time_us"] + [f"pos_{a}" for a in LINK_AXES] + [f"rate_{a}" for a in LINK_AXES] +
+	["motion_blocks", "planner_blocks", "moves", "state", "feed_percent", "rapid_percent", "seq"])
+
+def _crc16(data: bytes, crc=0xFFFF) -> int:
+	for b in data:
+		crc ^= b << 8
+		for _ in range(8):
+			crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+			crc &= 0xFFFF
+	return crc
+
+def _encode_frame(ftype: int, payload: bytes = b"") -> bytes:
+	body = bytes((ftype, len(payload))) + payload
+	return LINK_SYNC + body + struct.pack("<H", _crc16(body))
+
+def _seq_after(a: int, b: int) -> bool:
+	"""True if 16-bit sequence number a comes after b."""
+	return 0 < ((a - b) & 0xFFFF) < 0x8000
+
+def load_steps_per_mm(path: str):
+	"""steps_per_mm of X Y Z A from a config_xyza.yaml style file."""
+	import yaml
+	with open(path, "r", encoding="utf-8") as f:
+		cfg = yaml.safe_load(f)
+	axes = cfg.get("axes") or {}
+	return [float(axes[name]["steps_per_mm"]) for name in LINK_AXES]
+
+_WORD_RE = re.compile(r'([A-Z])\s*([-+]?[0-9]*\.?[0-9]+)')
 
-def send_homing_with_retries(ser: serial.Serial, homing_cmd: str, max_tries=5, ack_timeout=20.0):
+class _Modal:
+	"""Just enough G-code state to turn G0/G1 lines into absolute targets."""
+	def __init__(self):
+		self.position = [0.0] * len(LINK_AXES)
+		self.absolute = True
+		self.rapid = True
+		self.feed = 0.0
+
+def gcode_to_move(line: str, modal: _Modal):
 	"""
-	Start homing by sending the command; consider it 'started' if either:
-	- we receive an immediate ack ('ok'/'error'/'alarm'), OR
-	- we observe a transition away from Idle within leave_idle_timeout.
-	Alarms 8/9 trigger unlock+retry. Others fail.
+	Update `modal` from one line. Returns (target_mm, feed, rapid) for a move,
+	None for a line without motion; raises ValueError for anything the binary
+	link cannot express.
 	"""
-	leave_idle_timeout = 3.0  # short window to detect motion start
-	for i in range(1, max_tries + 1):
-		print(f">> {homing_cmd}  (try {i}/{max_tries})")
-		send_line(ser, homing_cmd)
-
-		# Wait briefly for an ack OR motion start
-		start = time.time()
-		started = False
-		ack = None
-		while (time.time() - start) < leave_idle_timeout:
+	words = _WORD_RE.findall(line.upper())
+	if not words:
+		raise ValueError("not a G-code line")
+	target = list(modal.position)
+	moved = False
+	for letter, value in words:
+		v = float(value)
+		if letter == "G":
+			g = int(v)
+			if g in (0, 1):
+				modal.rapid = g == 0
+			elif g == 90:
+				modal.absolute = True
+			elif g == 91:
+				modal.absolute = False
+			else:
+				raise ValueError(f"G{value} not supported")
+		elif letter == "F":
+			modal.feed = v
+		elif letter.lower() in LINK_AXES:
+			i = LINK_AXES.index(letter.lower())
+			target[i] = v if modal.absolute else target[i] + v
+			moved = True
+		elif letter != "N":
+			raise ValueError(f"word {letter} not supported")
+	if not moved:
+		return None
+	modal.position = target
+	return target, modal.feed, modal.rapid
+
+# ---------------------- Precompiled block streams (%%PLAY) ----------------------
+#
+# Written by gcode_compile.py. Header <4sHBB4i: magic, version, axis count,
+# reserved, start position in steps. Then BLOCK_FMT records, a BLOCK payload
+# without its seq. The first block starts at rest from the start position.
+
+STREAM_MAGIC = b"RBLK"
+STREAM_VERSION = 1
+STREAM_HEADER = struct.Struct("<4sHBB4i")
+BLOCK_FMT = struct.Struct("<BB4I6I")
+
+def read_block_stream(path: str):
+	"""Returns (start_steps, [block tuples]); raises ValueError on a bad file."""
+	with open(path, "rb") as f:
+		data = f.read()
+	if len(data) < STREAM_HEADER.size:
+		raise ValueError("file too short")
+	magic, version, axes, _, *start = STREAM_HEADER.unpack_from(data)
+	if magic != STREAM_MAGIC or version != STREAM_VERSION or axes != len(LINK_AXES):
+		raise ValueError(f"not a v{STREAM_VERSION} {len(LINK_AXES)}-axis block stream")
+	body = data[STREAM_HEADER.size:]
+	if len(body) % BLOCK_FMT.size:
+		raise ValueError("truncated block")
+	return start, [b for b in BLOCK_FMT.iter_unpack(body)]
+
+# ---------------------- Stored jobs (%%SPOOL, %%RUN) ----------------------
+#
+# Mirrors source/roboarm2/src/link/job_spool.h: $JOB=<kind>,<bytes>,<crc32>
+# makes room on the device, SPOOL frames carry the bytes and $JOB reports
+# [JOB:<kind>,<bytes>,<crc32>]. $JOB RUN starts the job, which reports
+# [JOB END:<how>|MPos:<joints>] once it has queued its last move. G-code is
+# stored as the firmware runs it: comments stripped, %%FILE expanded.
+
+JOB_GCODE, JOB_BLOCKS = 0, 1
+JOB_KINDS = ("G-code", "block stream")
+# The device answers $JOB= once the flash is erased, which runs well above this.
+JOB_ERASE_BYTES_PER_S = 16384
+# %%RUN polls the state this often while it waits for [JOB END]; at Idle or
+# Alarm it also asks $JOB whether the job still runs. A device that answers
+# no '?' for JOB_SILENT_S ends the wait.
+JOB_CHECK_S = 2.0
+JOB_SILENT_S = 10.0
+JOB_END_RE = re.compile(r'^\[JOB END:([^|\]]*)(?:\|MPos:([^\]]*))?\]')
+
+def _job_gcode_lines(path: str, depth: int, out: list):
+	base_dir = os.path.dirname(path) or "."
+	for raw in iter_file_lines(path):
+		line = _strip_inline_comment(raw).strip()
+		if not line:
+			continue
+		if line.startswith("%%FILE"):
+			if depth + 1 >= _MAX_FILE_INCLUDE_DEPTH:
+				raise ValueError(f"%%FILE nesting limit ({_MAX_FILE_INCLUDE_DEPTH}) reached")
+			_job_gcode_lines(_parse_file_path(line[len("%%FILE"):], base_dir), depth + 1, out)
+			continue
+		if line.startswith(("%%", "$", "@")):
+			raise ValueError(f"'{line}' cannot run from the device")
+		out.append(line)
+
+def read_spool_job(path: str):
+	"""(kind, bytes) of a job file for %%SPOOL; raises OSError or ValueError."""
+	with open(path, "rb") as f:
+		data = f.read()
+	if data.startswith(STREAM_MAGIC):
+		read_block_stream(path)   # the checks of %%PLAY
+		return JOB_BLOCKS, data
+	lines = []
+	_job_gcode_lines(path, 0, lines)
+	if not lines:
+		raise ValueError("no G-code lines")
+	return JOB_GCODE, ("\n".join(lines) + "\n").encode("utf-8")
+
+# ---------------------- Work items ----------------------
+
+# Outbound work items, kind first:
+# - (WORK_GCODE, "G0 X10")
+# - (WORK_HOME,)               (special)
+# - (WORK_PLAY, "job.rblk")    (special, --binary only)
+# - (WORK_SYNC, SyncBarrier)   (special)
+# - (WORK_SPOOL, "job.gcode")  (special)
+# - (WORK_RUN,)                (special)
+# - (WORK_QUIT,)               (special)
+# Every session's queue is short on purpose: input is read lazily and the
+# dispatcher waits as soon as one arm waits on its device window, so memory
+# stays flat whatever the job size.
+WORK_GCODE, WORK_HOME, WORK_PLAY, WORK_QUIT, WORK_SYNC, WORK_SPOOL, WORK_RUN = range(7)
+WORKQ_DEPTH = 256
+
+class SyncBarrier:
+	"""
+	One %%SYNC: released when all `parties` sessions have arrived. Every
+	waiter resumes in the same loop iteration, so their next lines leave
+	back to back.
+	"""
+	def __init__(self, label: str, parties: int):
+		self.label = label
+		self.parties = parties
+		self.arrived = 0
+		self.first = None
+		self.released = asyncio.Event()
+
+	async def wait(self, stop: asyncio.Event) -> bool:
+		now = time.monotonic()
+		self.arrived += 1
+		if self.first is None:
+			self.first = now
+		if self.arrived >= self.parties:
+			print(f">> %%SYNC {self.label}: {self.parties} arm(s) released, {now - self.first:.3f}s after the first")
+			self.released.set()
+		while not self.released.is_set():
+			if stop.is_set():
+				return False
 			try:
-				ack = _rxq.get(timeout=0.2)
-				if ack.startswith("ok"):
-					started = True
-					break
-				if ack.startswith("alarm") or ack.startswith("error"):
-					break
-			except queue.Empty:
+				await asyncio.wait_for(self.released.wait(), POLL_INTERVAL_S)
+			except asyncio.TimeoutError:
 				pass
-			# Poll for status change
-			request_status(ser)
-			if _last_state != "Idle":
-				started = True
-				break
+		return True
+
+# ---------------------- Session ----------------------
+
+class Session:
+	"""
+	One controller on one serial port: RX parsing, <State> tracking, the ack
+	queue, the --stream window, the --binary credit window and the work queue
+	its sender drains.
+	"""
+	def __init__(self, name: str, port: str, args, cell, steps_per_mm=None):
+		self.name = name
+		self.tag = f"[{name}] " if len(args.port) > 1 else ""
+		self.args = args
+		self.cell = cell
+		self.steps_per_mm = steps_per_mm
+		self.ser = serial.Serial(port, args.baud, timeout=0, write_timeout=0)
+		self.work = asyncio.Queue(maxsize=WORKQ_DEPTH)
+		self.closing = False   # %%QUIT dispatched, takes no more work
+
+		# RX/State
+		self.acks = asyncio.Queue()   # acks only: "ok", "error:...", "alarm:..." (lowercased)
+		self.state = "Unknown"
+		self.state_gen = 0            # bumped on every <State> report
+		self._state_event = asyncio.Event()
+		self._rxbuf = bytearray()
+		self._text = bytearray()
+		self._poll_task = None
+
+		# TX: bytes the port has not taken yet, sent from the loop's writer
+		self._txbuf = bytearray()
+		self._tx_loop = None          # loop watching the descriptor, None while polled or detached
+		self._tx_armed = False        # writer registered
+
+		# --stream: [line, nbytes, attempt], oldest first
+		self.window = collections.deque()
+		self.window_bytes = 0
+		self.rx_buffer = args.rx_buffer if args.stream else 0
+
+		# --binary
+		self.link_acked = None        # last seq the device accepted, None until the first ACK
+		self.link_free = 0            # free move slots reported with that ACK
+		self.link_resend = False
+		self.link_inflight = {}       # seq -> frame bytes, sent but not acknowledged
+		self.link_rejects = 0         # REJECTED ACKs since the port opened
+		self._link_event = asyncio.Event()
+
+		# stored jobs
+		self.job_report = None        # last [JOB:...] line
+		self.job_end = None           # (how, joints or None) of the last [JOB END:...]
+		self._job_event = asyncio.Event()
+
+		# --telemetry: newest samples, oldest first
+		self.telemetry = collections.deque(maxlen=args.telemetry_ring)
+		self.telemetry_lost = 0       # samples missing from the seq numbers
+		self._telemetry_seq = None
+
+	@property
+	def stopped(self) -> bool:
+		return self.cell.stop.is_set()
+
+	def log(self, msg: str):
+		print(f"{self.tag}{msg}")
+
+	def err(self, msg: str):
+		print(f"{self.tag}{msg}", file=sys.stderr)
+
+	def write(self, data: bytes):
+		"""
+		Queue `data` behind what the port has not taken yet; never blocks the
+		loop. Where the port has a descriptor the loop's writer sends it once
+		the port is writable, else the non-blocking write hands it over now.
+		"""
+		self._txbuf += data
+		if self._tx_loop is None:
+			self._send_tx()
+		elif not self._tx_armed:
+			self._tx_loop.add_writer(self.ser.fileno(), self._on_writable)
+			self._tx_armed = True
 
-		if ack and (ack.startswith("alarm") or ack.startswith("error")) and not started:
-			alarm = parse_alarm_code(ack)
-			if alarm in (8, 9):
-				print(f"[INFO] Homing alarm {alarm} on try {i}/{max_tries}. Unlock + retry …", file=sys.stderr)
-				unlock_after_alarm(ser)
-				time.sleep(0.5)
+	def _send_tx(self):
+		# one non-blocking write: pyserial returns what the port took
+		if not self._txbuf:
+			return
+		try:
+			del self._txbuf[:self.ser.write(self._txbuf)]
+		except serial.SerialException as e:
+			self._txbuf.clear()
+			self.err(f"[ERR] write failed: {e}")
+			self.cell.abort()
+
+	def _on_writable(self):
+		self._send_tx()
+		if not self._txbuf:
+			self._tx_loop.remove_writer(self.ser.fileno())
+			self._tx_armed = False
+
+	# ---- RX ----
+
+	def attach(self, loop: asyncio.AbstractEventLoop):
+		"""
+		Serve the port from `loop`: read and write on readiness where the OS
+		allows it, else read by polling.
+		"""
+		try:
+			loop.add_reader(self.ser.fileno(), self._on_readable)
+		except (AttributeError, NotImplementedError, OSError, ValueError):
+			self._poll_task = loop.create_task(self._poll_rx())
+			return
+		self._tx_loop = loop
+		if self._txbuf:
+			loop.add_writer(self.ser.fileno(), self._on_writable)
+			self._tx_armed = True
+
+	def detach(self, loop: asyncio.AbstractEventLoop):
+		if self._poll_task:
+			self._poll_task.cancel()
+		else:
+			try:
+				loop.remove_reader(self.ser.fileno())
+				if self._tx_armed:
+					loop.remove_writer(self.ser.fileno())
+			except (AttributeError, NotImplementedError, OSError, ValueError):
+				pass
+		self._tx_loop = None
+		self._tx_armed = False
+		if self._txbuf:
+			# on the way out: what is left (e.g. $TEL=0) goes out blocking, bounded
+			self.ser.write_timeout = 1.0
+			try:
+				self.ser.write(self._txbuf)
+			except serial.SerialException:
+				pass
+			self._txbuf.clear()
+
+	def _on_readable(self):
+		try:
+			self._feed(self.ser.read(self.ser.in_waiting or 1))
+		except serial.SerialException as e:
+			self.err(f"[ERR] read failed: {e}")
+			self.cell.abort()
+
+	async def _poll_rx(self):
+		while True:
+			try:
+				waiting = self.ser.in_waiting
+				if waiting:
+					self._feed(self.ser.read(waiting))
+				self._send_tx()
+			except serial.SerialException as e:
+				self.err(f"[ERR] read failed: {e}")
+				self.cell.abort()
+				return
+			await asyncio.sleep(RX_POLL_S)
+
+	def _feed(self, chunk: bytes):
+		"""
+		Split the byte stream into link frames and console text. Text lines are
+		printed, acks queued and <State> reports tracked; ACK frames update the
+		link window. Plain ASCII firmware never sends a sync byte, so both modes
+		share this parser.
+		"""
+		buf = self._rxbuf
+		buf += chunk
+		while buf:
+			sync = buf.find(LINK_SYNC)
+			if sync < 0:
+				# keep a trailing first sync byte, the second may still arrive
+				sync = len(buf) - 1 if buf.endswith(LINK_SYNC[:1]) else len(buf)
+			self._text += buf[:sync]
+			del buf[:sync]
+			while b"\n" in self._text:
+				line, _, rest = self._text.partition(b"\n")
+				self._text = bytearray(rest)
+				self._on_line(line.decode(errors="ignore").strip())
+			if len(buf) < 4:
+				break
+			length = buf[3]
+			if len(buf) < length + 6:
+				break
+			body = bytes(buf[2:4 + length])
+			crc = struct.unpack_from("<H", buf, 4 + length)[0]
+			if crc != _crc16(body):
+				del buf[:1]   # not a frame after all, resync past this byte
 				continue
-			print(f"[ERR] Non-recoverable response during homing: {ack}", file=sys.stderr)
-			return False
+			del buf[:length + 6]
+			if body[0] == LINK_FRAME_ACK:
+				self._on_link_ack(body[2:])
+			elif body[0] == LINK_FRAME_TELEMETRY:
+				self._on_telemetry(body[2:])
 
-		if not started:
-			print("[ERR] Homing did not start (no ack / no motion).", file=sys.stderr)
-			# Try an unlock in case we were alarmed and missed it
-			unlock_after_alarm(ser)
-			time.sleep(0.5)
-			continue
+	def _on_line(self, line: str):
+		if not line:
+			return
+		self.log(f"<< {line}")
+		self._track_state(line)
+		self._track_job(line)
+		lower = line.lower()
+		if lower.startswith("ok") or lower.startswith("error") or lower.startswith("alarm"):
+			self.acks.put_nowait(lower)
+
+	def _track_state(self, line: str):
+		"""Record a <State|...> report and wake whoever waits on a state."""
+		if not line.startswith("<"):
+			return
+		bar = line.find("|")
+		if bar > 0:
+			state = line[1:bar]
+		elif line.endswith(">"):
+			state = line[1:-1]
+		else:
+			return
+		self.state = state
+		self.state_gen += 1
+		self._state_event.set()
+
+	def _track_job(self, line: str):
+		"""Record a [JOB:...] report or the [JOB END:...] of a stored job."""
+		if line.startswith("[JOB:"):
+			self.job_report = line
+			return
+		m = JOB_END_RE.match(line)
+		if not m:
+			return
+		try:
+			joints = [float(v) for v in m.group(2).split(",")] if m.group(2) else None
+		except ValueError:
+			joints = None
+		self.job_end = (m.group(1), joints)
+		self._job_event.set()
+
+	def _on_link_ack(self, payload: bytes):
+		if len(payload) != LINK_ACK_FMT.size:
+			return
+		seq, status, free = LINK_ACK_FMT.unpack(payload)
+		self.link_acked = seq
+		self.link_free = free
+		for s in [s for s in self.link_inflight if not _seq_after(s, seq)]:
+			del self.link_inflight[s]
+		if status == LINK_ACK_RESEND:
+			self.link_resend = True
+		elif status == LINK_ACK_REJECTED:
+			self.link_rejects += 1
+			self.err(f"[FW] frame after seq {seq} rejected")
+		self._link_event.set()
+
+	# ---- Telemetry ----
+
+	def _on_telemetry(self, payload: bytes):
+		sample = decode_telemetry(payload)
+		if sample is None:
+			return
+		if self._telemetry_seq is not None:
+			self.telemetry_lost += (sample.seq - self._telemetry_seq - 1) & 0xFFFF
+		self._telemetry_seq = sample.seq
+		self.telemetry.append(sample)
+		if self.cell.telemetry_log:
+			self.cell.telemetry_log.writerow([self.name, sample.time_us, *sample.position, *sample.rate,
+				sample.motion_blocks, sample.planner_blocks, sample.moves, sample.state,
+				sample.feed_percent, sample.rapid_percent, sample.seq])
 
-		# At this point homing is underway; now wait for completion
-		if wait_motion_complete(ser, leave_idle_timeout=2.0, finish_timeout=max(ack_timeout, 300.0)):
+	async def start_telemetry(self) -> bool:
+		ok, _ = await self.send_gcode(f"$TEL={self.args.telemetry}", ack_timeout=self.args.ack_timeout)
+		return ok
+
+	def stop_telemetry(self):
+		"""Best effort on the way out, so a terminal attached later sees no frames."""
+		try:
+			self.send_line("$TEL=0")
+		except serial.SerialException:
+			pass
+		if self.telemetry_lost:
+			self.log(f"[INFO] telemetry: {self.telemetry_lost} samples lost")
+
+	# ---- State waits ----
+
+	def request_status(self):
+		try:
+			self.write(b"?")
+		except Exception as e:
+			self.err(f"[WARN] status poll failed: {e}")
+
+	async def wait_for_state(self, pred, timeout_s, after_gen):
+		"""
+		Wait until a report newer than generation `after_gen` satisfies pred.
+		Returns True on success, False on timeout.
+		"""
+		deadline = time.monotonic() + timeout_s
+		while not self.stopped:
+			if self.state_gen > after_gen and pred(self.state):
+				return True
+			remaining = deadline - time.monotonic()
+			if remaining <= 0:
+				return False
+			self._state_event.clear()
+			try:
+				await asyncio.wait_for(self._state_event.wait(), min(remaining, POLL_INTERVAL_S))
+			except asyncio.TimeoutError:
+				self.request_status()
+		return False
+
+	async def wait_until_idle(self, timeout_s=180.0):
+		"""
+		Wait until the controller reports Idle. Only reports that arrive after
+		this call count, so a stale 'Idle' cannot end the wait.
+		"""
+		gen = self.state_gen
+		self.request_status()
+		if await self.wait_for_state(lambda st: st == "Idle", timeout_s, gen):
 			return True
-		print("[ERR] Homing did not return to Idle.", file=sys.stderr)
-		# fall through to retry
+		self.err(f"[TIMEOUT] still not Idle, last state '{self.state}' after {timeout_s}s")
+		return False
 
-	print(f"[ERR] Homing failed after {max_tries} tries.", file=sys.stderr)
-	return False
+	# ---- TX/Ack primitives ----
 
+	def send_line(self, s: str):
+		if not s.endswith("\n"):
+			s += "\n"
+		self.write(s.encode("utf-8"))
 
-# ---------------------- Streamer (stdin → queue → sender) ----------------------
+	async def wait_ack(self, timeout_s=12.0):
+		try:
+			return await asyncio.wait_for(self.acks.get(), timeout_s)  # lowercased
+		except asyncio.TimeoutError:
+			return None
 
-# Outbound work items:
-# - {"type":"gcode", "line": "G0 X10"}
-# - {"type":"home"}     (special)
-# - {"type":"quit"}     (special)
-_workq = queue.Queue(maxsize=65536)
+	async def send_gcode(self, gcode: str, retries=1, ack_timeout=12.0):
+		ack = None
+		for attempt in range(1, retries + 1):
+			self.log(f">> {gcode}  (try {attempt}/{retries})")
+			self.send_line(gcode)
+			ack = await self.wait_ack(timeout_s=ack_timeout)
+			if ack is None:
+				self.err(f"[TIMEOUT] no reply for: {gcode}")
+				continue
+			if ack.startswith("ok"):
+				return True, ack
+			self.err(f"[FW] {ack}  for: {gcode}")
+			if attempt < retries:
+				await asyncio.sleep(0.2)
+		return False, ack if ack else "timeout"
 
-def _perform_home_sequence(ser: serial.Serial, homing_retries: int) -> bool:
-	"""
-	Your exact multi-step homing/train sequence with waits in between.
-	Returns True on success, False on first failure.
-	"""
-	steps = [
-		lambda: send_homing_with_retries(ser, "$HZ", max_tries=homing_retries),
-		lambda: wait_motion_complete(ser),
-		lambda: send_gcode(ser, "g0 z0")[0],
-		lambda: wait_motion_complete(ser),
+	# ---- Character-counting stream (--stream) ----
+	#
+	# GRBL-style: keep sending while the bytes of all un-acked lines fit the
+	# controller's serial RX buffer. Acks arrive in line order, so the oldest
+	# entry of the window is the one each ack belongs to.
+
+	async def _window_take_ack(self, ack: str):
+		line, nbytes, attempt = self.window.popleft()
+		self.window_bytes -= nbytes
+		if ack.startswith("ok"):
+			return
+		self.err(f"[FW] {ack}  for: {line}")
+		if attempt < self.args.line_retries:
+			# resent behind whatever is already in flight
+			await self.stream_line(line, attempt=attempt + 1)
+		else:
+			self.err(f"[ERR] giving up on line: {line}  (last: {ack})")
+
+	async def _window_wait_ack(self):
+		ack = await self.wait_ack(timeout_s=self.args.ack_timeout)
+		if ack is None:
+			# cannot tell which lines were lost; start counting afresh
+			self.err(f"[TIMEOUT] no reply for {len(self.window)} streamed line(s); resetting window")
+			self.window.clear()
+			self.window_bytes = 0
+			return
+		await self._window_take_ack(ack)
+
+	async def stream_line(self, line: str, attempt=1):
+		"""Send `line` as soon as it fits the controller RX buffer, without waiting for its ack."""
+		nbytes = len(line.encode("utf-8")) + 1
+		while self.window and self.window_bytes + nbytes > self.rx_buffer and not self.stopped:
+			await self._window_wait_ack()
+		self.log(f">> {line}  (try {attempt}/{self.args.line_retries}, {self.window_bytes + nbytes}/{self.rx_buffer} bytes in flight)")
+		self.send_line(line)
+		self.window.append([line, nbytes, attempt])
+		self.window_bytes += nbytes
+
+	async def poll_window(self):
+		"""Consume acks that have already arrived, without blocking."""
+		while self.window and not self.acks.empty():
+			await self._window_take_ack(self.acks.get_nowait())
+
+	async def drain_window(self):
+		"""Wait until every streamed line is acknowledged (before macros and exit)."""
+		while self.window and not self.stopped:
+			await self._window_wait_ack()
+
+	# ---- Binary link (--binary) ----
+
+	async def link_sync(self, timeout_s=2.0):
+		"""PING until the device answers; returns the seq to continue after, or None."""
+		deadline = time.monotonic() + timeout_s
+		while time.monotonic() < deadline and self.link_acked is None:
+			self._link_event.clear()
+			self.write(_encode_frame(LINK_FRAME_PING))
+			try:
+				await asyncio.wait_for(self._link_event.wait(), 0.25)
+			except asyncio.TimeoutError:
+				pass
+		return self.link_acked
+
+	def _resend_inflight(self):
+		base = self.link_acked or 0
+		for s in sorted(self.link_inflight, key=lambda s: (s - base) & 0xFFFF):
+			self.write(self.link_inflight[s])
+
+	async def _send_windowed(self, seq: int, frame: bytes, ack_timeout: float):
+		"""
+		Send one numbered frame without waiting for its ACK. Waits only while the
+		device has no free slot; resends the window on RESEND or ACK timeout.
+		"""
+		deadline = time.monotonic() + ack_timeout
+		while not self.stopped:
+			if self.link_resend:
+				self.link_resend = False
+				self._resend_inflight()
+			if len(self.link_inflight) < self.link_free:
+				break
+			self._link_event.clear()
+			try:
+				await asyncio.wait_for(self._link_event.wait(), 0.25)
+				continue
+			except asyncio.TimeoutError:
+				pass
+			if self.link_inflight and time.monotonic() > deadline:
+				self.err(f"[TIMEOUT] no ACK after seq {self.link_acked}; resending {len(self.link_inflight)} move(s)")
+				self._resend_inflight()
+				deadline = time.monotonic() + ack_timeout
+			elif not self.link_inflight:
+				# the device only reports freed slots when asked
+				self.write(_encode_frame(LINK_FRAME_PING))
+		if self.stopped:
+			return False
+		self.link_inflight[seq] = frame
+		self.write(frame)
+		return True
+
+	async def send_move_binary(self, seq: int, steps, feed: float, rapid: bool, ack_timeout=12.0):
+		"""Send one MOVE frame inside the credit window."""
+		flags = LINK_MOVE_RAPID if rapid else 0
+		frame = _encode_frame(LINK_FRAME_MOVE, LINK_MOVE_FMT.pack(seq, flags, 0, feed, *steps))
+		return await self._send_windowed(seq, frame, ack_timeout)
 
-		lambda: send_homing_with_retries(ser, "$HA", max_tries=homing_retries),
-		lambda: wait_motion_complete(ser),
+	async def send_block_binary(self, seq: int, block, ack_timeout=12.0):
+		"""Send one precompiled block (a BLOCK_FMT tuple) inside the credit window."""
+		frame = _encode_frame(LINK_FRAME_BLOCK, LINK_BLOCK_FMT.pack(seq, *block))
+		return await self._send_windowed(seq, frame, ack_timeout)
 
-		lambda: send_homing_with_retries(ser, "$HY", max_tries=homing_retries),
-		lambda: wait_motion_complete(ser),
+	async def wait_link_drained(self, timeout_s=12.0):
+		"""Wait until every sent move has been acknowledged."""
+		deadline = time.monotonic() + timeout_s
+		while self.link_inflight and not self.stopped:
+			if time.monotonic() > deadline:
+				return False
+			self._link_event.clear()
+			try:
+				await asyncio.wait_for(self._link_event.wait(), 0.25)
+			except asyncio.TimeoutError:
+				pass
+		return True
 
-		lambda: send_gcode(ser, "g0 y45")[0],
-		lambda: wait_motion_complete(ser),
+	async def play_block_stream(self, path: str, seq: int, ack_timeout: float) -> int:
+		"""
+		Rapid to the stream's start through the planner, then send every block.
+		Returns the last sequence number used.
+		"""
+		try:
+			start, blocks = read_block_stream(path)
+		except (OSError, ValueError) as e:
+			self.err(f"[ERR] %%PLAY cannot load '{path}': {e}")
+			return seq
+		self.log(f">> %%PLAY BEGIN  {path}  ({len(blocks)} blocks)")
+		seq = (seq + 1) & 0xFFFF
+		await self.send_move_binary(seq, start, 0.0, True, ack_timeout=ack_timeout)
+		for block in blocks:
+			if self.stopped:
+				break
+			seq = (seq + 1) & 0xFFFF
+			await self.send_block_binary(seq, block, ack_timeout=ack_timeout)
+		self.log(f">> %%PLAY END    {path}")
+		return seq
 
-		lambda: send_homing_with_retries(ser, "$HZ", max_tries=homing_retries),
-		lambda: wait_motion_complete(ser),
+	# ---- Stored jobs (%%SPOOL, %%RUN) ----
 
-		lambda: send_homing_with_retries(ser, "$HX", max_tries=homing_retries),
-		lambda: wait_motion_complete(ser),
+	async def spool_job(self, path: str, seq: int, ack_timeout: float) -> int:
+		"""
+		Store a G-code file or block stream on the device: $JOB= once the arm is
+		at rest, the bytes as SPOOL frames inside the credit window, then $JOB
+		to check what the device holds. Returns the last sequence number used.
+		"""
+		try:
+			kind, data = read_spool_job(path)
+		except (OSError, ValueError) as e:
+			self.err(f"[ERR] %%SPOOL cannot load '{path}': {e}")
+			return seq
+		if not await self._settled():
+			self.err("[ERR] %%SPOOL: arm did not settle; the device only stores a job at rest")
+			return seq
+		crc = zlib.crc32(data)
+		self.log(f">> %%SPOOL BEGIN  {path}  ({len(data)} bytes, {JOB_KINDS[kind]})")
+		ok, _ = await self.send_gcode(f"$JOB={kind},{len(data)},{crc:08x}",
+			ack_timeout=ack_timeout + len(data) / JOB_ERASE_BYTES_PER_S)
+		if not ok:
+			self.err(f"[ERR] %%SPOOL: the device did not make room for '{path}'")
+			return seq
+		rejects = self.link_rejects
+		for offset in range(0, len(data), LINK_SPOOL_DATA):
+			if self.stopped or self.link_rejects != rejects:
+				break
+			seq = (seq + 1) & 0xFFFF
+			frame = _encode_frame(LINK_FRAME_SPOOL, LINK_SPOOL_FMT.pack(seq, offset) + data[offset:offset + LINK_SPOOL_DATA])
+			await self._send_windowed(seq, frame, ack_timeout)
+		await self.wait_link_drained(timeout_s=ack_timeout)
+		if self.link_rejects != rejects:
+			# the device drops a refused upload; continue after what it took
+			self.link_inflight.clear()
+			seq = self.link_acked
+		self.job_report = None
+		await self.send_gcode("$JOB", ack_timeout=ack_timeout)
+		if self.job_report == f"[JOB:{kind},{len(data)},{crc:08x}]":
+			self.log(f">> %%SPOOL END    {path}  (stored, crc {crc:08x})")
+		else:
+			self.err(f"[ERR] %%SPOOL: '{path}' not stored; the device reports {self.job_report}")
+		return seq
 
-		lambda: send_gcode(ser, "g0 x45 y45 z-45 a45")[0],
-		lambda: wait_motion_complete(ser),
-	]
-	for step in steps:
-		ok = step()
+	async def run_stored_job(self) -> bool:
+		"""
+		$JOB RUN once the arm is at rest, then wait for the job's [JOB END:...].
+		The device queues the moves as this process would, so the wait lasts
+		about as long as the job; it ends early, as a failure, once the device
+		is at rest without running the job or stops answering '?'.
+		"""
+		self.job_end = None
+		if not await self._settled():
+			self.err("[ERR] %%RUN: arm did not settle; a stored job starts at rest")
+			return False
+		ok, ack = await self.send_gcode("$JOB RUN", ack_timeout=self.args.ack_timeout)
 		if not ok:
-			print("[ERR] Homing sequence aborted.", file=sys.stderr)
+			self.err(f"[ERR] %%RUN: the device did not start its stored job ({ack})")
 			return False
-	return True
+		run_gen = gen = self.state_gen
+		self.request_status()
+		answered = time.monotonic()
+		next_check = answered + JOB_CHECK_S
+		while self.job_end is None and not self.stopped:
+			self._job_event.clear()
+			try:
+				await asyncio.wait_for(self._job_event.wait(), POLL_INTERVAL_S)
+				continue
+			except asyncio.TimeoutError:
+				pass
+			now = time.monotonic()
+			if self.state_gen != gen:
+				gen = self.state_gen
+				answered = now
+			elif now - answered > JOB_SILENT_S:
+				self.err(f"[TIMEOUT] %%RUN: no status from the device for {JOB_SILENT_S:.0f}s; giving up on its stored job")
+				return False
+			if now < next_check:
+				continue
+			next_check = now + JOB_CHECK_S
+			if self.state_gen > run_gen and self.state in ("Idle", "Alarm"):
+				# a reset, an alarm or a lost line ends the job without [JOB END]
+				self.job_report = None
+				ok, _ = await self.send_gcode("$JOB", ack_timeout=self.args.ack_timeout)
+				if self.job_end is None and not ok:
+					self.err("[ERR] %%RUN: the device does not answer $JOB; giving up on its stored job")
+					return False
+				if self.job_end is None and not (self.job_report or "").endswith(",RUN]"):
+					self.err(f"[ERR] %%RUN: device is {self.state} and reports {self.job_report}; the stored job is no longer running")
+					return False
+			self.request_status()
+		if self.job_end is None:
+			return False
+		if self.job_end[0] != "ok":
+			self.err(f"[ERR] %%RUN: the stored job ended with {self.job_end[0]}")
+			return False
+		self.log(">> %%RUN END (every move of the job is queued)")
+		return True
 
-def _sender_loop(ser: serial.Serial, homing_retries: int, ack_timeout: float, line_retries: int):
-	while True:
-		if _stop.is_set():
-			return
+	# ---- Open/wake ----
+
+	async def wake_and_sync(self):
+		self.ser.reset_input_buffer()
+		self.ser.reset_output_buffer()
+		self._txbuf.clear()
+		self.write(b"\r\n\r\n")
+		await asyncio.sleep(1.5)
+		self.ser.reset_input_buffer()
+
+	def close(self):
 		try:
-			item = _workq.get(timeout=0.1)
-		except queue.Empty:
-			continue
+			self.ser.close()
+		except Exception:
+			pass
 
-		t = item.get("type")
+	# ---- Senders ----
+
+	async def _next_work(self):
+		"""Next work item, handling streamed acks while the queue is empty; None on shutdown."""
+		while not self.stopped:
+			try:
+				return self.work.get_nowait()
+			except asyncio.QueueEmpty:
+				pass
+			await self.poll_window()
+			try:
+				return await asyncio.wait_for(self.work.get(), 0.1)
+			except asyncio.TimeoutError:
+				continue
+		return None
 
-		if t == "quit":
-			print(">> %%QUIT — shutting down")
-			_stop.set()
+	async def _settled(self) -> bool:
+		"""Everything sent is acknowledged and the arm has stopped moving."""
+		if self.args.binary:
+			if not await self.wait_link_drained(timeout_s=self.args.ack_timeout):
+				self.err(f"[TIMEOUT] moves after seq {self.link_acked} never acknowledged")
+				return False
+		else:
+			await self.drain_window()
+		return await self.wait_until_idle(timeout_s=self.args.homing_timeout)
+
+	async def _sync(self, barrier: SyncBarrier):
+		self.log(f">> %%SYNC {barrier.label}: waiting for the arm to settle")
+		if not await self._settled():
+			self.err(f"[ERR] %%SYNC {barrier.label}: arm did not settle — ABORTING")
+			self.cell.abort()
 			return
+		await barrier.wait(self.cell.stop)
 
-		if t == "home":
-			print(">> %%HOME (begin sequence)")
-			ok = _perform_home_sequence(ser, homing_retries)
-			if ok:
-				print(">> %%HOME (done)")
+	async def run(self):
+		try:
+			if self.args.telemetry and not await self.start_telemetry():
+				self.err("[ERR] firmware did not take $TEL — ABORTING")
+				self.cell.abort()
+				return
+			if self.args.binary:
+				await self._binary_sender_loop()
 			else:
-				print(">> %%HOME (FAILED) — ABORTING", file=sys.stderr)
-				_stop.set()
+				await self._sender_loop()
+		finally:
+			self.closing = True
+			self.cell.session_done()
+
+	async def _perform_home_sequence(self) -> bool:
+		"""
+		Run the firmware's stored homing program ($H). The device retries alarms
+		8/9 itself and answers once, with 'ok' or the alarm that ended it.
+		"""
+		homing_timeout = self.args.homing_timeout
+		self.log(">> $H")
+		self.send_line("$H")
+		ack = await self.wait_ack(timeout_s=homing_timeout)
+		if ack is None:
+			# '!' aborts the run on the device, which then stays in Alarm
+			self.err(f"[TIMEOUT] homing did not finish within {homing_timeout}s; aborting it")
+			self.write(b"!")
+			return False
+		if ack.startswith("ok"):
+			return True
+		alarm = parse_alarm_code(ack)
+		if alarm is not None:
+			self.err(f"[ERR] Homing failed with alarm {alarm}; '$X' unlocks.")
+		else:
+			self.err(f"[FW] {ack}  for: $H")
+		return False
+
+	async def _sender_loop(self):
+		"""--stream sends lines with character counting instead of stop-and-wait."""
+		while True:
+			item = await self._next_work()
+			if item is None:
 				return
-			continue
 
-		if t == "gcode":
-			line = item["line"]
-			ok, ack = send_gcode(ser, line, retries=line_retries, ack_timeout=ack_timeout)
-			if not ok:
-				print(f"[ERR] giving up on line: {line}  (last: {ack})", file=sys.stderr)
-			continue
+			t = item[0]
+			if t != WORK_GCODE:
+				await self.drain_window()
+
+			if t == WORK_QUIT:
+				self.log(">> %%QUIT — closing")
+				return
+
+			if t == WORK_SYNC:
+				await self._sync(item[1])
+				continue
+
+			if t == WORK_HOME:
+				self.log(">> %%HOME (begin sequence)")
+				if await self._perform_home_sequence():
+					self.log(">> %%HOME (done)")
+				else:
+					self.err(">> %%HOME (FAILED) — ABORTING")
+					self.cell.abort()
+					return
+				continue
+
+			if t == WORK_PLAY:
+				self.err("[WARN] %%PLAY needs --binary; skipped")
+				continue
+
+			if t == WORK_SPOOL:
+				# SPOOL frames need the link's sequence, whatever the mode
+				seq = self.link_acked if self.link_acked is not None else await self.link_sync()
+				if seq is None:
+					self.err("[ERR] %%SPOOL: no answer to link PING; is this the native firmware?")
+					continue
+				await self.spool_job(item[1], seq, self.args.ack_timeout)
+				continue
+
+			if t == WORK_RUN:
+				await self.run_stored_job()
+				continue
+
+			if t == WORK_GCODE and self.rx_buffer > 0:
+				await self.stream_line(item[1])
+				continue
+
+			if t == WORK_GCODE:
+				line = item[1]
+				ok, ack = await self.send_gcode(line, retries=self.args.line_retries, ack_timeout=self.args.ack_timeout)
+				if not ok:
+					self.err(f"[ERR] giving up on line: {line}  (last: {ack})")
+				continue
+
+	async def _binary_sender_loop(self):
+		"""
+		--binary: G0/G1 lines become MOVE frames streamed inside the device's
+		credit window, %%PLAY sends a precompiled stream as BLOCK frames and
+		%%SPOOL stores a job as SPOOL frames.
+		Other macros and commands have no binary form yet.
+		"""
+		ack_timeout = self.args.ack_timeout
+		seq = await self.link_sync()
+		if seq is None:
+			self.err("[ERR] no answer to link PING; is the firmware in binary mode?")
+			self.cell.abort()
+			return
+		modal = _Modal()
+		while True:
+			item = await self._next_work()
+			if item is None:
+				return
+
+			t = item[0]
+
+			if t == WORK_QUIT:
+				self.log(">> %%QUIT — waiting for outstanding moves")
+				await self.wait_link_drained(timeout_s=ack_timeout)
+				return
+
+			if t == WORK_SYNC:
+				await self._sync(item[1])
+				continue
+
+			if t == WORK_HOME:
+				self.err("[WARN] %%HOME is not available in --binary mode; skipped")
+				continue
+
+			if t == WORK_PLAY:
+				seq = await self.play_block_stream(item[1], seq, ack_timeout)
+				continue
+
+			if t == WORK_SPOOL:
+				seq = await self.spool_job(item[1], seq, ack_timeout)
+				continue
+
+			if t == WORK_RUN:
+				await self.run_stored_job()
+				if self.job_end and self.job_end[1]:
+					# later lines continue from where the job left the arm
+					modal.position = self.job_end[1]
+				continue
+
+			if t == WORK_GCODE:
+				line = item[1]
+				try:
+					move = gcode_to_move(line, modal)
+				except ValueError as e:
+					self.err(f"[WARN] skipped in --binary mode: {line}  ({e})")
+					continue
+				if move is None:
+					continue
+				target_mm, feed, rapid = move
+				seq = (seq + 1) & 0xFFFF
+				steps = [round(mm * k) for mm, k in zip(target_mm, self.steps_per_mm)]
+				self.log(f">> #{seq} {line}")
+				await self.send_move_binary(seq, steps, feed, rapid, ack_timeout=ack_timeout)
+				continue
 
 # ---------------------- File include support ----------------------
 
@@ -325,111 +1117,299 @@ def _parse_file_path(arg: str, base_dir: str) -> str:
 		arg = os.path.normpath(os.path.join(base_dir, arg))
 	return arg
 
-def _enqueue_line_text(raw_line: str, base_dir: str, depth: int):
+_INCLUDE_READ_LINES = 4096
+
+def iter_file_lines(path: str):
+	"""
+	Yield the lines of `path` lazily. The file is read _INCLUDE_READ_LINES at
+	a time and closed in between, so includes waiting on a full queue hold no
+	handles. Raises OSError if it cannot be opened.
+	"""
+	pos = 0
+	while True:
+		with open(path, "rb") as f:
+			f.seek(pos)
+			chunk = list(itertools.islice(f, _INCLUDE_READ_LINES))
+			pos = f.tell()
+		for raw in chunk:
+			yield raw.decode("utf-8", errors="ignore")
+		if len(chunk) < _INCLUDE_READ_LINES:
+			return
+
+# ---------------------- Cell (stdin → sessions) ----------------------
+
+class Cell:
 	"""
-	Process a single textual line: handle directives (%%HOME, %%FILE, %%QUIT),
-	otherwise enqueue as G-code. Strips comments/blank lines.
+	The arms of one process. Parses input lines once and puts the resulting
+	work on the queue of every addressed session; a shared job file is read a
+	single time whatever the number of arms.
 	"""
-	line = _strip_inline_comment(raw_line).strip()
-	if not line:
-		return
+	def __init__(self):
+		self.sessions = {}
+		self.stop = asyncio.Event()
+		self._done = asyncio.Event()
+		self._running = 0
+		self._sync_count = 0
+		self.telemetry_log = None   # csv.writer of --telemetry-log
 
-	if line.startswith("%%QUIT"):
-		_workq.put({"type":"quit"})
-		return
+	def add(self, session: Session):
+		self.sessions[session.name] = session
+		self._running += 1
 
-	if line.startswith("%%HOME"):
-		_workq.put({"type":"home"})
-		return
+	def abort(self):
+		self.stop.set()
 
-	if line.startswith("%%FILE"):
-		if depth >= _MAX_FILE_INCLUDE_DEPTH:
-			print(f"[ERR] %%FILE nesting limit ({_MAX_FILE_INCLUDE_DEPTH}) reached; skipping.", file=sys.stderr)
+	def session_done(self):
+		self._running -= 1
+		if self._running <= 0:
+			self._done.set()
+
+	async def wait_done(self):
+		await self._done.wait()
+
+	def _targets(self, names=None):
+		sessions = self.sessions.values() if names is None else (self.sessions[n] for n in names)
+		return [s for s in sessions if not s.closing]
+
+	async def _put(self, item, targets):
+		for s in targets:
+			while not self.stop.is_set() and not s.closing:
+				try:
+					await asyncio.wait_for(s.work.put(item), POLL_INTERVAL_S)
+					break
+				except asyncio.TimeoutError:
+					continue
+
+	def _address(self, line: str, names):
+		"""Split an '@a,b' prefix off `line`; returns (rest, names) or None if it names no arm."""
+		if not line.startswith("@"):
+			return line, names
+		prefix, _, rest = line[1:].partition(" ")
+		wanted = [n for n in prefix.split(",") if n]
+		unknown = [n for n in wanted if n not in self.sessions]
+		if unknown or not wanted:
+			print(f"[ERR] no arm named {', '.join(unknown) or repr(prefix)}; known: {', '.join(self.sessions)}", file=sys.stderr)
+			return None
+		if names is not None and not set(wanted) <= set(names):
+			print(f"[ERR] @{prefix} inside a file for {', '.join(names)}; skipping.", file=sys.stderr)
+			return None
+		return rest.strip(), wanted
+
+	async def dispatch_line(self, raw_line: str, base_dir: str, depth: int, names=None):
+		"""
+		Process a single textual line: handle the arm prefix and directives
+		(%%HOME, %%FILE, %%PLAY, %%SPOOL, %%RUN, %%SYNC, %%QUIT), otherwise
+		queue as G-code.
+		Strips comments/blank lines. `names` are the arms an enclosing
+		%%FILE was addressed to, None for all.
+		"""
+		line = _strip_inline_comment(raw_line).strip()
+		if not line:
+			return
+		addressed = self._address(line, names)
+		if addressed is None:
+			return
+		line, names = addressed
+		if not line:
 			return
-		rest = line[len("%%FILE"):].strip()
-		if not rest:
-			print("[ERR] %%FILE requires a path.", file=sys.stderr)
+		targets = self._targets(names)
+		if not targets:
 			return
-		path = _parse_file_path(rest, base_dir)
-		_enqueue_file_contents(path, depth + 1)
-		return
 
-	# default: gcode
-	_workq.put({"type":"gcode", "line": line})
+		if line.startswith("%%QUIT"):
+			await self._put((WORK_QUIT,), targets)
+			for s in targets:
+				s.closing = True
+			return
 
-def _enqueue_file_contents(path: str, depth: int):
-	try:
-		with open(path, "r", encoding="utf-8", errors="ignore") as f:
-			lines = f.readlines()
-	except Exception as e:
-		print(f"[ERR] %%FILE failed to open '{path}': {e}", file=sys.stderr)
-		return
+		if line.startswith("%%HOME"):
+			await self._put((WORK_HOME,), targets)
+			return
 
-	print(f">> %%FILE BEGIN  {path}  ({len(lines)} lines)")
-	base_dir = os.path.dirname(path) or "."
-	for raw in lines:
-		if _stop.is_set():
-			break
-		_enqueue_line_text(raw, base_dir, depth)
-	print(f">> %%FILE END    {path}")
-
-# ---------------------- Session/wake ----------------------
-
-def wake_and_sync(ser: serial.Serial):
-	ser.reset_input_buffer()
-	ser.reset_output_buffer()
-	ser.write(b"\r\n\r\n")
-	ser.flush()
-	time.sleep(1.5)
-	ser.reset_input_buffer()
+		if line.startswith("%%SYNC"):
+			self._sync_count += 1
+			label = line[len("%%SYNC"):].strip() or f"#{self._sync_count}"
+			await self._put((WORK_SYNC, SyncBarrier(label, len(targets))), targets)
+			return
+
+		if line.startswith("%%PLAY"):
+			rest = line[len("%%PLAY"):].strip()
+			if not rest:
+				print("[ERR] %%PLAY requires a path.", file=sys.stderr)
+				return
+			await self._put((WORK_PLAY, _parse_file_path(rest, base_dir)), targets)
+			return
+
+		if line.startswith("%%SPOOL"):
+			rest = line[len("%%SPOOL"):].strip()
+			if not rest:
+				print("[ERR] %%SPOOL requires a path.", file=sys.stderr)
+				return
+			await self._put((WORK_SPOOL, _parse_file_path(rest, base_dir)), targets)
+			return
+
+		if line.startswith("%%RUN"):
+			await self._put((WORK_RUN,), targets)
+			return
+
+		if line.startswith("%%FILE"):
+			if depth >= _MAX_FILE_INCLUDE_DEPTH:
+				print(f"[ERR] %%FILE nesting limit ({_MAX_FILE_INCLUDE_DEPTH}) reached; skipping.", file=sys.stderr)
+				return
+			rest = line[len("%%FILE"):].strip()
+			if not rest:
+				print("[ERR] %%FILE requires a path.", file=sys.stderr)
+				return
+			path = _parse_file_path(rest, base_dir)
+			await self.dispatch_file(path, depth + 1, names)
+			return
+
+		# default: gcode
+		await self._put((WORK_GCODE, line), targets)
+
+	async def dispatch_file(self, path: str, depth: int, names=None):
+		try:
+			size = os.path.getsize(path)
+		except OSError as e:
+			print(f"[ERR] %%FILE failed to open '{path}': {e}", file=sys.stderr)
+			return
+
+		to = "" if names is None else f"  -> {', '.join(names)}"
+		print(f">> %%FILE BEGIN  {path}  ({size} bytes){to}")
+		base_dir = os.path.dirname(path) or "."
+		count = 0
+		try:
+			for raw in iter_file_lines(path):
+				if self.stop.is_set():
+					break
+				await self.dispatch_line(raw, base_dir, depth, names)
+				count += 1
+		except OSError as e:
+			print(f"[ERR] %%FILE failed reading '{path}': {e}", file=sys.stderr)
+		print(f">> %%FILE END    {path}  ({count} lines)")
 
 # ---------------------- Main ----------------------
 
+def _parse_ports(specs):
+	"""'COM7' or 'left=COM7' -> [(name, port)]; unnamed ports are called arm0, arm1, ..."""
+	ports = []
+	for i, spec in enumerate(specs):
+		name, sep, port = spec.partition("=")
+		if not sep:
+			name, port = f"arm{i}", spec
+		if not name or not port or "," in name or " " in name:
+			raise ValueError(f"bad --port '{spec}', expected PORT or NAME=PORT")
+		if any(n == name for n, _ in ports):
+			raise ValueError(f"arm name '{name}' used twice")
+		ports.append((name, port))
+	return ports
+
+def _stdin_reader(loop: asyncio.AbstractEventLoop, lines: asyncio.Queue):
+	"""
+	The one thread besides the loop: blocking stdin reads, handed over one at
+	a time so a full work queue holds the reader back. None marks EOF.
+	"""
+	try:
+		for raw in sys.stdin:
+			asyncio.run_coroutine_threadsafe(lines.put(raw), loop).result()
+		asyncio.run_coroutine_threadsafe(lines.put(None), loop).result()
+	except (RuntimeError, concurrent.futures.CancelledError):
+		pass   # loop closed, or shutting down with the put pending
+
+async def _produce(cell: Cell, lines: asyncio.Queue):
+	stdin_base_dir = os.getcwd()
+	while not cell.stop.is_set():
+		raw = await lines.get()
+		if raw is None:
+			# stdin closed: keep running until %%QUIT or Ctrl+C
+			print("[INFO] stdin closed — session remains open. Use %%QUIT or Ctrl+C to exit.")
+			return
+		await cell.dispatch_line(raw, stdin_base_dir, depth=0)
+
+async def _run(args, ports):
+	loop = asyncio.get_running_loop()
+	steps_per_mm = load_steps_per_mm(args.config) if args.binary else None
+	cell = Cell()
+	try:
+		for name, port in ports:
+			cell.add(Session(name, port, args, cell, steps_per_mm))
+	except serial.SerialException as e:
+		for s in cell.sessions.values():
+			s.close()
+		print(f"[ERR] {e}", file=sys.stderr)
+		return 1
+
+	sessions = list(cell.sessions.values())
+	log_file = None
+	try:
+		if args.telemetry_log:
+			try:
+				log_file = open(args.telemetry_log, "w", newline="")
+			except OSError as e:
+				print(f"[ERR] {e}", file=sys.stderr)
+				return 1
+			cell.telemetry_log = csv.writer(log_file)
+			cell.telemetry_log.writerow(TELEMETRY_LOG_HEADER)
+		if not args.no_wake:
+			await asyncio.gather(*(s.wake_and_sync() for s in sessions))
+		for s in sessions:
+			s.attach(loop)
+		senders = [loop.create_task(s.run()) for s in sessions]
+
+		lines = asyncio.Queue(maxsize=1)
+		threading.Thread(target=_stdin_reader, args=(loop, lines), daemon=True).start()
+		producer = loop.create_task(_produce(cell, lines))
+
+		# all sessions closed (%%QUIT) or one of them aborted the cell
+		stop = loop.create_task(cell.stop.wait())
+		await asyncio.wait([loop.create_task(cell.wait_done()), stop], return_when=asyncio.FIRST_COMPLETED)
+		cell.stop.set()
+		producer.cancel()
+		await asyncio.wait(senders, timeout=2.0)
+	finally:
+		# Graceful shutdown
+		for s in sessions:
+			if args.telemetry:
+				s.stop_telemetry()
+			s.detach(loop)
+			s.close()
+		if log_file:
+			log_file.close()
+	return 0
+
 def main():
-	parser = argparse.ArgumentParser(description="stdin-driven G-code streamer with %%HOME, %%FILE, and %%QUIT macros.")
-	parser.add_argument("--port", default="COM7")
+	parser = argparse.ArgumentParser(description="stdin-driven G-code streamer for one or more arms, with %%HOME, %%FILE, %%PLAY, %%SPOOL, %%RUN, %%SYNC, and %%QUIT macros.")
+	parser.add_argument("--port", action="append", help="serial port, or NAME=PORT; repeat for several arms (default COM7)")
 	parser.add_argument("--baud", type=int, default=115200)
 	parser.add_argument("--no-wake", action="store_true")
-	parser.add_argument("--homing-retries", type=int, default=5)
+	parser.add_argument("--homing-timeout", type=float, default=600.0, help="seconds to wait for $H (and for Idle at %%SYNC)")
 	parser.add_argument("--ack-timeout", type=float, default=12.0, help="seconds to wait for OK/error/alarm on each line")
 	parser.add_argument("--line-retries", type=int, default=1, help="retries for line-level timeouts")
+	parser.add_argument("--stream", action="store_true", help="character-counting streaming instead of waiting for each ack")
+	parser.add_argument("--rx-buffer", type=int, default=127, help="controller serial RX buffer in bytes for --stream")
+	parser.add_argument("--binary", action="store_true", help="stream moves as binary frames (native firmware, e.g. --baud 921600)")
+	parser.add_argument("--config", default=os.path.join(os.path.dirname(os.path.abspath(__file__)), "config_xyza.yaml"),
+		help="axis config for steps_per_mm in --binary mode")
+	parser.add_argument("--telemetry", type=int, metavar="HZ", help="binary telemetry samples per second, 100..1000 (native firmware)")
+	parser.add_argument("--telemetry-ring", type=int, default=10000, help="telemetry samples kept per arm")
+	parser.add_argument("--telemetry-log", metavar="CSV", help="write every telemetry sample to this file")
 	args = parser.parse_args()
-
-	ser = serial.Serial(args.port, args.baud, timeout=0.1, write_timeout=1.0)
-	if not args.no_wake:
-		wake_and_sync(ser)
-
-	# Start threads
-	rx_t = threading.Thread(target=_rx_loop, args=(ser,), daemon=True)
-	tx_t = threading.Thread(target=_sender_loop, args=(ser, args.homing_retries, args.ack_timeout, args.line_retries), daemon=True)
-	rx_t.start()
-	tx_t.start()
-
-	# Producer: read stdin and enqueue work; after EOF keep session alive
-	stdin_base_dir = os.getcwd()
+	if not args.port:
+		args.port = ["COM7"]
 	try:
-		for raw in sys.stdin:
-			if _stop.is_set():
-				break
-			_enqueue_line_text(raw, stdin_base_dir, depth=0)
-
-		# stdin closed: keep running until %%QUIT or Ctrl+C
-		print("[INFO] stdin closed — session remains open. Use %%QUIT or Ctrl+C to exit.")
-		while not _stop.is_set():
-			time.sleep(0.25)
+		ports = _parse_ports(args.port)
+	except ValueError as e:
+		parser.error(str(e))
+	if args.telemetry is not None and not 100 <= args.telemetry <= 1000:
+		parser.error("--telemetry takes 100..1000 Hz")
+	if args.telemetry_log and not args.telemetry:
+		parser.error("--telemetry-log needs --telemetry")
 
+	try:
+		return asyncio.run(_run(args, ports))
 	except KeyboardInterrupt:
 		print("\n[INFO] KeyboardInterrupt — shutting down")
-		_stop.set()
-	finally:
-		# Graceful shutdown
-		tx_t.join(timeout=2.0)
-		_stop.set()
-		rx_t.join(timeout=1.0)
-		try:
-			ser.close()
-		except Exception:
-			pass
+		return 0
 
 if __name__ == "__main__":
-	main()
+	sys.exit(main())
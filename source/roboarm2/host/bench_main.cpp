@@ -0,0 +1,125 @@
+// roboarm_bench: host throughput of the planner and the step encoder.
+//
+//   roboarm_bench                  synthetic job, short joint segments
+//   roboarm_bench job.gcode        a real one
+//   roboarm_bench --gpio-dir ...   direction pins on GPIO, planner stops at reversals
+//
+// Plans the job into blocks (blocks/s), then runs the blocks through the
+// stream encoder with no output (symbols/s, steps/s and how much faster than
+// the arm would move). Each phase repeats until it has run for MIN_SECONDS
+// and the best round is reported, in the [bench] format of the firmware's
+// step benchmark.
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "sim.h"
+#include "motion/axis_config.h"
+
+constexpr double MIN_SECONDS = 0.5;
+constexpr size_t SYNTHETIC_MOVES = 4000;
+
+using bench_clock = std::chrono::steady_clock;
+
+// A random walk of short G1 segments with a rapid now and then, the kind of
+// job that keeps the look-ahead full. Same moves on every run.
+static std::vector<sim_move_t> synthetic_job(void) {
+    std::vector<sim_move_t> moves;
+    uint32_t seed = 12345;
+    float joints[AXIS_COUNT] = {};
+    for (size_t n = 0; n < SYNTHETIC_MOVES; n++) {
+        for (size_t i = 0; i < AXIS_COUNT; i++) {
+            seed = seed * 1664525u + 1013904223u;
+            const float delta = static_cast<float>(seed >> 8) / (1u << 24) * 6.0f - 3.0f;
+            joints[i] = joints[i] + delta > 90.0f || joints[i] + delta < -90.0f ? joints[i] - delta : joints[i] + delta;
+        }
+        sim_move_t move = {};
+        axes_to_steps(joints, move.target);
+        move.feed = n % 50 == 49 ? 0.0f : (n % 2 ? 3000.0f : 1500.0f) / 60.0f;
+        moves.push_back(move);
+    }
+    return moves;
+}
+
+static void collect(void *ctx, const motion_block_t &block) {
+    static_cast<std::vector<motion_block_t> *>(ctx)->push_back(block);
+}
+
+// Best seconds per round of `round`, repeated for at least MIN_SECONDS.
+template<typename F>
+static double best_round(F &&round) {
+    double best = 1e30;
+    double total = 0.0;
+    do {
+        const auto start = bench_clock::now();
+        round();
+        const double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+        best = std::min(best, seconds);
+        total += seconds;
+    } while (total < MIN_SECONDS);
+    return best;
+}
+
+int main(int argc, char **argv) {
+    bool paired = true;
+    std::string job;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--gpio-dir") == 0) {
+            paired = false;
+        } else if (argv[i][0] != '-' && job.empty()) {
+            job = argv[i];
+        } else {
+            fprintf(stderr, "usage: roboarm_bench [--gpio-dir] [job.gcode]\n");
+            return 2;
+        }
+    }
+    std::vector<sim_move_t> moves;
+    if (job.empty()) {
+        moves = synthetic_job();
+    } else {
+        std::string error;
+        if (!sim_read_job(job, moves, error)) {
+            fprintf(stderr, "[ERR] %s\n", error.c_str());
+            return 1;
+        }
+    }
+    printf("[bench] %s: %zu moves, direction %s\n", job.empty() ? "synthetic job" : job.c_str(), moves.size(),
+           paired ? "in the stream" : "on GPIO");
+
+    std::vector<motion_block_t> blocks;
+    const double plan_s = best_round([&] {
+        blocks.clear();
+        sim_plan(moves, !paired, collect, &blocks);
+    });
+    printf("[bench] planner %zu blocks in %.3f ms, %.0f blocks/s\n", blocks.size(), plan_s * 1e3, blocks.size() / plan_s);
+
+    uint64_t symbols = 0;
+    uint64_t steps = 0;
+    uint64_t ticks = 0;
+    const double encode_s = best_round([&] {
+        sim_encoder_t encoder = {};
+        sim_encoder_init(encoder, paired);
+        for (const motion_block_t &block : blocks) {
+            sim_encoder_push(encoder, block);
+        }
+        sim_encoder_finish(encoder);
+        symbols = steps = ticks = 0;
+        for (const auto &channels : encoder.stats) {
+            for (const sim_channel_stats_t &stats : channels) {
+                symbols += stats.symbols;
+                steps += stats.steps;
+                ticks = std::max(ticks, stats.ticks);
+            }
+        }
+    });
+    const double motion_s = static_cast<double>(ticks) / motion_timing::TICKS_PER_S;
+    printf("[bench] encoder %llu symbols in %.3f ms, %.0f symbols/s\n", static_cast<unsigned long long>(symbols), encode_s * 1e3,
+           symbols / encode_s);
+    printf("[bench] encoder %llu steps, %.0f steps/s, %.1f s of motion, %.0fx real time\n", static_cast<unsigned long long>(steps),
+           steps / encode_s, motion_s, motion_s / encode_s);
+    printf("[bench] done\n");
+    return 0;
+}
@@ -0,0 +1,259 @@
+#include "sim.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include "link/gcode_parser.h"
+#include "motion/axis_config.h"
+
+// %%FILE nesting, as home.py allows.
+constexpr int MAX_INCLUDE_DEPTH = 8;
+// Ticks every channel advances per round while draining, 1 ms.
+constexpr uint64_t ROUND_TICKS = motion_timing::TICKS_PER_S / 1000;
+
+constexpr uint64_t FNV_OFFSET = 0xcbf29ce484222325ull;
+constexpr uint64_t FNV_PRIME = 0x100000001b3ull;
+
+struct job_reader_t {
+    gcode_parser_t parser;
+    gcode_modal_t modal;
+    std::vector<sim_move_t> *moves;
+    std::string *error;
+};
+
+// home.py's _parse_file_path: quotes stripped, relative to the including file.
+static std::string include_path(std::string arg, const std::string &base) {
+    while (!arg.empty() && (arg.back() == ' ' || arg.back() == '\t')) {
+        arg.pop_back();
+    }
+    if (arg.size() >= 2 && (arg.front() == '"' || arg.front() == '\'') && arg.back() == arg.front()) {
+        arg = arg.substr(1, arg.size() - 2);
+    }
+    if (arg.empty() || arg.front() == '/') {
+        return arg;
+    }
+    const size_t slash = base.find_last_of('/');
+    return slash == std::string::npos ? arg : base.substr(0, slash + 1) + arg;
+}
+
+// One G-code line through the console parser, like serial_link.cpp.
+static bool feed_line(job_reader_t &reader, const std::string &line, const std::string &where) {
+    std::string text = line;
+    text += '\n';
+    for (const char c : text) {
+        const gcode_result_t result = gcode_parser_feed(reader.parser, c);
+        gcode_error_t error = GCODE_OK;
+        if (result == GCODE_ERROR) {
+            error = reader.parser.error;
+        } else if (result == GCODE_LINE) {
+            bool moved = false;
+            error = gcode_modal_apply(reader.modal, reader.parser.line, moved);
+            if (error == GCODE_OK && moved) {
+                float joints[AXIS_COUNT];
+                sim_move_t move = {};
+                for (size_t i = 0; i < AXIS_COUNT; i++) {
+                    joints[i] = static_cast<float>(reader.modal.position[i]) / GCODE_SCALE;
+                }
+                axes_to_steps(joints, move.target);
+                move.feed = reader.modal.rapid ? 0.0f : static_cast<float>(reader.modal.feed) / GCODE_SCALE / 60.0f;
+                reader.moves->push_back(move);
+            }
+        }
+        if (error != GCODE_OK) {
+            *reader.error = where + ": error:" + std::to_string(static_cast<int>(error));
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool read_file(job_reader_t &reader, const std::string &path, int depth) {
+    std::ifstream file(path);
+    if (!file) {
+        *reader.error = path + ": cannot open";
+        return false;
+    }
+    std::string line;
+    for (size_t number = 1; std::getline(file, line); number++) {
+        const size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos) {
+            continue;
+        }
+        const std::string where = path + ":" + std::to_string(number);
+        if (line.compare(start, 2, "%%") == 0) {
+            if (line.compare(start, 6, "%%FILE") != 0) {
+                continue;
+            }
+            if (depth + 1 >= MAX_INCLUDE_DEPTH) {
+                *reader.error = where + ": %%FILE nesting limit reached";
+                return false;
+            }
+            std::string arg = line.substr(start + 6);
+            arg.erase(0, arg.find_first_not_of(" \t"));
+            if (!arg.empty() && arg.back() == '\r') {
+                arg.pop_back();
+            }
+            if (!read_file(reader, include_path(arg, path), depth + 1)) {
+                return false;
+            }
+            continue;
+        }
+        if (line[start] == '$') {
+            continue;
+        }
+        if (!feed_line(reader, line, where)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool sim_read_job(const std::string &path, std::vector<sim_move_t> &moves, std::string &error) {
+    job_reader_t reader = {};
+    gcode_parser_reset(reader.parser);
+    gcode_modal_init(reader.modal);
+    reader.moves = &moves;
+    reader.error = &error;
+    return read_file(reader, path, 0);
+}
+
+void sim_plan(const std::vector<sim_move_t> &moves, bool stop_on_reversal, void (*emit)(void *ctx, const motion_block_t &block),
+              void *ctx) {
+    planner_config_t config = {};
+    config.axis_count = AXIS_COUNT;
+    for_each_axis([&](auto axis, size_t i) {
+        config.mm_per_step[i] = axis.MM_PER_STEP;
+        config.max_rate[i] = AXES[i].max_rate_mm_per_min / 60.0f;
+        config.accel[i] = AXES[i].accel_mm_per_s2;
+    });
+    config.junction_deviation = JUNCTION_DEVIATION_MM;
+    config.stop_on_reversal = stop_on_reversal;
+    auto planner = std::make_unique<planner_t>();
+    planner_init(*planner, config);
+
+    // tasks.cpp commit_blocks(); once ROBOARM_PLANNER_COMMIT_BLOCKS are in
+    // the ring it never drains below that again, the job being ahead of the arm
+    size_t committed = 0;
+    const auto commit = [&](bool flush) {
+        motion_block_t block;
+        while ((planner_full(*planner) || committed < ROBOARM_PLANNER_COMMIT_BLOCKS || flush) && planner_pop(*planner, block, flush)) {
+            committed++;
+            emit(ctx, block);
+        }
+    };
+    for (const sim_move_t &move : moves) {
+        commit(false);
+        planner_buffer_line(*planner, move.target, move.feed);
+    }
+    commit(true);
+}
+
+// As motion_engine.cpp builds them: the axis' max rate at its max acceleration.
+static void build_tables(sim_encoder_t &encoder) {
+    encoder.table_storage.assign(AXIS_COUNT * ROBOARM_ACCEL_TABLE_ENTRIES, 0);
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        const axis_config_t &axis = AXES[i];
+        encoder.tables[i] = {};
+#if ROBOARM_ACCEL_TABLE_ENTRIES
+        const uint32_t accel = std::max<uint32_t>(lroundf(axis.accel_mm_per_s2 * axis.steps_per_mm), 1);
+        const uint32_t max_rate = std::min<uint32_t>(lroundf(axis.max_rate_mm_per_min / 60.0f * axis.steps_per_mm), RAMP_MAX_RATE);
+        accel_table_build(encoder.tables[i], &encoder.table_storage[i * ROBOARM_ACCEL_TABLE_ENTRIES], ROBOARM_ACCEL_TABLE_ENTRIES,
+                          accel, max_rate);
+#endif
+        encoder.stream->tables[i] = encoder.tables[i].speeds ? &encoder.tables[i] : nullptr;
+    }
+}
+
+void sim_encoder_init(sim_encoder_t &encoder, bool paired) {
+    encoder.stream = std::make_unique<step_stream_t>();
+    encoder.paired = paired;
+    build_tables(encoder);
+    step_stream_reset(*encoder.stream, AXIS_COUNT, paired);
+    step_stream_override(*encoder.stream, STEP_OVERRIDE_NONE);
+    encoder.dir_bits = 0;
+    for (size_t d = 0; d < 2; d++) {
+        for (size_t i = 0; i < AXIS_COUNT; i++) {
+            encoder.time[d][i] = 0;
+            encoder.done[d][i] = !paired && d;
+            encoder.stats[d][i] = {};
+            encoder.stats[d][i].hash = FNV_OFFSET;
+        }
+    }
+    encoder.blocks = 0;
+}
+
+static void emit_symbol(sim_encoder_t &encoder, size_t axis, bool direction) {
+    step_symbol_t symbol;
+    const bool more = direction ? step_stream_next_dir_symbol(*encoder.stream, axis, symbol)
+                                : step_stream_next_symbol(*encoder.stream, axis, symbol);
+    if (!more) {
+        encoder.done[direction][axis] = true;
+        return;
+    }
+    sim_channel_stats_t &stats = encoder.stats[direction][axis];
+    const uint32_t ticks = symbol.duration0 + symbol.duration1;
+    stats.symbols++;
+    stats.ticks += ticks;
+    stats.steps += !direction && symbol.level1;
+    for (int byte = 0; byte < 4; byte++) {
+        stats.hash = (stats.hash ^ ((symbol.val >> (8 * byte)) & 0xff)) * FNV_PRIME;
+    }
+    encoder.time[direction][axis] += ticks;
+    if (encoder.sink) {
+        encoder.sink(encoder.ctx, {axis, direction}, symbol);
+    }
+}
+
+// Every channel up to the same tick, ROUND_TICKS past the one furthest
+// behind, like the RMT channels running side by side; until `done` says so.
+template<typename F>
+static void run_until(sim_encoder_t &encoder, F &&done) {
+    while (!done()) {
+        uint64_t behind = UINT64_MAX;
+        for (size_t d = 0; d < 2; d++) {
+            for (size_t i = 0; i < AXIS_COUNT; i++) {
+                if (!encoder.done[d][i]) {
+                    behind = std::min(behind, encoder.time[d][i]);
+                }
+            }
+        }
+        if (behind == UINT64_MAX) {
+            return;
+        }
+        const uint64_t horizon = behind + ROUND_TICKS;
+        for (size_t i = 0; i < AXIS_COUNT; i++) {
+            for (size_t d = 0; d < 2; d++) {
+                while (!encoder.done[d][i] && encoder.time[d][i] < horizon) {
+                    emit_symbol(encoder, i, d);
+                }
+            }
+        }
+    }
+}
+
+void sim_encoder_push(sim_encoder_t &encoder, const motion_block_t &block) {
+    step_stream_t &stream = *encoder.stream;
+    uint8_t moving = 0;
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        moving |= block.steps[i] ? 1u << i : 0;
+    }
+    // motion_engine_queue(): GPIO direction pins flip once the steps before
+    // have left, the planner has already brought the axes to rest
+    const uint8_t reversed = encoder.paired ? 0 : (block.dir_bits ^ encoder.dir_bits) & moving;
+    if (reversed) {
+        run_until(encoder, [&] { return step_stream_drained(stream, 1); });
+        encoder.dir_bits ^= reversed;
+    }
+    run_until(encoder, [&] { return stream.ring.free_slots() != 0; });
+    stream.ring.try_push(block);
+    encoder.blocks++;
+}
+
+void sim_encoder_finish(sim_encoder_t &encoder) {
+    encoder.stream->stop.store(true);
+    run_until(encoder, [] { return false; });
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        encoder.stats[0][i].position = encoder.stream->tallies[i].position.load();
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "motion/motion_block.h"
+#include "motion/planner.h"
+#include "motion/step_stream.h"
+
+// Host replay of the firmware's motion path (roboarm_motion): G-code through
+// the console parser and the look-ahead planner, committed to the motion ring
+// the way tasks.cpp does, then turned into RMT symbols by the same stream
+// encoder code the RMT interrupt runs.
+//
+// The host sends a job faster than the arm runs it, so the replay assumes the
+// same: the planner and the ring fill up and the encoders only run when the
+// ring is full. Nothing else waits on time, which makes the symbol stream of
+// a job reproducible to the bit.
+//
+// With `paired` every axis has a direction channel, as on the ESP32 with four
+// axes; otherwise the direction pins are GPIOs and the planner stops before
+// reversals, which the encoder side waits out by draining the stream.
+
+// A G0/G1 line of the job, in planner units.
+struct sim_move_t {
+    int32_t target[AXIS_COUNT]; // absolute, steps
+    float feed;                 // mm/s, 0 for a rapid
+};
+
+// G-code of `path` as moves. %%FILE includes are expanded like home.py does;
+// other %% macros and `$` lines are skipped. False with `error` set on a
+// file that cannot be read or a line the firmware would reject.
+bool sim_read_job(const std::string &path, std::vector<sim_move_t> &moves, std::string &error);
+
+// Plan `moves` from position 0, handing every block to `emit` in the order
+// the planner task commits them.
+void sim_plan(const std::vector<sim_move_t> &moves, bool stop_on_reversal, void (*emit)(void *ctx, const motion_block_t &block),
+              void *ctx);
+
+// Channel of a symbol: the step pin of the axis, or its direction pin.
+struct sim_channel_t {
+    size_t axis;
+    bool direction;
+};
+
+struct sim_channel_stats_t {
+    uint64_t symbols;
+    uint64_t ticks;
+    uint64_t steps;
+    int64_t position;   // step channel: where the axis ends, steps
+    uint64_t hash;      // FNV-1a 64 over the symbol words
+};
+
+// Encoder half: a step stream and its per-axis speed tables, drained channel
+// by channel in tick order.
+struct sim_encoder_t {
+    std::unique_ptr<step_stream_t> stream;
+    bool paired;
+    std::vector<uint32_t> table_storage;
+    accel_table_t tables[AXIS_COUNT];
+    uint8_t dir_bits;               // GPIO direction pins, unpaired only
+    uint64_t time[2][AXIS_COUNT];   // [direction][axis] ticks emitted
+    bool done[2][AXIS_COUNT];
+    sim_channel_stats_t stats[2][AXIS_COUNT];
+    uint64_t blocks;
+    void (*sink)(void *ctx, sim_channel_t channel, step_symbol_t symbol); // may be null
+    void *ctx;
+};
+
+void sim_encoder_init(sim_encoder_t &encoder, bool paired);
+// Queue `block`, running the encoders while the ring is full (and, without
+// direction channels, until the stream has drained before a reversal).
+void sim_encoder_push(sim_encoder_t &encoder, const motion_block_t &block);
+// Stop the stream and drain every channel.
+void sim_encoder_finish(sim_encoder_t &encoder);
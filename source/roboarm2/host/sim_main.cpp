@@ -0,0 +1,124 @@
+// roboarm_sim: replay a G-code job through the firmware's planner and step
+// encoder and report the RMT symbol stream of every channel (sim.h).
+//
+//   roboarm_sim job.gcode                  summary and checks
+//   roboarm_sim --out run/job job.gcode    also run/job.<axis>.step.bin, .dir.bin
+//   roboarm_sim --dump job.gcode           every symbol as text
+//
+// The .bin files hold the 32-bit rmt_symbol_word_t values as the encoder
+// wrote them, little-endian. The summary gives each channel's symbol, step
+// and tick counts and an FNV-1a hash of its words, so a CI job can diff it
+// against a known good run. Exits 1 if an axis does not end where the job
+// does or a step channel's pulses do not match its steps.
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "sim.h"
+#include "motion/axis_config.h"
+
+struct output_t {
+    FILE *files[2][AXIS_COUNT];
+    bool dump;
+};
+
+static void on_symbol(void *ctx, sim_channel_t channel, step_symbol_t symbol) {
+    output_t &out = *static_cast<output_t *>(ctx);
+    if (FILE *file = out.files[channel.direction][channel.axis]) {
+        const uint8_t word[4] = {static_cast<uint8_t>(symbol.val), static_cast<uint8_t>(symbol.val >> 8),
+                                 static_cast<uint8_t>(symbol.val >> 16), static_cast<uint8_t>(symbol.val >> 24)};
+        fwrite(word, 1, sizeof(word), file);
+    }
+    if (out.dump) {
+        printf("%c %s %u %u %u %u\n", AXES[channel.axis].name, channel.direction ? "dir" : "step", symbol.duration0,
+               symbol.level0, symbol.duration1, symbol.level1);
+    }
+}
+
+static void on_block(void *ctx, const motion_block_t &block) {
+    sim_encoder_push(*static_cast<sim_encoder_t *>(ctx), block);
+}
+
+static int usage(void) {
+    fprintf(stderr, "usage: roboarm_sim [--gpio-dir] [--out PREFIX] [--dump] job.gcode\n");
+    return 2;
+}
+
+int main(int argc, char **argv) {
+    bool paired = true;
+    std::string prefix;
+    std::string job;
+    output_t out = {};
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--gpio-dir") == 0) {
+            paired = false;
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            prefix = argv[++i];
+        } else if (strcmp(argv[i], "--dump") == 0) {
+            out.dump = true;
+        } else if (argv[i][0] != '-' && job.empty()) {
+            job = argv[i];
+        } else {
+            return usage();
+        }
+    }
+    if (job.empty()) {
+        return usage();
+    }
+
+    std::vector<sim_move_t> moves;
+    std::string error;
+    if (!sim_read_job(job, moves, error)) {
+        fprintf(stderr, "[ERR] %s\n", error.c_str());
+        return 1;
+    }
+    for (size_t d = 0; d < 2 && !prefix.empty(); d++) {
+        for (size_t i = 0; i < AXIS_COUNT && (paired || !d); i++) {
+            const std::string path = prefix + "." + static_cast<char>(AXES[i].name | 0x20) + (d ? ".dir.bin" : ".step.bin");
+            out.files[d][i] = fopen(path.c_str(), "wb");
+            if (!out.files[d][i]) {
+                fprintf(stderr, "[ERR] cannot write %s\n", path.c_str());
+                return 1;
+            }
+        }
+    }
+
+    sim_encoder_t encoder = {};
+    sim_encoder_init(encoder, paired);
+    encoder.sink = on_symbol;
+    encoder.ctx = &out;
+    sim_plan(moves, !paired, on_block, &encoder);
+    sim_encoder_finish(encoder);
+    for (auto &files : out.files) {
+        for (FILE *file : files) {
+            if (file) {
+                fclose(file);
+            }
+        }
+    }
+
+    printf("[sim] %s: %zu moves, %llu blocks, direction %s\n", job.c_str(), moves.size(),
+           static_cast<unsigned long long>(encoder.blocks), paired ? "in the stream" : "on GPIO");
+    int failed = 0;
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        for (size_t d = 0; d < 2 && (paired || !d); d++) {
+            const sim_channel_stats_t &stats = encoder.stats[d][i];
+            printf("[sim] %c %-4s symbols=%llu steps=%llu ticks=%llu (%.6f s) hash=%016llx\n", AXES[i].name, d ? "dir" : "step",
+                   static_cast<unsigned long long>(stats.symbols), static_cast<unsigned long long>(stats.steps),
+                   static_cast<unsigned long long>(stats.ticks), static_cast<double>(stats.ticks) / motion_timing::TICKS_PER_S,
+                   static_cast<unsigned long long>(stats.hash));
+        }
+        const sim_channel_stats_t &steps = encoder.stats[0][i];
+        const int64_t expected = moves.empty() ? 0 : moves.back().target[i];
+        const uint32_t counted = encoder.stream->tallies[i].steps.load();
+        if (steps.position != expected || steps.steps != counted) {
+            printf("[sim] %c FAIL: ends at %lld steps, job at %lld; %llu pulses for %lu steps\n", AXES[i].name,
+                   static_cast<long long>(steps.position), static_cast<long long>(expected),
+                   static_cast<unsigned long long>(steps.steps), static_cast<unsigned long>(counted));
+            failed = 1;
+        }
+    }
+    printf("[sim] %s\n", failed ? "FAILED" : "ok");
+    return failed;
+}
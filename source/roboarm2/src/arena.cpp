@@ -0,0 +1,111 @@
+#include "arena.h"
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+
+static const char *TAG = "arena";
+
+constexpr uint32_t HEAP_CAPS = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+
+struct arena_t {
+    const char *name;
+    uint8_t *base;
+    size_t size;
+    size_t used;
+    size_t ring_bytes;
+    std::atomic<size_t> fill_peak;
+};
+
+// Plain .bss: internal DRAM on the ESP32, which the RMT interrupt and DMA can
+// reach, and nothing of it in the flash image.
+template<size_t BYTES>
+struct arena_mem_t {
+    alignas(8) uint8_t bytes[BYTES ? BYTES : 1];
+};
+
+static arena_mem_t<ROBOARM_ARENA_PLANNER_BYTES> s_planner_mem;
+static arena_mem_t<ROBOARM_ARENA_RMT_BYTES> s_rmt_mem;
+static arena_mem_t<ROBOARM_ARENA_LINK_BYTES> s_link_mem;
+static arena_mem_t<ROBOARM_ARENA_JOB_BYTES> s_job_mem;
+static arena_mem_t<ROBOARM_ARENA_INSTR_BYTES> s_instr_mem;
+
+static arena_t s_arenas[ARENA_REGION_COUNT] = {
+    {"planner", s_planner_mem.bytes, ROBOARM_ARENA_PLANNER_BYTES, 0, 0, {}},
+    {"rmt", s_rmt_mem.bytes, ROBOARM_ARENA_RMT_BYTES, 0, 0, {}},
+    {"link", s_link_mem.bytes, ROBOARM_ARENA_LINK_BYTES, 0, 0, {}},
+    {"job", s_job_mem.bytes, ROBOARM_ARENA_JOB_BYTES, 0, 0, {}},
+    {"instr", s_instr_mem.bytes, ROBOARM_ARENA_INSTR_BYTES, 0, 0, {}},
+};
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static size_t s_boot_heap; // free heap at arena_report
+static size_t s_heap_low;  // lowest free heap warned about
+
+void *arena_alloc(arena_region_t region, size_t bytes, size_t align, size_t ring_bytes) {
+    arena_t &arena = s_arenas[region];
+    // align the address, not the offset: the backing array is only 8-aligned
+    // and the rings ask for a cache line (spsc_ring.h); align is a power of two
+    const uintptr_t base = reinterpret_cast<uintptr_t>(arena.base);
+    portENTER_CRITICAL(&s_lock);
+    const size_t start = ((base + arena.used + align - 1) & ~static_cast<uintptr_t>(align - 1)) - base;
+    const bool fits = start + bytes <= arena.size;
+    if (fits) {
+        arena.used = start + bytes;
+        arena.ring_bytes += ring_bytes;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    if (!fits) {
+        ESP_LOGE(TAG, "%s region full: %u of %u bytes used, %u more asked", arena.name, static_cast<unsigned>(arena.used),
+                 static_cast<unsigned>(arena.size), static_cast<unsigned>(bytes));
+        return nullptr;
+    }
+    memset(arena.base + start, 0, bytes);
+    return arena.base + start;
+}
+
+void arena_fill(arena_region_t region, size_t bytes) {
+    std::atomic<size_t> &peak = s_arenas[region].fill_peak;
+    size_t seen = peak.load(std::memory_order_relaxed);
+    while (bytes > seen && !peak.compare_exchange_weak(seen, bytes, std::memory_order_relaxed)) {
+    }
+}
+
+// Bytes of the region that have held data: everything allocated except the
+// part of its rings never filled.
+static size_t high_water(const arena_t &arena) {
+    return arena.used - arena.ring_bytes + arena.fill_peak.load(std::memory_order_relaxed);
+}
+
+void arena_report(void) {
+    for (const arena_t &arena : s_arenas) {
+        ESP_LOGI(TAG, "%-7s %6u bytes, %6u allocated, %6u in rings", arena.name, static_cast<unsigned>(arena.size),
+                 static_cast<unsigned>(arena.used), static_cast<unsigned>(arena.ring_bytes));
+    }
+    s_boot_heap = heap_caps_get_free_size(HEAP_CAPS);
+    s_heap_low = s_boot_heap;
+    ESP_LOGI(TAG, "heap %u bytes free, largest block %u", static_cast<unsigned>(s_boot_heap),
+             static_cast<unsigned>(heap_caps_get_largest_free_block(HEAP_CAPS)));
+}
+
+void arena_watch_heap(void) {
+    const size_t free_bytes = heap_caps_get_free_size(HEAP_CAPS);
+    if (s_boot_heap && free_bytes < s_heap_low) {
+        ESP_LOGW(TAG, "heap down to %u bytes free, %u below boot", static_cast<unsigned>(free_bytes),
+                 static_cast<unsigned>(s_boot_heap - free_bytes));
+        s_heap_low = free_bytes;
+    }
+}
+
+void arena_dump(void) {
+    for (const arena_t &arena : s_arenas) {
+        printf("[mem] %s size=%u allocated=%u rings=%u high_water=%u\n", arena.name, static_cast<unsigned>(arena.size),
+               static_cast<unsigned>(arena.used), static_cast<unsigned>(arena.ring_bytes),
+               static_cast<unsigned>(high_water(arena)));
+    }
+    printf("[mem] heap free=%u boot=%u min=%u largest=%u\n", static_cast<unsigned>(heap_caps_get_free_size(HEAP_CAPS)),
+           static_cast<unsigned>(s_boot_heap), static_cast<unsigned>(heap_caps_get_minimum_free_size(HEAP_CAPS)),
+           static_cast<unsigned>(heap_caps_get_largest_free_block(HEAP_CAPS)));
+    fflush(stdout);
+}
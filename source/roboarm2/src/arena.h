@@ -0,0 +1,57 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <new>
+#include "roboarm_config.h"
+
+// Static memory of the firmware. The buffers the motion, planner and link
+// paths keep for their lifetime come out of fixed regions, sized by the
+// ROBOARM_ARENA_*_BYTES build flags and carved up once at boot. Nothing is
+// freed and nothing is allocated once the tasks run, so fragmentation cannot
+// build up and the heap only holds what the ESP-IDF drivers take at init.
+//
+// Allocations may contain rings (queues, the planner's look-ahead); their
+// owners report how many of those bytes are in use (arena_fill), so every
+// region gets a high-water mark next to its size. The status task calls
+// arena_watch_heap and warns if the heap ever drops below where boot left it.
+// `$MEM` on the console prints it all (arena_dump).
+
+enum arena_region_t : uint8_t {
+    ARENA_PLANNER, // look-ahead blocks and the planner -> feeder queue
+    ARENA_RMT,     // step stream, encoder staging buffers and ramp speed tables
+    ARENA_LINK,    // moves received from the host, waiting for the planner
+    ARENA_JOB,     // read-ahead buffers of a stored job (link/job_spool.h)
+    ARENA_INSTR,   // step path histograms (diag/instrumentation.h)
+    ARENA_REGION_COUNT,
+};
+
+// `bytes` of `region`, zeroed, for the rest of the run; nullptr once the
+// region is full. `ring_bytes` of them are rings whose fill arena_fill reports.
+void *arena_alloc(arena_region_t region, size_t bytes, size_t align, size_t ring_bytes = 0);
+
+// `count` value-initialised objects of `region`; nullptr once it is full.
+template<typename T>
+T *arena_new(arena_region_t region, size_t count = 1, size_t ring_bytes = 0) {
+    void *mem = arena_alloc(region, sizeof(T) * count, alignof(T), ring_bytes);
+    if (!mem) {
+        return nullptr;
+    }
+    T *objects = static_cast<T *>(mem);
+    for (size_t i = 0; i < count; i++) {
+        new (&objects[i]) T();
+    }
+    return objects;
+}
+
+// Ring bytes of `region` holding data right now, summed over its rings.
+// Keeps the maximum; safe from any task.
+void arena_fill(arena_region_t region, size_t bytes);
+
+// Log every region and the free heap. Call once the tasks are up.
+void arena_report(void);
+
+// Warn when the free heap has dropped below its level at arena_report.
+void arena_watch_heap(void);
+
+// `$MEM`: regions, high-water marks and heap, on the console.
+void arena_dump(void);
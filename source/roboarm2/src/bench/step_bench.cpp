@@ -0,0 +1,313 @@
+#include "step_bench.h"
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <driver/rmt_rx.h>
+#include <esp_attr.h>
+#include <esp_check.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <soc/soc_caps.h>
+#include "diag/instrumentation.h"
+#include "link/gcode_parser.h"
+#include "motion/motion_engine.h"
+#include "tasks.h"
+
+static const char *TAG = "step_bench";
+
+// Shares core 1 and its priority with the feeder it replaces.
+constexpr task_layout_t TASK_BENCH = {"bench", 4096, TASK_FEEDER.priority, 1};
+
+constexpr uint32_t BENCH_RATES[] = {1000, 2000, 5000, 10000, 20000, 40000, RAMP_MAX_RATE};
+constexpr uint32_t BENCH_ACCELS[] = {100000, 1000000, 10000000};
+// A sweep point is clean without dropped pulses and with the p99 period
+// error within this share of the period.
+constexpr double BENCH_CLEAN_ERROR = 0.05;
+// The capture ends after a level this long; must fit one RX duration field.
+constexpr uint32_t BENCH_IDLE_NS = 2000000;
+constexpr uint32_t BENCH_FILTER_NS = 100;
+constexpr TickType_t BENCH_CAPTURE_TIMEOUT = pdMS_TO_TICKS(2000);
+constexpr size_t BENCH_MAX_SYMBOLS = SOC_RMT_CHANNELS_PER_GROUP * SOC_RMT_MEM_WORDS_PER_CHANNEL;
+
+// Parser throughput input: typical CAM output with both comment styles.
+static const char BENCH_GCODE[] =
+    "G90 G1 F3000 (start)\n"
+    "G1 X10.125 Y-3.25 Z1.5 A45\n"
+    "X10.250 Y-3.375 ; arc segment\n"
+    "X10.375 Y-3.5 Z1.4375\n"
+    "G0 Z5 (retract (fast))\n"
+    "N120 G1 X-0.001 Y0.0005 F1500\n";
+constexpr int64_t BENCH_GCODE_US = 1000000;
+
+static_assert(static_cast<uint64_t>(BENCH_IDLE_NS) * ROBOARM_TICKS_PER_S / 1000000000u <= motion_timing::HALF_MAX,
+              "BENCH_IDLE_NS too long for the RX tick rate");
+static_assert(motion_timing::TICKS_PER_S / BENCH_RATES[0] - motion_timing::PULSE_TICKS < BENCH_IDLE_NS / 1000 * (ROBOARM_TICKS_PER_S / 1000000),
+              "slowest bench rate would end the capture");
+
+// accel == 0 runs the whole move at `rate`.
+struct bench_profile_t {
+    size_t axes;
+    uint32_t steps;
+    uint32_t rate;
+    uint32_t accel;
+};
+
+struct bench_result_t {
+    size_t pulses;
+    int32_t dropped;       // negative for extra pulses
+    double rate;           // achieved mean rate, steps/s
+    double p50_ns;
+    double p99_ns;
+    double max_ns;
+    double period_ns;      // commanded cruise period
+};
+
+static rmt_channel_handle_t s_rx;
+static size_t s_rx_symbols;
+static QueueHandle_t s_captured;
+static DRAM_ATTR rmt_symbol_word_t s_capture[BENCH_MAX_SYMBOLS];
+static uint32_t s_edges[BENCH_MAX_SYMBOLS];
+static double s_errors[BENCH_MAX_SYMBOLS];
+
+static const rmt_receive_config_t RECEIVE_CONFIG = {
+    .signal_range_min_ns = BENCH_FILTER_NS,
+    .signal_range_max_ns = BENCH_IDLE_NS,
+    .flags = {},
+};
+
+static bool on_recv_done(rmt_channel_handle_t channel, const rmt_rx_done_event_data_t *edata, void *user_ctx) {
+    BaseType_t woken = pdFALSE;
+    const size_t symbols = edata->num_symbols;
+    xQueueSendFromISR(s_captured, &symbols, &woken);
+    return woken == pdTRUE;
+}
+
+static esp_err_t bench_init(void) {
+    motion_engine_config_t engine_config = {};
+    engine_config.resolution_hz = ROBOARM_TICKS_PER_S;
+    engine_config.axes = AXES;
+    engine_config.axis_count = AXIS_COUNT;
+    engine_config.reserved_channels = 1;
+    ESP_RETURN_ON_ERROR(motion_engine_init(&engine_config), TAG, "engine");
+    ESP_RETURN_ON_ERROR(motion_engine_stream_start(), TAG, "stream");
+
+    // The RX channel gets what the axes left of the RMT RAM.
+    motion_engine_stats_t stats;
+    motion_engine_get_stats(&stats);
+    s_rx_symbols = BENCH_MAX_SYMBOLS - AXIS_COUNT * stats.mem_block_symbols;
+    ESP_RETURN_ON_FALSE(s_rx_symbols >= SOC_RMT_MEM_WORDS_PER_CHANNEL, ESP_ERR_NO_MEM, TAG, "no RMT RAM left for RX");
+
+    rmt_rx_channel_config_t rx_config = {};
+    rx_config.gpio_num = ROBOARM_BENCH_RX_GPIO < 0 ? AXES[0].step_pin : static_cast<gpio_num_t>(ROBOARM_BENCH_RX_GPIO);
+    rx_config.clk_src = RMT_CLK_SRC_DEFAULT;
+    rx_config.resolution_hz = ROBOARM_TICKS_PER_S;
+    rx_config.mem_block_symbols = s_rx_symbols;
+    rx_config.intr_priority = ROBOARM_RMT_INTR_PRIORITY;
+    rx_config.flags.io_loop_back = ROBOARM_BENCH_RX_GPIO < 0;
+    ESP_RETURN_ON_ERROR(rmt_new_rx_channel(&rx_config, &s_rx), TAG, "rx channel");
+
+    s_captured = xQueueCreate(1, sizeof(size_t));
+    ESP_RETURN_ON_FALSE(s_captured, ESP_ERR_NO_MEM, TAG, "capture queue");
+    rmt_rx_event_callbacks_t callbacks = {};
+    callbacks.on_recv_done = on_recv_done;
+    ESP_RETURN_ON_ERROR(rmt_rx_register_event_callbacks(s_rx, &callbacks, NULL), TAG, "rx callbacks");
+    ESP_RETURN_ON_ERROR(rmt_enable(s_rx), TAG, "rx enable");
+    ESP_LOGI(TAG, "capturing GPIO%d, %u RX symbols, %u TX symbols per axis", static_cast<int>(rx_config.gpio_num),
+             static_cast<unsigned>(s_rx_symbols), static_cast<unsigned>(stats.mem_block_symbols));
+    return ESP_OK;
+}
+
+static esp_err_t queue_profile(const bench_profile_t &profile) {
+    if (profile.accel) {
+        motion_move_t move = {};
+        for (size_t i = 0; i < profile.axes; i++) {
+            move.steps[i] = static_cast<int32_t>(profile.steps);
+        }
+        move.rate = profile.rate;
+        move.accel = profile.accel;
+        return motion_engine_queue_move(&move, portMAX_DELAY);
+    }
+    motion_block_t block = {};
+    for (size_t i = 0; i < profile.axes; i++) {
+        block.steps[i] = profile.steps;
+    }
+    block.lead_steps = profile.steps;
+    block.entry_rate = block.cruise_rate = block.exit_rate = profile.rate;
+    block.accel = profile.rate;
+    block.profile = RAMP_TRAPEZOID;
+    return motion_engine_queue(&block, portMAX_DELAY);
+}
+
+// Run one move while capturing the X step pin. Returns the captured symbol
+// count, 0 if the capture never ended.
+static size_t capture(const bench_profile_t &profile) {
+    ESP_ERROR_CHECK(rmt_receive(s_rx, s_capture, s_rx_symbols * sizeof(rmt_symbol_word_t), &RECEIVE_CONFIG));
+    ESP_ERROR_CHECK(queue_profile(profile));
+    size_t symbols = 0;
+    if (xQueueReceive(s_captured, &symbols, BENCH_CAPTURE_TIMEOUT) != pdTRUE) {
+        // abort the pending receive
+        rmt_disable(s_rx);
+        rmt_enable(s_rx);
+        symbols = 0;
+    }
+    while (!motion_engine_idle()) {
+        vTaskDelay(1);
+    }
+    return symbols;
+}
+
+// Rising edge times in ticks; the line idles low before the first one.
+static size_t rising_edges(size_t symbols) {
+    size_t edges = 0;
+    uint32_t time = 0;
+    bool high = false;
+    for (size_t i = 0; i < symbols; i++) {
+        const rmt_symbol_word_t &symbol = s_capture[i];
+        const uint32_t levels[2] = {symbol.level0, symbol.level1};
+        const uint32_t durations[2] = {symbol.duration0, symbol.duration1};
+        for (size_t half = 0; half < 2; half++) {
+            if (durations[half] == 0) {
+                return edges;
+            }
+            if (levels[half] && !high) {
+                s_edges[edges++] = time;
+            }
+            high = levels[half];
+            time += durations[half];
+        }
+    }
+    return edges;
+}
+
+// Commanded time of step k in ticks, from the first step. Rest-to-rest
+// profiles follow motion_engine_queue_move: v^2 = 2 a k up to the peak,
+// cruise, then the same ramp mirrored.
+static double commanded_ticks(const bench_profile_t &profile, uint32_t k) {
+    const double ticks = motion_timing::TICKS_PER_S;
+    const uint32_t rate = std::min(profile.rate, RAMP_MAX_RATE);
+    if (!profile.accel) {
+        return k * ticks / rate;
+    }
+    const double a = profile.accel;
+    double peak = rate;
+    uint32_t ramp_steps = static_cast<uint32_t>(static_cast<uint64_t>(rate) * rate / (2ull * profile.accel));
+    if (2ull * ramp_steps > profile.steps) {
+        ramp_steps = profile.steps / 2;
+        peak = sqrt(a * profile.steps);
+    }
+    const double accel_steps = peak * peak / (2 * a);
+    const auto time = [&](double step) {
+        if (step <= accel_steps) {
+            return sqrt(2 * step / a);
+        }
+        const double decel_start = profile.steps - ramp_steps;
+        const double cruise = sqrt(2 * accel_steps / a) + (std::min(step, decel_start) - accel_steps) / peak;
+        if (step <= decel_start) {
+            return cruise;
+        }
+        return cruise + sqrt(2 * ramp_steps / a) - sqrt(2 * (profile.steps - step) / a);
+    };
+    return (time(k + 1) - time(1)) * ticks;
+}
+
+static bench_result_t measure(const bench_profile_t &profile) {
+    bench_result_t result = {};
+    const size_t edges = rising_edges(capture(profile));
+    result.pulses = edges;
+    result.dropped = static_cast<int32_t>(profile.steps) - static_cast<int32_t>(edges);
+    result.period_ns = 1e9 / std::min(profile.rate, RAMP_MAX_RATE);
+    if (edges < 2) {
+        return result;
+    }
+    const double ns_per_tick = 1e9 / motion_timing::TICKS_PER_S;
+    for (size_t k = 1; k < edges; k++) {
+        const double commanded = commanded_ticks(profile, k) - commanded_ticks(profile, k - 1);
+        s_errors[k - 1] = fabs((s_edges[k] - s_edges[k - 1]) - commanded) * ns_per_tick;
+    }
+    const size_t count = edges - 1;
+    std::sort(s_errors, s_errors + count);
+    result.p50_ns = s_errors[count / 2];
+    result.p99_ns = s_errors[std::min(count - 1, count * 99 / 100)];
+    result.max_ns = s_errors[count - 1];
+    result.rate = count * static_cast<double>(motion_timing::TICKS_PER_S) / (s_edges[edges - 1] - s_edges[0]);
+    return result;
+}
+
+static void print_result(const bench_profile_t &profile, const bench_result_t &result) {
+    printf("[bench] axes=%u rate=%lu accel=%lu steps=%lu pulses=%u dropped=%ld achieved=%.0f err_ns p50=%.0f p99=%.0f max=%.0f\n",
+           static_cast<unsigned>(profile.axes), static_cast<unsigned long>(profile.rate),
+           static_cast<unsigned long>(profile.accel), static_cast<unsigned long>(profile.steps),
+           static_cast<unsigned>(result.pulses), static_cast<long>(result.dropped), result.rate, result.p50_ns, result.p99_ns,
+           result.max_ns);
+}
+
+// Feed the sample program through the tokenizer and modal state for about
+// BENCH_GCODE_US; runs before the motion sweeps so the RMT interrupt is quiet.
+static void bench_gcode(void) {
+    gcode_parser_t parser;
+    gcode_modal_t modal;
+    gcode_parser_reset(parser);
+    gcode_modal_init(modal);
+    uint32_t lines = 0;
+    uint32_t errors = 0;
+    uint32_t passes = 0;
+    const int64_t start = esp_timer_get_time();
+    int64_t elapsed = 0;
+    do {
+        for (const char *c = BENCH_GCODE; *c; c++) {
+            const gcode_result_t result = gcode_parser_feed(parser, *c);
+            if (result == GCODE_LINE) {
+                bool moved;
+                errors += gcode_modal_apply(modal, parser.line, moved) != GCODE_OK;
+                lines++;
+            } else if (result == GCODE_ERROR) {
+                errors++;
+            }
+        }
+        passes++;
+        elapsed = esp_timer_get_time() - start;
+    } while (elapsed < BENCH_GCODE_US);
+    const double seconds = elapsed / 1e6;
+    printf("[bench] gcode parser %.0f lines/s %.0f bytes/s errors=%lu\n", lines / seconds,
+           passes * (sizeof(BENCH_GCODE) - 1) / seconds, static_cast<unsigned long>(errors));
+}
+
+static void bench_task(void *arg) {
+    bench_gcode();
+    ESP_ERROR_CHECK(bench_init());
+    // one symbol per pulse, keep one for the closing idle level
+    const uint32_t steps = s_rx_symbols - 1;
+    double max_clean[AXIS_COUNT] = {};
+
+    for (size_t axes = 1; axes <= AXIS_COUNT; axes++) {
+        for (uint32_t rate : BENCH_RATES) {
+            const bench_profile_t profile = {axes, steps, rate, 0};
+            const bench_result_t result = measure(profile);
+            print_result(profile, result);
+            if (result.dropped == 0 && result.p99_ns <= BENCH_CLEAN_ERROR * result.period_ns) {
+                max_clean[axes - 1] = std::max(max_clean[axes - 1], result.rate);
+            }
+        }
+        for (uint32_t accel : BENCH_ACCELS) {
+            const bench_profile_t profile = {axes, steps, RAMP_MAX_RATE, accel};
+            print_result(profile, measure(profile));
+        }
+    }
+    for (size_t axes = 1; axes <= AXIS_COUNT; axes++) {
+        printf("[bench] axes=%u max clean rate %.0f steps/s\n", static_cast<unsigned>(axes), max_clean[axes - 1]);
+    }
+    instr_dump();
+    printf("[bench] done\n");
+    fflush(stdout);
+    vTaskDelete(NULL);
+}
+
+void step_bench_start(void) {
+    const BaseType_t ret = xTaskCreatePinnedToCore(bench_task, TASK_BENCH.name, TASK_BENCH.stack, NULL, TASK_BENCH.priority,
+                                                   NULL, TASK_BENCH.core);
+    assert(ret == pdPASS);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+// Step rate benchmark, built instead of the normal firmware with
+// -DROBOARM_BENCHMARK=1 (pio run -e bench).
+//
+// The X step pin is captured by an RMT RX channel, on the same pad by default
+// or through a jumper to ROBOARM_BENCH_RX_GPIO. Constant rate and rest-to-rest
+// ramp moves are swept over 1..AXIS_COUNT moving axes; for each one the real
+// rising edges are compared with the commanded timing and a line with dropped
+// pulses and period error percentiles is printed, then the highest clean rate
+// per axis count. Step drivers should be disabled, every axis really moves.
+// Before that, G-code parser throughput is reported in lines/s.
+
+// Start the benchmark task. Call once from app_main.
+void step_bench_start(void);
@@ -0,0 +1,206 @@
+#include "instrumentation.h"
+#include <assert.h>
+#include <stdio.h>
+#include <atomic>
+#include "arena.h"
+#include "motion/motion_iram.h"
+#include "motion/motion_engine.h"
+#include "link/serial_link.h"
+#include "tasks.h"
+
+#if ROBOARM_INSTRUMENTATION
+#include <esp_rom_sys.h>
+#include <esp_timer.h>
+
+// Bucket 0 counts zeros, bucket b values in [2^(b-1), 2^b).
+constexpr size_t HIST_BUCKETS = 33;
+// Chunks written to one channel but not yet sent; two once the RAM is full.
+constexpr size_t REFILL_PENDING = 4;
+
+struct instr_hist_t {
+    std::atomic<uint32_t> buckets[HIST_BUCKETS];
+    std::atomic<uint32_t> count;
+    std::atomic<uint32_t> max;
+};
+
+// Touched only by the encoder and done callback of one channel, which run
+// from the same interrupt.
+struct refill_tracker_t {
+    uint32_t last_call;
+    uint32_t pending[REFILL_PENDING]; // commanded ticks of each chunk, oldest first
+    size_t pending_count;
+};
+
+static const char *const HIST_NAMES[INSTR_HIST_COUNT] = {"encode_cycles", "refill_jitter", "done_latency", "ring_level"};
+static const bool HIST_IN_CYCLES[INSTR_HIST_COUNT] = {true, true, true, false};
+
+static_assert(INSTR_HIST_COUNT * sizeof(instr_hist_t) + AXIS_COUNT * sizeof(refill_tracker_t) + 16 <= ROBOARM_ARENA_INSTR_BYTES,
+              "ROBOARM_ARENA_INSTR_BYTES too small for the histograms");
+
+static instr_hist_t *s_hists;       // INSTR_HIST_COUNT, ARENA_INSTR
+static refill_tracker_t *s_refills; // AXIS_COUNT, ARENA_INSTR
+static std::atomic<uint32_t> s_underruns[AXIS_COUNT];
+static std::atomic<uint32_t> s_last_underrun_ms;
+static uint32_t s_cpu_mhz = 1;
+static uint32_t s_cycles_per_tick_q16;
+
+static uint32_t MOTION_IRAM ticks_to_cycles(uint64_t ticks) {
+    return static_cast<uint32_t>(ticks * s_cycles_per_tick_q16 >> 16);
+}
+
+void instr_init(void) {
+    s_hists = arena_new<instr_hist_t>(ARENA_INSTR, INSTR_HIST_COUNT);
+    s_refills = arena_new<refill_tracker_t>(ARENA_INSTR, AXIS_COUNT);
+    assert(s_hists && s_refills);
+    s_cpu_mhz = esp_rom_get_cpu_ticks_per_us();
+    s_cycles_per_tick_q16 = static_cast<uint32_t>((static_cast<uint64_t>(s_cpu_mhz) * 1000000u << 16) / ROBOARM_TICKS_PER_S);
+    instr_reset();
+}
+
+void instr_reset(void) {
+    for (size_t id = 0; id < INSTR_HIST_COUNT; id++) {
+        instr_hist_t &hist = s_hists[id];
+        for (std::atomic<uint32_t> &bucket : hist.buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        hist.count.store(0, std::memory_order_relaxed);
+        hist.max.store(0, std::memory_order_relaxed);
+    }
+    for (std::atomic<uint32_t> &underruns : s_underruns) {
+        underruns.store(0, std::memory_order_relaxed);
+    }
+    s_last_underrun_ms.store(0, std::memory_order_relaxed);
+}
+
+void MOTION_IRAM instr_record(instr_hist_id_t id, uint32_t value) {
+    instr_hist_t &hist = s_hists[id];
+    hist.buckets[value ? 32 - __builtin_clz(value) : 0].fetch_add(1, std::memory_order_relaxed);
+    hist.count.fetch_add(1, std::memory_order_relaxed);
+    uint32_t max = hist.max.load(std::memory_order_relaxed);
+    while (value > max && !hist.max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+    }
+}
+
+void MOTION_IRAM instr_refill_reset(size_t axis) {
+    s_refills[axis] = {};
+}
+
+void MOTION_IRAM instr_refill_begin(size_t axis, uint32_t now) {
+    refill_tracker_t &tracker = s_refills[axis];
+    // With both halves written, each call means the older one has been sent
+    // since the previous call.
+    if (tracker.pending_count >= 2) {
+        const int32_t error = static_cast<int32_t>(now - tracker.last_call - ticks_to_cycles(tracker.pending[0]));
+        instr_record(INSTR_REFILL_JITTER, error < 0 ? -error : error);
+        tracker.pending_count--;
+        for (size_t i = 0; i < tracker.pending_count; i++) {
+            tracker.pending[i] = tracker.pending[i + 1];
+        }
+    }
+    tracker.last_call = now;
+}
+
+void MOTION_IRAM instr_refill_chunk(size_t axis, uint32_t ticks) {
+    refill_tracker_t &tracker = s_refills[axis];
+    if (tracker.pending_count == REFILL_PENDING) {
+        tracker.pending_count--;
+        for (size_t i = 0; i < tracker.pending_count; i++) {
+            tracker.pending[i] = tracker.pending[i + 1];
+        }
+    }
+    tracker.pending[tracker.pending_count++] = ticks;
+}
+
+void MOTION_IRAM instr_trans_done(size_t axis, uint32_t now) {
+    refill_tracker_t &tracker = s_refills[axis];
+    if (tracker.pending_count == 0) {
+        return; // not a stream transaction
+    }
+    uint64_t remaining = 0;
+    for (size_t i = 0; i < tracker.pending_count; i++) {
+        remaining += tracker.pending[i];
+    }
+    const int32_t late = static_cast<int32_t>(now - tracker.last_call - ticks_to_cycles(remaining));
+    instr_record(INSTR_DONE_LATENCY, late < 0 ? 0 : late);
+    tracker = {};
+}
+
+void MOTION_IRAM instr_underrun(size_t axis) {
+    s_underruns[axis].fetch_add(1, std::memory_order_relaxed);
+    s_last_underrun_ms.store(static_cast<uint32_t>(esp_timer_get_time() / 1000), std::memory_order_relaxed);
+}
+
+// Upper bound of the bucket holding the `percent` percentile.
+static uint32_t percentile(const uint32_t *buckets, uint32_t count, uint32_t percent) {
+    const uint64_t rank = (static_cast<uint64_t>(count) * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (size_t b = 0; b < HIST_BUCKETS; b++) {
+        seen += buckets[b];
+        if (seen >= rank && seen) {
+            return b == 0 ? 0 : b >= 32 ? UINT32_MAX : (1u << b) - 1;
+        }
+    }
+    return 0;
+}
+
+static void dump_hist(instr_hist_id_t id) {
+    const instr_hist_t &hist = s_hists[id];
+    uint32_t buckets[HIST_BUCKETS];
+    for (size_t b = 0; b < HIST_BUCKETS; b++) {
+        buckets[b] = hist.buckets[b].load(std::memory_order_relaxed);
+    }
+    const uint32_t count = hist.count.load(std::memory_order_relaxed);
+    const uint32_t max = hist.max.load(std::memory_order_relaxed);
+    printf("[stats] %s n=%lu p50<=%lu p90<=%lu p99<=%lu max=%lu", HIST_NAMES[id], static_cast<unsigned long>(count),
+           static_cast<unsigned long>(percentile(buckets, count, 50)), static_cast<unsigned long>(percentile(buckets, count, 90)),
+           static_cast<unsigned long>(percentile(buckets, count, 99)), static_cast<unsigned long>(max));
+    if (HIST_IN_CYCLES[id]) {
+        printf(" cycles (max %lu us)", static_cast<unsigned long>(max / s_cpu_mhz));
+    }
+    printf("\n[stats] %s buckets", HIST_NAMES[id]);
+    for (size_t b = 0; b < HIST_BUCKETS; b++) {
+        if (buckets[b]) {
+            printf(" %lu:%lu", b ? 1ul << (b - 1) : 0ul, static_cast<unsigned long>(buckets[b]));
+        }
+    }
+    printf("\n");
+}
+
+#endif
+
+static void dump_task(const task_layout_t &layout) {
+    printf(" %s=%u@%d", layout.name, static_cast<unsigned>(layout.priority), static_cast<int>(layout.core));
+}
+
+void instr_dump(void) {
+    motion_engine_stats_t engine;
+    motion_engine_get_stats(&engine);
+    printf("[stats] rmt mem_block_symbols=%u trans_queue_depth=%u intr_priority=%d\n",
+           static_cast<unsigned>(engine.mem_block_symbols), static_cast<unsigned>(engine.trans_queue_depth),
+           ROBOARM_RMT_INTR_PRIORITY);
+    printf("[stats] tasks");
+    dump_task(TASK_FEEDER);
+    dump_task(TASK_PLANNER);
+    dump_task(TASK_LINK);
+    dump_task(TASK_STATUS);
+    printf("\n[stats] underruns=%lu crc_errors=%lu refills", static_cast<unsigned long>(engine.underruns),
+           static_cast<unsigned long>(serial_link_crc_errors()));
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        printf(" %lu", static_cast<unsigned long>(engine.refills[i]));
+    }
+    printf("\n");
+#if ROBOARM_INSTRUMENTATION
+    printf("[stats] underruns by axis");
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        printf(" %lu", static_cast<unsigned long>(s_underruns[i].load(std::memory_order_relaxed)));
+    }
+    printf(", last at %lu ms\n", static_cast<unsigned long>(s_last_underrun_ms.load(std::memory_order_relaxed)));
+    for (size_t id = 0; id < INSTR_HIST_COUNT; id++) {
+        dump_hist(static_cast<instr_hist_id_t>(id));
+    }
+#else
+    printf("[stats] histograms off, build with -DROBOARM_INSTRUMENTATION=1\n");
+#endif
+    printf("[stats] end\n");
+    fflush(stdout);
+}
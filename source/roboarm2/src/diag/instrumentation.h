@@ -0,0 +1,62 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "roboarm_config.h"
+
+#if ROBOARM_INSTRUMENTATION
+#include <esp_cpu.h>
+#endif
+
+// Optional timing instrumentation of the step path, enabled with
+// -DROBOARM_INSTRUMENTATION=1. Every hook below compiles to nothing otherwise.
+//
+// Samples go into log2 histograms of relaxed atomics, so the RMT interrupt on
+// core 1 and tasks on core 0 record without locks. A reset while samples are
+// being recorded may leave a few of them behind, which is fine for tuning.
+// `$STATS` on the console prints everything (instr_dump).
+
+enum instr_hist_id_t {
+    INSTR_ENCODE_CYCLES,   // CPU cycles spent in one stream encoder call
+    INSTR_REFILL_JITTER,   // |refill interval - commanded length of the half just sent|, cycles
+    INSTR_DONE_LATENCY,    // on_trans_done after the commanded end of the last symbol, cycles
+    INSTR_RING_LEVEL,      // motion ring blocks at each refill of the first axis
+    INSTR_HIST_COUNT,
+};
+
+#if ROBOARM_INSTRUMENTATION
+
+static inline uint32_t instr_cycles(void) {
+    return esp_cpu_get_cycle_count();
+}
+
+void instr_init(void);
+void instr_reset(void);
+void instr_record(instr_hist_id_t id, uint32_t value);
+
+// Refill tracking of one stream channel, in the order the encoder sees it:
+// begin at every encoder call, chunk for every staging buffer handed to the
+// RMT RAM (`ticks` of commanded time), done from on_trans_done. Assumes
+// chunks of half the channel RAM, as motion_engine sets them up.
+void instr_refill_reset(size_t axis);
+void instr_refill_begin(size_t axis, uint32_t now);
+void instr_refill_chunk(size_t axis, uint32_t ticks);
+void instr_trans_done(size_t axis, uint32_t now);
+void instr_underrun(size_t axis);
+
+#else
+
+static inline uint32_t instr_cycles(void) { return 0; }
+static inline void instr_init(void) {}
+static inline void instr_reset(void) {}
+static inline void instr_record(instr_hist_id_t, uint32_t) {}
+static inline void instr_refill_reset(size_t) {}
+static inline void instr_refill_begin(size_t, uint32_t) {}
+static inline void instr_refill_chunk(size_t, uint32_t) {}
+static inline void instr_trans_done(size_t, uint32_t) {}
+static inline void instr_underrun(size_t) {}
+
+#endif
+
+// Print the histograms next to the engine, link and task settings they help
+// to tune. Available in every build; says so when instrumentation is off.
+void instr_dump(void);
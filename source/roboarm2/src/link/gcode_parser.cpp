@@ -0,0 +1,195 @@
+#include "gcode_parser.h"
+
+// Integer part limit, keeps value * GCODE_SCALE in an int32.
+constexpr uint32_t GCODE_MAX_INT = 2000000;
+constexpr uint8_t GCODE_FRAC_DIGITS = 3;
+static_assert(GCODE_MAX_INT * static_cast<uint64_t>(GCODE_SCALE) + GCODE_SCALE <= INT32_MAX);
+
+static void begin_line(gcode_parser_t &parser) {
+    parser = {};
+    parser.line.motion = -1;
+    parser.line.distance = -1;
+}
+
+void gcode_parser_reset(gcode_parser_t &parser) {
+    begin_line(parser);
+}
+
+static void fail(gcode_parser_t &parser, gcode_error_t error) {
+    if (parser.error == GCODE_OK) {
+        parser.error = error;
+    }
+}
+
+static int axis_index(char letter) {
+    for (int i = 0; i < static_cast<int>(AXIS_COUNT); i++) {
+        if (GCODE_AXIS_LETTERS[i] == letter) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Store the word read so far.
+static void end_word(gcode_parser_t &parser) {
+    if (!parser.letter) {
+        return;
+    }
+    const char letter = parser.letter;
+    parser.letter = 0;
+    if (!parser.has_digits) {
+        fail(parser, GCODE_ERROR_NUMBER);
+        return;
+    }
+    const int32_t magnitude = static_cast<int32_t>(parser.int_part * GCODE_SCALE + parser.frac_part + parser.round_up);
+    const int32_t value = parser.negative ? -magnitude : magnitude;
+    gcode_line_t &line = parser.line;
+
+    const int axis = axis_index(letter);
+    if (axis >= 0) {
+        line.axis[axis] = value;
+        line.axis_mask |= 1u << axis;
+    } else if (letter == 'F') {
+        if (value <= 0) {
+            fail(parser, GCODE_ERROR_NUMBER);
+        }
+        line.feed = value;
+        line.has_feed = true;
+    } else if (letter == 'G') {
+        if (value % GCODE_SCALE != 0) {
+            fail(parser, GCODE_ERROR_UNSUPPORTED);
+            return;
+        }
+        switch (value / GCODE_SCALE) {
+        case 0:
+        case 1:
+            line.motion = static_cast<int8_t>(value / GCODE_SCALE);
+            break;
+        case 90:
+        case 91:
+            line.distance = static_cast<int8_t>(value / GCODE_SCALE);
+            break;
+        default:
+            fail(parser, GCODE_ERROR_UNSUPPORTED);
+            break;
+        }
+    } else if (letter != 'N') {
+        fail(parser, GCODE_ERROR_UNSUPPORTED);
+    }
+}
+
+static void number_char(gcode_parser_t &parser, char c) {
+    if (!parser.letter) {
+        fail(parser, GCODE_ERROR_LETTER);
+        return;
+    }
+    if (c == '-' || c == '+') {
+        if (parser.has_digits || parser.dot || parser.negative) {
+            fail(parser, GCODE_ERROR_NUMBER);
+        }
+        parser.negative = c == '-';
+        return;
+    }
+    if (c == '.') {
+        if (parser.dot) {
+            fail(parser, GCODE_ERROR_NUMBER);
+        }
+        parser.dot = true;
+        return;
+    }
+    const uint32_t digit = static_cast<uint32_t>(c - '0');
+    parser.has_digits = true;
+    if (!parser.dot) {
+        parser.int_part = parser.int_part * 10 + digit;
+        if (parser.int_part > GCODE_MAX_INT) {
+            fail(parser, GCODE_ERROR_NUMBER);
+            parser.int_part = 0;
+        }
+    } else if (parser.frac_digits < GCODE_FRAC_DIGITS) {
+        static constexpr uint32_t PLACE[GCODE_FRAC_DIGITS] = {100, 10, 1};
+        parser.frac_part += digit * PLACE[parser.frac_digits++];
+    } else if (parser.frac_digits++ == GCODE_FRAC_DIGITS) {
+        parser.round_up = digit >= 5;
+    }
+}
+
+static void begin_word(gcode_parser_t &parser, char letter) {
+    end_word(parser);
+    parser.letter = letter;
+    parser.negative = false;
+    parser.has_digits = false;
+    parser.dot = false;
+    parser.frac_digits = 0;
+    parser.int_part = 0;
+    parser.frac_part = 0;
+    parser.round_up = false;
+}
+
+gcode_result_t gcode_parser_feed(gcode_parser_t &parser, char c) {
+    if (parser.line_done) {
+        begin_line(parser);
+    }
+    if (c == '\n') {
+        end_word(parser);
+        // words and error stay readable until the next byte
+        parser.line_done = true;
+        return parser.error == GCODE_OK ? GCODE_LINE : GCODE_ERROR;
+    }
+    if (parser.semicolon || c == ' ' || c == '\t' || c == '\r') {
+        return GCODE_MORE;
+    }
+    if (c == ';') {
+        parser.semicolon = true;
+        return GCODE_MORE;
+    }
+    if (c == '(') {
+        parser.paren_depth++;
+        return GCODE_MORE;
+    }
+    if (c == ')') {
+        if (parser.paren_depth) {
+            parser.paren_depth--;
+        }
+        return GCODE_MORE;
+    }
+    if (parser.paren_depth || parser.error != GCODE_OK) {
+        return GCODE_MORE;
+    }
+    if (c >= 'a' && c <= 'z') {
+        c = static_cast<char>(c - 'a' + 'A');
+    }
+    if (c >= 'A' && c <= 'Z') {
+        begin_word(parser, c);
+    } else if ((c >= '0' && c <= '9') || c == '.' || c == '-' || c == '+') {
+        number_char(parser, c);
+    } else {
+        fail(parser, GCODE_ERROR_LETTER);
+    }
+    return GCODE_MORE;
+}
+
+void gcode_modal_init(gcode_modal_t &modal) {
+    modal = {};
+    modal.rapid = true;
+}
+
+gcode_error_t gcode_modal_apply(gcode_modal_t &modal, const gcode_line_t &line, bool &moved) {
+    moved = false;
+    const bool rapid = line.motion >= 0 ? line.motion == 0 : modal.rapid;
+    const int32_t feed = line.has_feed ? line.feed : modal.feed;
+    if (line.axis_mask && !rapid && feed == 0) {
+        return GCODE_ERROR_NO_FEED;
+    }
+    modal.rapid = rapid;
+    modal.feed = feed;
+    if (line.distance >= 0) {
+        modal.relative = line.distance == 91;
+    }
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        if (line.axis_mask & (1u << i)) {
+            modal.position[i] = modal.relative ? modal.position[i] + line.axis[i] : line.axis[i];
+            moved = true;
+        }
+    }
+    return GCODE_OK;
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "motion/motion_block.h"
+
+// Streaming G-code tokenizer for the console text between link frames.
+//
+// Bytes are fed one at a time straight from the UART read buffer; words are
+// accumulated as they arrive, so no line is ever copied or allocated. Values
+// are fixed point in GCODE_SCALE units (0.001 mm, 0.001 mm/min for F).
+//
+// Comments follow home.py's _strip_inline_comment: ';' drops the rest of the
+// line (also inside parentheses), '(' ... ')' nests and a stray ')' is
+// dropped. Spaces, tabs and '\r' are ignored and '\n' ends a line.
+//
+// Supported: G0 G1 G90 G91, X Y Z A, F and N (ignored). Anything else is an
+// error; error codes match Grbl's so host senders can report them.
+
+constexpr int32_t GCODE_SCALE = 1000;
+constexpr char GCODE_AXIS_LETTERS[AXIS_COUNT + 1] = "XYZA";
+
+enum gcode_error_t : uint8_t {
+    GCODE_OK = 0,
+    GCODE_ERROR_LETTER = 1,        // expected a word letter
+    GCODE_ERROR_NUMBER = 2,        // missing, malformed or out of range value
+    GCODE_ERROR_INVALID_COMMAND = 3, // unknown `$` command
+    GCODE_ERROR_NO_HOMING = 5,     // `$H` on an axis without a limit switch
+    GCODE_ERROR_NOT_IDLE = 8,      // needs the machine Idle and no stored job running
+    GCODE_ERROR_ALARM_LOCK = 9,    // motion refused until `$H` or `$X`
+    GCODE_ERROR_UNSUPPORTED = 20,  // unsupported G code or word
+    GCODE_ERROR_NO_FEED = 22,      // G1 before any F
+    GCODE_ERROR_INVALID_TARGET = 33, // tool-space target out of the arm's reach
+};
+
+enum gcode_result_t {
+    GCODE_MORE,     // line not finished
+    GCODE_LINE,     // `line` holds the words of a finished line
+    GCODE_ERROR,    // a finished line was rejected, see `error`
+};
+
+// Words of one line. motion and distance are -1 when not given.
+struct gcode_line_t {
+    uint8_t axis_mask;
+    int32_t axis[AXIS_COUNT];
+    bool has_feed;
+    int32_t feed;
+    int8_t motion;      // 0 or 1
+    int8_t distance;    // 90 or 91
+};
+
+struct gcode_parser_t {
+    gcode_line_t line;
+    gcode_error_t error;
+    bool line_done;         // '\n' seen, the next byte starts a new line
+    bool semicolon;         // rest of the line is a comment
+    uint8_t paren_depth;
+    char letter;            // word being read, 0 between words
+    bool negative;
+    bool has_digits;
+    bool dot;
+    uint8_t frac_digits;
+    uint32_t int_part;
+    uint32_t frac_part;     // GCODE_SCALE units
+    bool round_up;          // first digit past the kept fraction was >= 5
+};
+
+// Modal state carried from line to line.
+struct gcode_modal_t {
+    int32_t position[AXIS_COUNT];   // GCODE_SCALE units
+    int32_t feed;
+    bool rapid;
+    bool relative;
+};
+
+void gcode_parser_reset(gcode_parser_t &parser);
+gcode_result_t gcode_parser_feed(gcode_parser_t &parser, char c);
+
+void gcode_modal_init(gcode_modal_t &modal);
+// Apply the words of a finished line; `moved` is set if position changed and
+// the line should become a move (rapid or at `feed`).
+gcode_error_t gcode_modal_apply(gcode_modal_t &modal, const gcode_line_t &line, bool &moved);
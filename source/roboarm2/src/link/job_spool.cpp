@@ -0,0 +1,444 @@
+#include "job_spool.h"
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <esp_check.h>
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+#include <freertos/task.h>
+#include "protocol.h"
+#include "serial_link.h"
+#include "arena.h"
+#include "machine/machine_state.h"
+
+static const char *TAG = "job_spool";
+
+constexpr const char *JOB_PARTITION = "jobs";
+constexpr uint32_t JOB_MAGIC = 0x424f4a52; // "RJOB"
+constexpr uint8_t JOB_VERSION = 1;
+// Flash erase unit; the header has the first one to itself.
+constexpr uint32_t JOB_SECTOR = 4096;
+constexpr uint32_t JOB_DATA_OFFSET = JOB_SECTOR;
+constexpr size_t JOB_BUFFERS = 2;
+constexpr size_t VERIFY_CHUNK = 256;
+
+// gcode_compile.py's stream header (home.py STREAM_HEADER), then records of
+// a link_block_t without its seq.
+constexpr uint32_t STREAM_MAGIC = 0x4b4c4252; // "RBLK"
+constexpr uint16_t STREAM_VERSION = 1;
+constexpr size_t STREAM_RECORD = sizeof(link_block_t) - sizeof(uint16_t);
+
+static_assert(JOB_BUFFERS * ROBOARM_JOB_BUFFER_BYTES + 2 * (JOB_BUFFERS * 4 + sizeof(StaticQueue_t)) + 32 <= ROBOARM_ARENA_JOB_BYTES,
+              "ROBOARM_ARENA_JOB_BYTES too small for the job buffers");
+static_assert(ROBOARM_JOB_BUFFER_BYTES <= UINT16_MAX, "job_chunk_t::len is 16 bits");
+
+struct job_header_t {
+    uint32_t magic;
+    uint8_t version;
+    job_kind_t kind;
+    uint16_t reserved;
+    uint32_t bytes;
+    uint32_t crc32;
+};
+
+struct __attribute__((packed)) stream_header_t {
+    uint32_t magic;
+    uint16_t version;
+    uint8_t axes;
+    uint8_t reserved;
+    int32_t start[AXIS_COUNT];
+};
+static_assert(sizeof(stream_header_t) == 24, "stream_header_t is gcode_compile.py's format");
+
+// Reader -> job task: a filled buffer, `len` 0 at the end of the job.
+struct job_chunk_t {
+    uint8_t index;
+    uint16_t len;
+};
+
+// State of the job being run, job task only.
+struct job_run_t {
+    gcode_parser_t parser;
+    gcode_modal_t modal;
+    bool tool_space;
+    float joints[AXIS_COUNT];
+    union {
+        stream_header_t header;
+        uint8_t record[STREAM_RECORD];
+    };
+    size_t have;               // bytes of header / record collected
+    bool started;              // stream header taken
+    int32_t position[AXIS_COUNT];
+    job_end_t end;
+    bool done;
+};
+
+static job_spool_config_t s_config;
+static const esp_partition_t *s_partition;
+static const uint8_t *s_map;   // the partition, while a job is stored
+static esp_partition_mmap_handle_t s_map_handle;
+static bool s_stored;
+static job_info_t s_job;
+static bool s_uploading;
+static job_info_t s_upload;
+static uint32_t s_written;
+static uint8_t *s_buffers[JOB_BUFFERS]; // ARENA_JOB
+static QueueHandle_t s_free;   // buffer index
+static QueueHandle_t s_full;   // job_chunk_t
+static TaskHandle_t s_task;
+static TaskHandle_t s_reader;
+static job_run_t s_run;
+static std::atomic<bool> s_running;
+static std::atomic<bool> s_stop;      // job_spool_stop
+static std::atomic<bool> s_failed;    // the job task gave up, the reader may too
+static std::atomic<bool> s_end_ready;
+static job_end_t s_end;
+
+static bool idle_enough(void) {
+    const machine_state_t state = machine_state_get();
+    return state == MACHINE_IDLE || state == MACHINE_ALARM;
+}
+
+static void unmap(void) {
+    if (s_map) {
+        esp_partition_munmap(s_map_handle);
+        s_map = nullptr;
+    }
+}
+
+static esp_err_t map(void) {
+    const void *ptr;
+    ESP_RETURN_ON_ERROR(esp_partition_mmap(s_partition, 0, s_partition->size, ESP_PARTITION_MMAP_DATA, &ptr, &s_map_handle), TAG,
+                        "mmap");
+    s_map = static_cast<const uint8_t *>(ptr);
+    return ESP_OK;
+}
+
+// ---- Running ----
+
+static void reader_task(void *arg) {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        const uint8_t *data = s_map + JOB_DATA_OFFSET;
+        for (uint32_t offset = 0; offset < s_job.bytes && !s_stop.load() && !s_failed.load();) {
+            job_chunk_t chunk = {};
+            xQueueReceive(s_free, &chunk.index, portMAX_DELAY);
+            const uint32_t left = s_job.bytes - offset;
+            chunk.len = static_cast<uint16_t>(left < ROBOARM_JOB_BUFFER_BYTES ? left : ROBOARM_JOB_BUFFER_BYTES);
+            memcpy(s_buffers[chunk.index], data + offset, chunk.len);
+            offset += chunk.len;
+            xQueueSend(s_full, &chunk, portMAX_DELAY);
+        }
+        const job_chunk_t end = {};
+        xQueueSend(s_full, &end, portMAX_DELAY);
+    }
+}
+
+static void fail(job_run_t &run, gcode_error_t error) {
+    run.end.error = error;
+    run.done = true;
+    s_failed.store(true);
+}
+
+static void queue_move(job_run_t &run, const link_move_command_t &command) {
+    if (s_stop.load()) {
+        run.end.stopped = true;
+        run.done = true;
+        return;
+    }
+    machine_state_motion_queued();
+    xQueueSend(s_config.moves, &command, portMAX_DELAY);
+}
+
+// One byte of a G-code job, through the same steps as a console line.
+static void gcode_byte(job_run_t &run, char c) {
+    const gcode_result_t result = gcode_parser_feed(run.parser, c);
+    if (result == GCODE_ERROR) {
+        fail(run, run.parser.error);
+    } else if (result == GCODE_LINE) {
+        const gcode_line_t &line = run.parser.line;
+        if (line.axis_mask && machine_state_get() == MACHINE_ALARM) {
+            fail(run, GCODE_ERROR_ALARM_LOCK);
+            return;
+        }
+        link_move_command_t command;
+        bool moved = false;
+        const gcode_error_t error = serial_link_gcode_move(run.modal, line, run.tool_space, run.joints, command, moved);
+        if (error != GCODE_OK) {
+            fail(run, error);
+        } else if (moved) {
+            queue_move(run, command);
+        }
+    }
+    if (c == '\n' && !run.done) {
+        run.end.line++;
+    }
+}
+
+static void stream_header(job_run_t &run) {
+    const stream_header_t &header = run.header;
+    if (header.magic != STREAM_MAGIC || header.version != STREAM_VERSION || header.axes != AXIS_COUNT) {
+        fail(run, GCODE_ERROR_UNSUPPORTED);
+        return;
+    }
+    // like %%PLAY: the first block starts at rest from the stream's start
+    link_move_command_t command = {};
+    command.kind = LINK_COMMAND_MOVE;
+    memcpy(command.target, header.start, sizeof(command.target));
+    memcpy(run.position, header.start, sizeof(run.position));
+    run.started = true;
+    queue_move(run, command);
+}
+
+static void stream_record(job_run_t &run) {
+    run.end.line++;
+    link_block_t frame = {};
+    memcpy(reinterpret_cast<uint8_t *>(&frame) + sizeof(frame.seq), run.record, STREAM_RECORD);
+    link_move_command_t command = {};
+    command.kind = LINK_COMMAND_BLOCK;
+    if (!link_block_decode(frame, command.block)) {
+        fail(run, GCODE_ERROR_NUMBER);
+        return;
+    }
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        const int32_t steps = static_cast<int32_t>(command.block.steps[i]);
+        run.position[i] += command.block.dir_bits & (1u << i) ? -steps : steps;
+    }
+    queue_move(run, command);
+}
+
+// Bytes of a block stream, cut into its header and records whatever the
+// buffer boundaries.
+static void stream_bytes(job_run_t &run, const uint8_t *data, size_t len) {
+    while (len && !run.done) {
+        const size_t need = run.started ? STREAM_RECORD : sizeof(stream_header_t);
+        const size_t take = need - run.have < len ? need - run.have : len;
+        memcpy(run.record + run.have, data, take);
+        run.have += take;
+        data += take;
+        len -= take;
+        if (run.have == need) {
+            run.have = 0;
+            if (run.started) {
+                stream_record(run);
+            } else {
+                stream_header(run);
+            }
+        }
+    }
+}
+
+// [JOB END:<how>|MPos:<joints>], the joint values being where the job leaves
+// the axes once its moves have run.
+static void report_end(const job_end_t &end) {
+    if (end.stopped) {
+        printf("[JOB END:stopped");
+    } else if (end.error != GCODE_OK) {
+        printf("[JOB END:error:%d,%lu", static_cast<int>(end.error), static_cast<unsigned long>(end.line));
+    } else {
+        printf("[JOB END:ok");
+    }
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        printf("%s%.3f", i ? "," : "|MPos:", static_cast<double>(end.joints[i]));
+    }
+    printf("]\n");
+    fflush(stdout);
+}
+
+static void finish(job_run_t &run) {
+    if (!run.done && s_stop.load()) {
+        // the reader may have stopped in the middle of a line or record
+        run.end.stopped = true;
+        run.done = true;
+    }
+    if (!run.done) {
+        if (s_job.kind == JOB_GCODE) {
+            // a last line without its newline
+            gcode_byte(run, '\n');
+        } else if (!run.started || run.have) {
+            // no header, or a record cut short
+            run.end.line += run.started;
+            fail(run, GCODE_ERROR_NUMBER);
+        }
+    }
+    if (s_job.kind == JOB_BLOCKS && run.started) {
+        axes_to_mm(run.position, run.end.joints);
+    } else if (s_job.kind == JOB_GCODE && !run.tool_space) {
+        for (size_t i = 0; i < AXIS_COUNT; i++) {
+            run.end.joints[i] = static_cast<float>(run.modal.position[i]) / GCODE_SCALE;
+        }
+    } else {
+        memcpy(run.end.joints, run.joints, sizeof(run.end.joints));
+    }
+    s_end = run.end;
+    s_end_ready.store(true);
+    report_end(run.end);
+    s_running.store(false);
+}
+
+static void job_task(void *arg) {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        job_run_t &run = s_run;
+        run.end.line = s_job.kind == JOB_GCODE ? 1 : 0;
+        xTaskNotifyGive(s_reader);
+        job_chunk_t chunk;
+        while (xQueueReceive(s_full, &chunk, portMAX_DELAY) == pdTRUE && chunk.len) {
+            const uint8_t *data = s_buffers[chunk.index];
+            if (s_job.kind == JOB_GCODE) {
+                for (size_t i = 0; i < chunk.len && !run.done; i++) {
+                    gcode_byte(run, static_cast<char>(data[i]));
+                }
+            } else {
+                stream_bytes(run, data, chunk.len);
+            }
+            xQueueSend(s_free, &chunk.index, 0);
+        }
+        finish(run);
+    }
+}
+
+// ---- Storing ----
+
+static esp_err_t finish_upload(void) {
+    s_uploading = false;
+    uint8_t chunk[VERIFY_CHUNK];
+    uint32_t crc = 0;
+    for (uint32_t offset = 0; offset < s_upload.bytes; offset += sizeof(chunk)) {
+        const uint32_t left = s_upload.bytes - offset;
+        const size_t len = left < sizeof(chunk) ? left : sizeof(chunk);
+        ESP_RETURN_ON_ERROR(esp_partition_read(s_partition, JOB_DATA_OFFSET + offset, chunk, len), TAG, "read back");
+        crc = esp_rom_crc32_le(crc, chunk, len);
+    }
+    ESP_RETURN_ON_FALSE(crc == s_upload.crc32, ESP_ERR_INVALID_CRC, TAG, "job reads back as crc %08lx, not %08lx",
+                        static_cast<unsigned long>(crc), static_cast<unsigned long>(s_upload.crc32));
+    job_header_t header = {};
+    header.magic = JOB_MAGIC;
+    header.version = JOB_VERSION;
+    header.kind = s_upload.kind;
+    header.bytes = s_upload.bytes;
+    header.crc32 = s_upload.crc32;
+    ESP_RETURN_ON_ERROR(esp_partition_write(s_partition, 0, &header, sizeof(header)), TAG, "header");
+    ESP_RETURN_ON_ERROR(map(), TAG, "map job");
+    s_job = s_upload;
+    s_stored = true;
+    ESP_LOGI(TAG, "stored %s job of %lu bytes", s_job.kind == JOB_GCODE ? "G-code" : "block", static_cast<unsigned long>(s_job.bytes));
+    return ESP_OK;
+}
+
+esp_err_t job_spool_begin(job_kind_t kind, uint32_t bytes, uint32_t crc32) {
+    ESP_RETURN_ON_FALSE(s_partition, ESP_ERR_NOT_SUPPORTED, TAG, "no %s partition", JOB_PARTITION);
+    ESP_RETURN_ON_FALSE(kind <= JOB_BLOCKS && bytes && bytes <= s_partition->size - JOB_DATA_OFFSET, ESP_ERR_INVALID_SIZE, TAG,
+                        "job of %lu bytes", static_cast<unsigned long>(bytes));
+    ESP_RETURN_ON_FALSE(!s_running.load() && idle_enough(), ESP_ERR_INVALID_STATE, TAG, "machine busy");
+    s_uploading = false;
+    s_stored = false;
+    unmap();
+    const uint32_t erase = JOB_DATA_OFFSET + (bytes + JOB_SECTOR - 1) / JOB_SECTOR * JOB_SECTOR;
+    ESP_RETURN_ON_ERROR(esp_partition_erase_range(s_partition, 0, erase), TAG, "erase");
+    s_upload = {kind, bytes, crc32};
+    s_written = 0;
+    s_uploading = true;
+    return ESP_OK;
+}
+
+esp_err_t job_spool_write(uint32_t offset, const uint8_t *data, size_t len) {
+    ESP_RETURN_ON_FALSE(s_partition, ESP_ERR_NOT_SUPPORTED, TAG, "no %s partition", JOB_PARTITION);
+    ESP_RETURN_ON_FALSE(s_uploading && offset == s_written && len <= s_upload.bytes - offset && idle_enough(), ESP_ERR_INVALID_STATE,
+                        TAG, "write of %u bytes at %lu", static_cast<unsigned>(len), static_cast<unsigned long>(offset));
+    const esp_err_t err = esp_partition_write(s_partition, JOB_DATA_OFFSET + offset, data, len);
+    if (err != ESP_OK) {
+        s_uploading = false;
+        ESP_LOGE(TAG, "write: %s", esp_err_to_name(err));
+        return err;
+    }
+    s_written += len;
+    return s_written == s_upload.bytes ? finish_upload() : ESP_OK;
+}
+
+bool job_spool_stored(job_info_t *info) {
+    if (s_stored) {
+        *info = s_job;
+    }
+    return s_stored;
+}
+
+esp_err_t job_spool_run(const gcode_modal_t &modal, bool tool_space, const float joints[AXIS_COUNT]) {
+    ESP_RETURN_ON_FALSE(s_partition, ESP_ERR_NOT_SUPPORTED, TAG, "no %s partition", JOB_PARTITION);
+    ESP_RETURN_ON_FALSE(s_stored, ESP_ERR_NOT_FOUND, TAG, "no job stored");
+    ESP_RETURN_ON_FALSE(!s_running.load() && machine_state_get() == MACHINE_IDLE, ESP_ERR_INVALID_STATE, TAG, "machine busy");
+    s_run = {};
+    gcode_parser_reset(s_run.parser);
+    s_run.modal = modal;
+    s_run.tool_space = tool_space;
+    memcpy(s_run.joints, joints, sizeof(s_run.joints));
+    s_stop.store(false);
+    s_failed.store(false);
+    s_end_ready.store(false);
+    s_running.store(true);
+    xTaskNotifyGive(s_task);
+    return ESP_OK;
+}
+
+void job_spool_stop(void) {
+    s_stop.store(true);
+}
+
+bool job_spool_running(void) {
+    return s_running.load();
+}
+
+bool job_spool_take_end(job_end_t *end) {
+    if (!s_end_ready.load()) {
+        return false;
+    }
+    *end = s_end;
+    s_end_ready.store(false);
+    return true;
+}
+
+// A FreeRTOS queue with its storage in ARENA_JOB.
+static QueueHandle_t new_queue(size_t length, size_t item_size) {
+    StaticQueue_t *queue = arena_new<StaticQueue_t>(ARENA_JOB);
+    uint8_t *storage = static_cast<uint8_t *>(arena_alloc(ARENA_JOB, length * item_size, alignof(uint32_t)));
+    return queue && storage ? xQueueCreateStatic(length, item_size, storage, queue) : NULL;
+}
+
+esp_err_t job_spool_start(const job_spool_config_t *config) {
+    ESP_RETURN_ON_FALSE(config && config->moves, ESP_ERR_INVALID_ARG, TAG, "invalid config");
+    s_config = *config;
+    for (size_t i = 0; i < JOB_BUFFERS; i++) {
+        s_buffers[i] = static_cast<uint8_t *>(arena_alloc(ARENA_JOB, ROBOARM_JOB_BUFFER_BYTES, alignof(uint32_t)));
+        ESP_RETURN_ON_FALSE(s_buffers[i], ESP_ERR_NO_MEM, TAG, "job buffers");
+    }
+    s_free = new_queue(JOB_BUFFERS, sizeof(uint8_t));
+    s_full = new_queue(JOB_BUFFERS + 1, sizeof(job_chunk_t));
+    ESP_RETURN_ON_FALSE(s_free && s_full, ESP_ERR_NO_MEM, TAG, "job queues");
+    for (uint8_t i = 0; i < JOB_BUFFERS; i++) {
+        xQueueSend(s_free, &i, 0);
+    }
+    ESP_RETURN_ON_FALSE(xTaskCreatePinnedToCore(job_task, "job", s_config.task_stack, NULL, s_config.task_priority, &s_task,
+                                                s_config.task_core) == pdPASS,
+                        ESP_ERR_NO_MEM, TAG, "job task");
+    ESP_RETURN_ON_FALSE(xTaskCreatePinnedToCore(reader_task, "job_read", s_config.reader_stack, NULL, s_config.task_priority, &s_reader,
+                                                s_config.task_core) == pdPASS,
+                        ESP_ERR_NO_MEM, TAG, "job reader task");
+
+    s_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, JOB_PARTITION);
+    if (!s_partition) {
+        ESP_LOGW(TAG, "no %s partition, jobs cannot be stored", JOB_PARTITION);
+        return ESP_OK;
+    }
+    job_header_t header;
+    ESP_RETURN_ON_ERROR(esp_partition_read(s_partition, 0, &header, sizeof(header)), TAG, "header");
+    if (header.magic == JOB_MAGIC && header.version == JOB_VERSION && header.kind <= JOB_BLOCKS && header.bytes &&
+        header.bytes <= s_partition->size - JOB_DATA_OFFSET) {
+        ESP_RETURN_ON_ERROR(map(), TAG, "map job");
+        s_job = {header.kind, header.bytes, header.crc32};
+        s_stored = true;
+    }
+    ESP_LOGI(TAG, "%s partition of %lu KB, %s", JOB_PARTITION, static_cast<unsigned long>(s_partition->size / 1024),
+             s_stored ? "job stored" : "empty");
+    return ESP_OK;
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include "gcode_parser.h"
+#include "motion/axis_config.h"
+
+// One job stored on the device and run from there, so a long job no longer
+// depends on the host keeping up. The job lives in the "jobs" flash partition
+// (partitions.csv): a header sector, then the job as the host sent it, either
+// G-code text or a precompiled block stream of gcode_compile.py. The SD card
+// of config_xyza.yaml is not wired on this board.
+//
+// Storing: job_spool_begin erases what the job needs, the link writes its
+// bytes in order from SPOOL frames (protocol.h), and once the last byte is
+// in the job is read back against the CRC-32 the host gave and the header is
+// written. Until then no job is stored. Erasing and writing stall the flash
+// cache of both cores, so the link only stores a job while the machine is
+// Idle or Alarm.
+//
+// Running: a reader task copies the job from the memory-mapped partition into
+// two RAM buffers, one ahead of the other, and the job task parses them into
+// the link's move queue as a host would send it, G-code lines as moves (or
+// tool-space lines) and blocks as BLOCK commands after a rapid to the
+// stream's start. The job task spends most of its time waiting for room in
+// the queue, and by then the next buffer is already filled, so a slot that
+// opens is never waiting on flash. Plain flash reads would also stall the
+// motion core; reads through the mapping only take cache misses on core 0.
+
+enum job_kind_t : uint8_t {
+    JOB_GCODE = 0,
+    JOB_BLOCKS = 1, // header and BLOCK records as written by gcode_compile.py
+};
+
+struct job_info_t {
+    job_kind_t kind;
+    uint32_t bytes;
+    uint32_t crc32;             // zlib's CRC-32 of the bytes
+};
+
+// How a job ended, see job_spool_take_end.
+struct job_end_t {
+    gcode_error_t error;        // GCODE_OK if every line was queued
+    uint32_t line;              // G-code line or block record the error is in, from 1
+    bool stopped;               // job_spool_stop
+    float joints[AXIS_COUNT];   // where the job leaves the axes, joint values
+};
+
+struct job_spool_config_t {
+    QueueHandle_t moves;        // of link_move_command_t
+    uint32_t task_stack;        // job task: parses the job into `moves`
+    UBaseType_t task_priority;
+    BaseType_t task_core;
+    uint32_t reader_stack;      // reader task, same priority and core
+};
+
+// Without a "jobs" partition the tasks still start and every call below
+// answers ESP_ERR_NOT_SUPPORTED.
+esp_err_t job_spool_start(const job_spool_config_t *config);
+
+// The calls below are for one task, the link.
+
+// Drop the stored job and erase room for a new one of `bytes`.
+esp_err_t job_spool_begin(job_kind_t kind, uint32_t bytes, uint32_t crc32);
+// The next `len` bytes of the job begun; `offset` must be where the last
+// write ended. The last byte completes the job: ESP_ERR_INVALID_CRC if it
+// does not read back as begun.
+esp_err_t job_spool_write(uint32_t offset, const uint8_t *data, size_t len);
+// False if no complete job is stored.
+bool job_spool_stored(job_info_t *info);
+
+// Run the stored job (ESP_ERR_NOT_FOUND if there is none) from Idle. G-code
+// starts from `modal` (position, feed, distance mode), in tool space if
+// `tool_space` with the axes at `joints`.
+esp_err_t job_spool_run(const gcode_modal_t &modal, bool tool_space, const float joints[AXIS_COUNT]);
+// Stop reading the job; what it queued already still runs.
+void job_spool_stop(void);
+// From job_spool_run until the job task has queued its last move.
+bool job_spool_running(void);
+// True once per finished job, with how it ended.
+bool job_spool_take_end(job_end_t *end);
@@ -0,0 +1,111 @@
+#include "protocol.h"
+#include <string.h>
+
+enum : uint8_t {
+    PARSE_SYNC0,
+    PARSE_SYNC1,
+    PARSE_TYPE,
+    PARSE_LEN,
+    PARSE_PAYLOAD,
+    PARSE_CRC0,
+    PARSE_CRC1,
+};
+
+uint16_t link_crc16(uint16_t crc, const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        crc ^= static_cast<uint16_t>(data[i]) << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 0x8000 ? static_cast<uint16_t>(crc << 1) ^ 0x1021 : static_cast<uint16_t>(crc << 1);
+        }
+    }
+    return crc;
+}
+
+size_t link_encode_frame(uint8_t type, const void *payload, size_t len, uint8_t *out) {
+    out[0] = LINK_SYNC0;
+    out[1] = LINK_SYNC1;
+    out[2] = type;
+    out[3] = static_cast<uint8_t>(len);
+    if (len) {
+        memcpy(&out[4], payload, len);
+    }
+    const uint16_t crc = link_crc16(0xffff, &out[2], len + 2);
+    out[4 + len] = crc & 0xff;
+    out[5 + len] = crc >> 8;
+    return len + LINK_FRAME_OVERHEAD;
+}
+
+bool link_block_decode(const link_block_t &frame, motion_block_t &block) {
+    block = {};
+    memcpy(block.steps, frame.steps, sizeof(block.steps));
+    block.lead_steps = frame.lead_steps;
+    block.entry_rate = frame.entry_rate;
+    block.cruise_rate = frame.cruise_rate;
+    block.exit_rate = frame.exit_rate;
+    block.accel = frame.accel;
+    block.decel_steps = frame.decel_steps;
+    block.dir_bits = frame.dir_bits;
+    block.profile = static_cast<ramp_profile_t>(frame.profile);
+    uint32_t lead = 0;
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        lead = block.steps[i] > lead ? block.steps[i] : lead;
+    }
+    return lead && lead == block.lead_steps && block.cruise_rate && block.decel_steps <= block.lead_steps &&
+           frame.profile <= RAMP_SCURVE;
+}
+
+void link_parser_reset(link_parser_t &parser) {
+    const uint32_t crc_errors = parser.crc_errors;
+    parser = {};
+    parser.crc_errors = crc_errors;
+}
+
+link_parse_result_t link_parser_feed(link_parser_t &parser, uint8_t byte) {
+    switch (parser.state) {
+    case PARSE_SYNC0:
+        if (byte != LINK_SYNC0) {
+            return LINK_PARSE_NOT_FRAME;
+        }
+        parser.state = PARSE_SYNC1;
+        return LINK_PARSE_MORE;
+    case PARSE_SYNC1:
+        // a repeated first sync byte keeps us waiting for the second one
+        parser.state = byte == LINK_SYNC1 ? PARSE_TYPE : byte == LINK_SYNC0 ? PARSE_SYNC1 : PARSE_SYNC0;
+        return parser.state == PARSE_SYNC0 ? LINK_PARSE_NOT_FRAME : LINK_PARSE_MORE;
+    case PARSE_TYPE:
+        parser.type = byte;
+        parser.crc = link_crc16(0xffff, &byte, 1);
+        parser.state = PARSE_LEN;
+        return LINK_PARSE_MORE;
+    case PARSE_LEN:
+        if (byte > LINK_MAX_PAYLOAD) {
+            link_parser_reset(parser);
+            return LINK_PARSE_NOT_FRAME;
+        }
+        parser.len = byte;
+        parser.received = 0;
+        parser.crc = link_crc16(parser.crc, &byte, 1);
+        parser.state = byte ? PARSE_PAYLOAD : PARSE_CRC0;
+        return LINK_PARSE_MORE;
+    case PARSE_PAYLOAD:
+        parser.payload[parser.received++] = byte;
+        parser.crc = link_crc16(parser.crc, &byte, 1);
+        if (parser.received == parser.len) {
+            parser.state = PARSE_CRC0;
+        }
+        return LINK_PARSE_MORE;
+    case PARSE_CRC0:
+        parser.crc ^= byte;
+        parser.state = PARSE_CRC1;
+        return LINK_PARSE_MORE;
+    default: {
+        const bool ok = (parser.crc ^ (static_cast<uint16_t>(byte) << 8)) == 0;
+        parser.state = PARSE_SYNC0;
+        if (!ok) {
+            parser.crc_errors++;
+            return LINK_PARSE_BAD_CRC;
+        }
+        return LINK_PARSE_FRAME;
+    }
+    }
+}
@@ -0,0 +1,131 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "motion/motion_block.h"
+
+// Framed binary host protocol, mirrored by source/py/home.py --binary.
+//
+//   0xA5 0x5A | type | len | payload[len] | crc16 (LE)
+//
+// The CRC is CRC-16/CCITT-FALSE over type, len and payload. All fields are
+// little-endian. Bytes outside a frame are skipped, so console text on the
+// same UART (always < 0x80) never looks like a sync sequence.
+//
+// The host numbers every MOVE and BLOCK. The device accepts only the next sequence
+// number and answers each frame with an ACK carrying the last accepted
+// number and the free move slots; the host keeps at most that many moves in
+// flight. A bad CRC or a gap makes the device answer LINK_ACK_RESEND, and the
+// host resends everything after the acknowledged number.
+
+constexpr uint8_t LINK_SYNC0 = 0xa5;
+constexpr uint8_t LINK_SYNC1 = 0x5a;
+constexpr size_t LINK_MAX_PAYLOAD = 64;
+constexpr size_t LINK_FRAME_OVERHEAD = 6;
+
+enum link_frame_type_t : uint8_t {
+    LINK_FRAME_MOVE = 0x01, // host -> device, link_move_t
+    LINK_FRAME_PING = 0x02, // host -> device, empty; answered with an ACK
+    LINK_FRAME_BLOCK = 0x03, // host -> device, link_block_t
+    LINK_FRAME_SPOOL = 0x04, // host -> device, link_spool_t
+    LINK_FRAME_ACK = 0x81,  // device -> host, link_ack_t
+    LINK_FRAME_TELEMETRY = 0x82, // device -> host, link_telemetry_t, unsolicited
+};
+
+enum link_ack_status_t : uint8_t {
+    LINK_ACK_OK = 0,
+    LINK_ACK_RESEND = 1,    // resend everything after `seq`
+    LINK_ACK_REJECTED = 2,  // frame understood but not acceptable
+};
+
+enum link_move_flags_t : uint8_t {
+    LINK_MOVE_RAPID = 1u << 0, // feed ignored, axes at their max rate
+};
+
+struct __attribute__((packed)) link_move_t {
+    uint16_t seq;
+    uint8_t flags;
+    uint8_t reserved;
+    float feed;                      // mm/min
+    int32_t target[AXIS_COUNT];      // absolute, steps
+};
+static_assert(sizeof(link_move_t) == 24, "link_move_t is part of the wire format");
+
+// A block planned offline (source/py/gcode_compile.py), run as is without
+// the planner. Numbered in the same sequence as MOVE frames.
+struct __attribute__((packed)) link_block_t {
+    uint16_t seq;
+    uint8_t dir_bits;                // bit i set: axis i moves negative
+    uint8_t profile;                 // ramp_profile_t
+    uint32_t steps[AXIS_COUNT];
+    uint32_t lead_steps;
+    uint32_t entry_rate;             // lead steps/s
+    uint32_t cruise_rate;
+    uint32_t exit_rate;
+    uint32_t accel;                  // lead steps/s^2
+    uint32_t decel_steps;
+};
+static_assert(sizeof(link_block_t) == 44, "link_block_t is part of the wire format");
+
+// Fill a motion block from `frame`, with the checks motion_engine_queue
+// makes, so a bad file fails where it is read and not in the feeder.
+bool link_block_decode(const link_block_t &frame, motion_block_t &block);
+
+// Bytes of a job being stored on the device (link/job_spool.h), in order,
+// numbered and acknowledged like moves. `data` is as long as the frame
+// leaves room for.
+struct __attribute__((packed)) link_spool_t {
+    uint16_t seq;
+    uint8_t reserved[2];
+    uint32_t offset;                 // of data[0] in the job
+    uint8_t data[LINK_MAX_PAYLOAD - 8];
+};
+static_assert(sizeof(link_spool_t) == LINK_MAX_PAYLOAD, "link_spool_t is part of the wire format");
+
+struct __attribute__((packed)) link_ack_t {
+    uint16_t seq;                    // last accepted move
+    uint8_t status;
+    uint8_t free;                    // move slots left on the device
+};
+static_assert(sizeof(link_ack_t) == 4, "link_ack_t is part of the wire format");
+
+// One sample of link/telemetry.h.
+struct __attribute__((packed)) link_telemetry_t {
+    uint32_t time_us;                // esp_timer at the sample, wraps
+    int32_t position[AXIS_COUNT];    // steps at the pins
+    int32_t rate[AXIS_COUNT];        // steps/s, signed
+    uint8_t motion_blocks;           // blocks in the motion ring
+    uint8_t planner_blocks;          // blocks in the look-ahead
+    uint8_t moves;                   // moves waiting for the planner
+    uint8_t state;                   // machine_state_t
+    uint8_t feed_percent;
+    uint8_t rapid_percent;
+    uint16_t seq;                    // sample number, a gap is a sample lost
+};
+static_assert(sizeof(link_telemetry_t) == 44, "link_telemetry_t is part of the wire format");
+
+uint16_t link_crc16(uint16_t crc, const uint8_t *data, size_t len);
+
+// Write a complete frame into `out` (at least len + LINK_FRAME_OVERHEAD bytes).
+// Returns the frame size.
+size_t link_encode_frame(uint8_t type, const void *payload, size_t len, uint8_t *out);
+
+// Byte-by-byte frame decoder, resynchronises on the sync bytes.
+struct link_parser_t {
+    uint8_t state;
+    uint8_t type;
+    uint8_t len;
+    uint8_t received;
+    uint16_t crc;
+    uint8_t payload[LINK_MAX_PAYLOAD];
+    uint32_t crc_errors;
+};
+
+enum link_parse_result_t : uint8_t {
+    LINK_PARSE_MORE,       // byte consumed, no complete frame yet
+    LINK_PARSE_FRAME,      // parser.type / len / payload hold a frame
+    LINK_PARSE_BAD_CRC,
+    LINK_PARSE_NOT_FRAME,  // byte is outside any frame
+};
+
+void link_parser_reset(link_parser_t &parser);
+link_parse_result_t link_parser_feed(link_parser_t &parser, uint8_t byte);
@@ -0,0 +1,597 @@
+#include "serial_link.h"
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <esp_check.h>
+#include <esp_log.h>
+#include <driver/uart_vfs.h>
+#include <freertos/task.h>
+#include "gcode_parser.h"
+#include "job_spool.h"
+#include "protocol.h"
+#include "telemetry.h"
+#include "arena.h"
+#include "diag/instrumentation.h"
+#include "machine/homing.h"
+#include "machine/machine_state.h"
+#include "motion/kinematics.h"
+#include "motion/motion_engine.h"
+
+static const char *TAG = "serial_link";
+
+constexpr size_t LINK_RX_BUFFER = 2048;
+constexpr size_t LINK_TX_BUFFER = 512;
+constexpr size_t LINK_READ_CHUNK = 128;
+constexpr size_t LINK_LINE_MAX = 32;
+
+// Realtime bytes (serial_link.h)
+constexpr uint8_t RT_STATUS = '?';
+constexpr uint8_t RT_HOLD = '!';
+constexpr uint8_t RT_RESUME = '~';
+constexpr uint8_t RT_FEED_RESET = 0x90;
+constexpr uint8_t RT_FEED_PLUS_10 = 0x91;
+constexpr uint8_t RT_FEED_MINUS_10 = 0x92;
+constexpr uint8_t RT_FEED_PLUS_1 = 0x93;
+constexpr uint8_t RT_FEED_MINUS_1 = 0x94;
+constexpr uint8_t RT_RAPID_100 = 0x95;
+constexpr uint8_t RT_RAPID_50 = 0x96;
+constexpr uint8_t RT_RAPID_25 = 0x97;
+constexpr int FEED_OVERRIDE_MIN = 10;
+constexpr int FEED_OVERRIDE_MAX = 100;
+
+static serial_link_config_t s_config;
+static link_parser_t s_parser;
+static uint16_t s_last_seq;
+static bool s_synced;          // a move has been accepted since boot
+static bool s_resend_pending;  // RESEND sent, later frames of the window are dropped quietly
+static char s_line[LINK_LINE_MAX]; // `$` command being typed
+static size_t s_line_len;       // LINK_LINE_MAX once a line overflowed, until its end
+static gcode_parser_t s_gcode;
+static gcode_modal_t s_modal;
+static bool s_line_start = true; // nothing but frames since the last '\n'
+static bool s_tool_space;       // G-code positions are tool poses, `$KIN=1`
+static float s_joints[AXIS_COUNT]; // where the last tool-space line ends, joint values
+static bool s_homing;           // `$H` handed to the planner, not answered yet
+static int32_t s_home_position[AXIS_COUNT]; // where it leaves the axes, steps
+
+static void send_ack(uint16_t seq, link_ack_status_t status) {
+    link_ack_t ack = {};
+    ack.seq = seq;
+    ack.status = status;
+    const UBaseType_t free = uxQueueSpacesAvailable(s_config.moves);
+    ack.free = free > UINT8_MAX ? UINT8_MAX : static_cast<uint8_t>(free);
+    uint8_t frame[sizeof(ack) + LINK_FRAME_OVERHEAD];
+    const size_t len = link_encode_frame(LINK_FRAME_ACK, &ack, sizeof(ack), frame);
+    uart_write_bytes(s_config.port, frame, len);
+}
+
+// The first frame after boot sets the sequence, afterwards only the next
+// number is taken; repeats of the last one are acknowledged again.
+static bool next_in_sequence(uint16_t seq) {
+    if (!s_synced || seq == static_cast<uint16_t>(s_last_seq + 1)) {
+        return true;
+    }
+    if (seq == s_last_seq) {
+        send_ack(s_last_seq, LINK_ACK_OK);
+    } else if (!s_resend_pending) {
+        s_resend_pending = true;
+        send_ack(s_last_seq, LINK_ACK_RESEND);
+    }
+    return false;
+}
+
+static void accepted(uint16_t seq) {
+    s_last_seq = seq;
+    s_synced = true;
+    s_resend_pending = false;
+    send_ack(s_last_seq, LINK_ACK_OK);
+}
+
+// Moves wait for a running stored job or homing like they do for an alarm.
+static void accept(uint16_t seq, const link_move_command_t &command) {
+    if (machine_state_get() == MACHINE_ALARM || job_spool_running() || s_homing) {
+        send_ack(s_last_seq, LINK_ACK_REJECTED);
+        return;
+    }
+    machine_state_motion_queued();
+    if (xQueueSend(s_config.moves, &command, 0) != pdTRUE) {
+        machine_state_motion_done();
+        // host ignored the credit it was given
+        if (!s_resend_pending) {
+            s_resend_pending = true;
+            send_ack(s_last_seq, LINK_ACK_RESEND);
+        }
+        return;
+    }
+    accepted(seq);
+}
+
+static void handle_move(const link_parser_t &parser) {
+    if (parser.len != sizeof(link_move_t)) {
+        send_ack(s_last_seq, LINK_ACK_REJECTED);
+        return;
+    }
+    link_move_t move;
+    memcpy(&move, parser.payload, sizeof(move));
+    if (!next_in_sequence(move.seq)) {
+        return;
+    }
+    link_move_command_t command = {};
+    command.kind = LINK_COMMAND_MOVE;
+    memcpy(command.target, move.target, sizeof(command.target));
+    command.feed = move.flags & LINK_MOVE_RAPID ? 0.0f : move.feed;
+    accept(move.seq, command);
+}
+
+static void handle_block(const link_parser_t &parser) {
+    link_block_t frame;
+    if (parser.len != sizeof(frame)) {
+        send_ack(s_last_seq, LINK_ACK_REJECTED);
+        return;
+    }
+    memcpy(&frame, parser.payload, sizeof(frame));
+    if (!next_in_sequence(frame.seq)) {
+        return;
+    }
+    link_move_command_t command = {};
+    command.kind = LINK_COMMAND_BLOCK;
+    if (!link_block_decode(frame, command.block)) {
+        send_ack(s_last_seq, LINK_ACK_REJECTED);
+        return;
+    }
+    accept(frame.seq, command);
+}
+
+// Bytes of the job being stored. A write the spool refuses is rejected and
+// the upload is over; `$JOB` tells whether a job is stored.
+static void handle_spool(const link_parser_t &parser) {
+    constexpr size_t HEADER = offsetof(link_spool_t, data);
+    if (parser.len <= HEADER) {
+        send_ack(s_last_seq, LINK_ACK_REJECTED);
+        return;
+    }
+    link_spool_t frame;
+    memcpy(&frame, parser.payload, parser.len);
+    if (!next_in_sequence(frame.seq)) {
+        return;
+    }
+    if (job_spool_write(frame.offset, frame.data, parser.len - HEADER) != ESP_OK) {
+        send_ack(s_last_seq, LINK_ACK_REJECTED);
+        return;
+    }
+    accepted(frame.seq);
+}
+
+static void reply(gcode_error_t error) {
+    if (error == GCODE_OK) {
+        printf("ok\n");
+    } else {
+        printf("error:%d\n", static_cast<int>(error));
+    }
+    fflush(stdout);
+}
+
+// G-code position of the axes at `joints`, in the current mode.
+static void set_modal_position(const float joints[AXIS_COUNT]) {
+    float values[AXIS_COUNT];
+    if (s_tool_space) {
+        kinematics_forward(ARM_GEOMETRY, joints, values);
+    } else {
+        memcpy(values, joints, sizeof(values));
+    }
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        s_modal.position[i] = lroundf(values[i] * GCODE_SCALE);
+    }
+}
+
+// `$KIN=<mode>`; the G-code position is carried over into the new mode.
+static void set_tool_space(bool tool_space) {
+    if (!s_tool_space) {
+        for (size_t i = 0; i < AXIS_COUNT; i++) {
+            s_joints[i] = static_cast<float>(s_modal.position[i]) / GCODE_SCALE;
+        }
+    }
+    s_tool_space = tool_space;
+    set_modal_position(s_joints);
+}
+
+// Joint values of the current G-code position.
+static void modal_joints(float joints[AXIS_COUNT]) {
+    if (s_tool_space) {
+        memcpy(joints, s_joints, sizeof(s_joints));
+        return;
+    }
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        joints[i] = static_cast<float>(s_modal.position[i]) / GCODE_SCALE;
+    }
+}
+
+// The G-code position picks up where a stored job left the axes.
+static void take_job_end(void) {
+    job_end_t end;
+    if (job_spool_take_end(&end)) {
+        memcpy(s_joints, end.joints, sizeof(s_joints));
+        set_modal_position(s_joints);
+    }
+}
+
+static gcode_error_t job_error(esp_err_t err) {
+    switch (err) {
+    case ESP_OK:
+        return GCODE_OK;
+    case ESP_ERR_INVALID_STATE:
+        return GCODE_ERROR_NOT_IDLE;
+    case ESP_ERR_INVALID_SIZE:
+        return GCODE_ERROR_NUMBER;
+    default:
+        return GCODE_ERROR_UNSUPPORTED;
+    }
+}
+
+// `$JOB=<kind>,<bytes>,<crc32 hex>`
+static gcode_error_t begin_job(const char *args) {
+    char *end;
+    const unsigned long kind = strtoul(args, &end, 10);
+    if (end == args || *end != ',') {
+        return GCODE_ERROR_NUMBER;
+    }
+    const char *next = end + 1;
+    const unsigned long bytes = strtoul(next, &end, 10);
+    if (end == next || *end != ',') {
+        return GCODE_ERROR_NUMBER;
+    }
+    next = end + 1;
+    const unsigned long crc = strtoul(next, &end, 16);
+    if (end == next || *end || kind > JOB_BLOCKS) {
+        return GCODE_ERROR_NUMBER;
+    }
+    return job_error(job_spool_begin(static_cast<job_kind_t>(kind), bytes, crc));
+}
+
+static void report_job(void) {
+    job_info_t job;
+    if (!job_spool_stored(&job)) {
+        printf("[JOB:none]\n");
+        return;
+    }
+    printf("[JOB:%u,%lu,%08lx%s]\n", static_cast<unsigned>(job.kind), static_cast<unsigned long>(job.bytes),
+           static_cast<unsigned long>(job.crc32), job_spool_running() ? ",RUN" : "");
+}
+
+// Homing runs on the planner task, after everything queued before it. The
+// link keeps serving '?', realtime bytes and frames meanwhile and answers
+// from poll_home once it is over.
+static void handle_home(uint8_t axes) {
+    constexpr uint8_t PROGRAM_AXES = homing_axes_of(HOMING_PROGRAM, sizeof(HOMING_PROGRAM) / sizeof(HOMING_PROGRAM[0]));
+    if (homing_unsupported(axes ? axes : PROGRAM_AXES)) {
+        reply(GCODE_ERROR_NO_HOMING);
+        return;
+    }
+    if (job_spool_running() || s_homing) {
+        reply(GCODE_ERROR_NOT_IDLE);
+        return;
+    }
+    link_move_command_t command = {};
+    command.kind = LINK_COMMAND_HOME;
+    command.home_axes = axes;
+    command.waiter = xTaskGetCurrentTaskHandle();
+    command.home_position = s_home_position;
+    xQueueSend(s_config.moves, &command, portMAX_DELAY);
+    s_homing = true;
+}
+
+// The answer to `$H` once the planner reports homing over; the G-code
+// position picks up where homing left the axes.
+static void poll_home(void) {
+    uint32_t alarm = HOMING_OK;
+    if (!s_homing || xTaskNotifyWait(0, UINT32_MAX, &alarm, 0) != pdTRUE) {
+        return;
+    }
+    s_homing = false;
+    axes_to_mm(s_home_position, s_joints);
+    set_modal_position(s_joints);
+    if (alarm != HOMING_OK) {
+        printf("ALARM:%lu\n", static_cast<unsigned long>(alarm));
+        fflush(stdout);
+        return;
+    }
+    reply(GCODE_OK);
+}
+
+// `$` command lines, answered like G-code lines.
+static void handle_command(const char *line) {
+    take_job_end();
+    if (strcmp(line, "$H") == 0) {
+        handle_home(0);
+        return;
+    }
+    if (strncmp(line, "$H", 2) == 0 && line[2] && !line[3]) {
+        const char *letter = strchr(GCODE_AXIS_LETTERS, line[2]);
+        if (letter) {
+            handle_home(static_cast<uint8_t>(1u << (letter - GCODE_AXIS_LETTERS)));
+            return;
+        }
+    }
+    if (strcmp(line, "$X") == 0) {
+        if (machine_state_get() == MACHINE_ALARM) {
+            machine_state_set(MACHINE_IDLE);
+        }
+    } else if (strcmp(line, "$KIN") == 0) {
+        printf("[KIN:%d]\n", s_tool_space ? 1 : 0);
+    } else if (strcmp(line, "$KIN=0") == 0 || strcmp(line, "$KIN=1") == 0) {
+        set_tool_space(line[5] == '1');
+    } else if (strcmp(line, "$OV") == 0) {
+        const motion_override_t override = motion_engine_override();
+        printf("[OV:%u,%u]\n", override.feed_percent, override.rapid_percent);
+    } else if (strcmp(line, "$TEL") == 0) {
+        printf("[TEL:%lu]\n", static_cast<unsigned long>(telemetry_rate()));
+    } else if (strncmp(line, "$TEL=", 5) == 0) {
+        char *end;
+        const unsigned long hz = strtoul(line + 5, &end, 10);
+        if (end == line + 5 || *end || telemetry_set_rate(hz) != ESP_OK) {
+            reply(GCODE_ERROR_NUMBER);
+            return;
+        }
+    } else if (strcmp(line, "$JOB") == 0) {
+        report_job();
+    } else if (strncmp(line, "$JOB=", 5) == 0 || strcmp(line, "$JOB RUN") == 0) {
+        // homing may not have left Idle yet
+        if (s_homing) {
+            reply(GCODE_ERROR_NOT_IDLE);
+            return;
+        }
+        if (line[4] == '=') {
+            reply(begin_job(line + 5));
+            return;
+        }
+        float joints[AXIS_COUNT];
+        modal_joints(joints);
+        const gcode_error_t error = job_error(job_spool_run(s_modal, s_tool_space, joints));
+        if (error != GCODE_OK) {
+            reply(error);
+            return;
+        }
+    } else if (strcmp(line, "$JOB STOP") == 0) {
+        job_spool_stop();
+    } else if (strcmp(line, "$MEM") == 0) {
+        arena_dump();
+    } else if (strcmp(line, "$STATS") == 0) {
+        instr_dump();
+    } else if (strcmp(line, "$STATS R") == 0) {
+        instr_dump();
+        instr_reset();
+    } else {
+        reply(GCODE_ERROR_INVALID_COMMAND);
+        return;
+    }
+    reply(GCODE_OK);
+}
+
+// Blocks while the planner is behind; the host's character counting keeps
+// the UART buffer from overflowing meanwhile.
+static void handle_gcode(const gcode_line_t &line) {
+    take_job_end();
+    if (line.axis_mask && machine_state_get() == MACHINE_ALARM) {
+        reply(GCODE_ERROR_ALARM_LOCK);
+        return;
+    }
+    if (line.axis_mask && (job_spool_running() || s_homing)) {
+        reply(GCODE_ERROR_NOT_IDLE);
+        return;
+    }
+    link_move_command_t command;
+    bool moved = false;
+    const gcode_error_t error = serial_link_gcode_move(s_modal, line, s_tool_space, s_joints, command, moved);
+    if (error == GCODE_OK && moved) {
+        machine_state_motion_queued();
+        xQueueSend(s_config.moves, &command, portMAX_DELAY);
+    }
+    reply(error);
+}
+
+static uint8_t feed_percent(int percent) {
+    return static_cast<uint8_t>(percent < FEED_OVERRIDE_MIN ? FEED_OVERRIDE_MIN : percent > FEED_OVERRIDE_MAX ? FEED_OVERRIDE_MAX : percent);
+}
+
+// Hold only stops a running job and resume only continues a held one, like
+// Grbl's feed hold and cycle start. Hold while homing aborts it.
+// Every console byte comes through here, so anything else leaves before the
+// override is read under the stream lock the step interrupt refills under.
+static bool realtime_byte(uint8_t byte) {
+    if (byte == RT_STATUS) {
+        machine_state_report();
+        return true;
+    }
+    if (byte != RT_HOLD && byte != RT_RESUME && (byte < RT_FEED_RESET || byte > RT_RAPID_25)) {
+        return false;
+    }
+    motion_override_t override = motion_engine_override();
+    const machine_state_t state = machine_state_get();
+    switch (byte) {
+    case RT_HOLD:
+        if (state == MACHINE_HOME) {
+            homing_abort();
+            return true;
+        }
+        if (state != MACHINE_RUN) {
+            return true;
+        }
+        override.hold = true;
+        break;
+    case RT_RESUME:
+        if (state != MACHINE_HOLD) {
+            return true;
+        }
+        override.hold = false;
+        break;
+    case RT_FEED_RESET:
+        override.feed_percent = FEED_OVERRIDE_MAX;
+        break;
+    case RT_FEED_PLUS_10:
+    case RT_FEED_MINUS_10:
+    case RT_FEED_PLUS_1:
+    case RT_FEED_MINUS_1: {
+        static constexpr int DELTAS[] = {10, -10, 1, -1};
+        override.feed_percent = feed_percent(override.feed_percent + DELTAS[byte - RT_FEED_PLUS_10]);
+        break;
+    }
+    case RT_RAPID_100:
+        override.rapid_percent = 100;
+        break;
+    case RT_RAPID_50:
+        override.rapid_percent = 50;
+        break;
+    case RT_RAPID_25:
+        override.rapid_percent = 25;
+        break;
+    default:
+        return false;
+    }
+    if (motion_engine_set_override(&override) != ESP_OK) {
+        return true;
+    }
+    if (byte == RT_HOLD) {
+        machine_state_set(MACHINE_HOLD);
+    } else if (byte == RT_RESUME) {
+        // the status task reports Idle once nothing is left to run
+        machine_state_set(MACHINE_RUN);
+    }
+    return true;
+}
+
+static void console_byte(uint8_t byte) {
+    if (realtime_byte(byte)) {
+        return;
+    }
+    if (s_line_len == 0 && s_line_start && byte == '$') {
+        s_line[s_line_len++] = '$';
+        return;
+    }
+    if (s_line_len) {
+        if (byte == '\n') {
+            // an overlong line is answered as invalid
+            s_line[s_line_len < LINK_LINE_MAX ? s_line_len : 0] = '\0';
+            handle_command(s_line);
+            s_line_len = 0;
+        } else if (byte == '\r') {
+            // ignored, like in G-code lines
+        } else if (s_line_len < LINK_LINE_MAX - 1) {
+            s_line[s_line_len++] = static_cast<char>(byte);
+        } else {
+            s_line_len = LINK_LINE_MAX;
+        }
+        return;
+    }
+    s_line_start = byte == '\n';
+    switch (gcode_parser_feed(s_gcode, static_cast<char>(byte))) {
+    case GCODE_LINE:
+        handle_gcode(s_gcode.line);
+        break;
+    case GCODE_ERROR:
+        reply(s_gcode.error);
+        break;
+    default:
+        break;
+    }
+}
+
+static void serial_link_task(void *arg) {
+    uint8_t chunk[LINK_READ_CHUNK];
+    while (true) {
+        const int len = uart_read_bytes(s_config.port, chunk, sizeof(chunk), pdMS_TO_TICKS(20));
+        poll_home();
+        for (int i = 0; i < len; i++) {
+            switch (link_parser_feed(s_parser, chunk[i])) {
+            case LINK_PARSE_FRAME:
+                if (s_parser.type == LINK_FRAME_MOVE) {
+                    handle_move(s_parser);
+                } else if (s_parser.type == LINK_FRAME_BLOCK) {
+                    handle_block(s_parser);
+                } else if (s_parser.type == LINK_FRAME_SPOOL) {
+                    handle_spool(s_parser);
+                } else if (s_parser.type == LINK_FRAME_PING) {
+                    send_ack(s_last_seq, LINK_ACK_OK);
+                }
+                break;
+            case LINK_PARSE_BAD_CRC:
+                if (!s_resend_pending) {
+                    s_resend_pending = true;
+                    send_ack(s_last_seq, LINK_ACK_RESEND);
+                }
+                break;
+            case LINK_PARSE_NOT_FRAME:
+                console_byte(chunk[i]);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+}
+
+esp_err_t serial_link_start(const serial_link_config_t *config) {
+    ESP_RETURN_ON_FALSE(config && config->moves && config->axes, ESP_ERR_INVALID_ARG, TAG, "invalid config");
+    s_config = *config;
+    link_parser_reset(s_parser);
+    gcode_parser_reset(s_gcode);
+    gcode_modal_init(s_modal);
+
+    uart_config_t uart_config = {};
+    uart_config.baud_rate = static_cast<int>(s_config.baud);
+    uart_config.data_bits = UART_DATA_8_BITS;
+    uart_config.parity = UART_PARITY_DISABLE;
+    uart_config.stop_bits = UART_STOP_BITS_1;
+    uart_config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+    uart_config.source_clk = UART_SCLK_DEFAULT;
+    ESP_RETURN_ON_ERROR(uart_driver_install(s_config.port, LINK_RX_BUFFER, LINK_TX_BUFFER, 0, NULL, 0), TAG, "uart driver");
+    ESP_RETURN_ON_ERROR(uart_param_config(s_config.port, &uart_config), TAG, "uart config");
+    // The console writes to the FIFO itself unless told otherwise, between the
+    // bytes the driver's interrupt moves there for the frames. Through the
+    // driver every write, a frame or a flushed line, is queued whole under its
+    // TX lock, whichever task it comes from.
+#if CONFIG_ESP_CONSOLE_UART
+    if (s_config.port == CONFIG_ESP_CONSOLE_UART_NUM) {
+        uart_vfs_dev_use_driver(s_config.port);
+    }
+#endif
+
+    ESP_RETURN_ON_FALSE(xTaskCreatePinnedToCore(serial_link_task, "serial_link", s_config.task_stack, NULL,
+                                                s_config.task_priority, NULL, s_config.task_core) == pdPASS,
+                        ESP_ERR_NO_MEM, TAG, "link task");
+    ESP_LOGI(TAG, "binary link on UART%d at %lu baud", static_cast<int>(s_config.port),
+             static_cast<unsigned long>(s_config.baud));
+    return ESP_OK;
+}
+
+gcode_error_t serial_link_gcode_move(gcode_modal_t &modal, const gcode_line_t &line, bool tool_space, float joints[AXIS_COUNT],
+                                     link_move_command_t &command, bool &moved) {
+    const gcode_modal_t previous = modal;
+    moved = false;
+    const gcode_error_t error = gcode_modal_apply(modal, line, moved);
+    if (error != GCODE_OK || !moved) {
+        return error;
+    }
+    command = {};
+    command.kind = tool_space ? LINK_COMMAND_TOOL_LINE : LINK_COMMAND_MOVE;
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        command.joints[i] = static_cast<float>(modal.position[i]) / GCODE_SCALE;
+    }
+    if (tool_space) {
+        memcpy(command.tool_pose, command.joints, sizeof(command.tool_pose));
+        if (!kinematics_inverse(ARM_GEOMETRY, command.tool_pose, joints, command.joints)) {
+            modal = previous;
+            moved = false;
+            return GCODE_ERROR_INVALID_TARGET;
+        }
+        memcpy(joints, command.joints, sizeof(command.joints));
+    }
+    axes_to_steps(command.joints, command.target);
+    command.feed = modal.rapid ? 0.0f : static_cast<float>(modal.feed) / GCODE_SCALE;
+    return GCODE_OK;
+}
+
+uint32_t serial_link_crc_errors(void) {
+    return s_parser.crc_errors;
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <stdint.h>
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <driver/uart.h>
+#include "gcode_parser.h"
+#include "motion/axis_config.h"
+
+// Host link over a UART. A receive task decodes protocol.h frames and hands
+// each accepted move to `moves` as a link_move_command_t; the planner side
+// consumes that queue. On the devkit the USB port is a USB-UART bridge on
+// UART0, so the same link serves both.
+//
+// Text between frames is console input: '?' reports the state, `$` lines are
+// commands and every other line is G-code (gcode_parser.h), answered with
+// "ok" or "error:<code>" once its move is queued, like Grbl. `$H` runs the
+// device's homing program (machine/homing.h) and is answered once it is
+// over, with "ok" or "ALARM:<code>". Meanwhile '?', realtime bytes and
+// frames are still served; motion lines, MOVE and BLOCK frames, `$H`,
+// `$JOB=` and `$JOB RUN` are refused with error:8 or a reject, and '!'
+// aborts the run with ALARM:6. `$X` clears an alarm. `$STATS` prints
+// the step path statistics, `$MEM` the memory regions (arena.h).
+// `$TEL=<hz>` streams telemetry frames at 100..1000 Hz, 0 stops them
+// (telemetry.h); `$TEL` reports the rate as [TEL:<hz>].
+//
+// Stored jobs (job_spool.h): `$JOB=<kind>,<bytes>,<crc32 hex>` makes room
+// for a job of `bytes` (kind 0 G-code, 1 a block stream), answered once the
+// flash is erased; SPOOL frames then carry its bytes, numbered like moves.
+// `$JOB` reports the stored job as [JOB:<kind>,<bytes>,<crc32>] with ",RUN"
+// while it runs, or [JOB:none]. `$JOB RUN` starts it from the current G-code
+// state and is answered right away. Once it has queued its last move the
+// job reports [JOB END:<how>|MPos:<x>,<y>,<z>,<a>], <how> being ok, stopped
+// or error:<code>,<line>, and the joint values where it leaves the axes; the
+// G-code position continues from there. `$JOB STOP` stops reading
+// it. While a job runs, motion lines, MOVE and BLOCK frames and `$H` are
+// refused with error:8 or a reject, realtime bytes and the other commands
+// still work.
+//
+// Realtime bytes act as soon as they arrive, also in the middle of a line,
+// with Grbl's values: '!' holds a running job (every axis decelerates to
+// rest, state Hold) and '~' resumes it; 0x90 sets the feed override back to
+// 100 %, 0x91/0x92 raise/lower it by 10 %, 0x93/0x94 by 1 %, within 10..100 %;
+// 0x95/0x96/0x97 set the rapid override to 100/50/25 %. The overrides scale
+// the moves already queued too (motion_engine_set_override). `$OV` reports
+// them as [OV:<feed>,<rapid>].
+//
+// `$KIN=1` switches G-code to tool space (motion/kinematics.h): X Y Z are the
+// tool tip in mm and A the tool pitch in degrees, and every line is planned
+// as a straight tool move. `$KIN=0` goes back to joint values, `$KIN` reports
+// the mode as [KIN:<n>].
+
+enum link_command_kind_t : uint8_t {
+    LINK_COMMAND_MOVE,          // plan a line to `target` at `feed`
+    LINK_COMMAND_BLOCK,         // run `block` as is
+    LINK_COMMAND_HOME,          // home, then notify `waiter` with the homing_alarm_t
+    LINK_COMMAND_TOOL_LINE,     // straight tool move to `tool_pose`, ending at `joints`
+};
+
+struct link_move_command_t {
+    link_command_kind_t kind;
+    int32_t target[AXIS_COUNT]; // absolute, steps
+    float feed;                 // mm/min, 0 for a rapid
+    motion_block_t block;
+    uint8_t home_axes;          // 0 runs HOMING_PROGRAM
+    TaskHandle_t waiter;
+    int32_t *home_position;     // AXIS_COUNT, set before `waiter` is notified
+    float tool_pose[AXIS_COUNT]; // x y z mm, pitch degrees
+    float joints[AXIS_COUNT];    // joint values at tool_pose; `target` is them in steps
+};
+
+struct serial_link_config_t {
+    uart_port_t port;
+    uint32_t baud;
+    QueueHandle_t moves;        // of link_move_command_t
+    const axis_config_t *axes;  // AXIS_COUNT entries, G-code mm to steps
+    uint32_t task_stack;
+    UBaseType_t task_priority;
+    BaseType_t task_core;
+};
+
+esp_err_t serial_link_start(const serial_link_config_t *config);
+
+// A G-code line applied to `modal` as the console does it: `moved` says
+// whether `command` now holds a move to queue. In tool space `joints` is
+// where the last line ended and follows the move. A tool target out of
+// reach leaves `modal` as it was.
+gcode_error_t serial_link_gcode_move(gcode_modal_t &modal, const gcode_line_t &line, bool tool_space, float joints[AXIS_COUNT],
+                                     link_move_command_t &command, bool &moved);
+
+// Frames dropped for a bad CRC since boot.
+uint32_t serial_link_crc_errors(void);
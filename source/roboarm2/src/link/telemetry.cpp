@@ -0,0 +1,88 @@
+#include "telemetry.h"
+#include <atomic>
+#include <esp_check.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/task.h>
+#include "protocol.h"
+#include "machine/machine_state.h"
+#include "motion/motion_engine.h"
+
+static const char *TAG = "telemetry";
+
+static telemetry_config_t s_config;
+static TaskHandle_t s_task;
+static esp_timer_handle_t s_timer;
+static std::atomic<uint32_t> s_rate;
+
+static uint8_t clamp_u8(size_t value) {
+    return value > UINT8_MAX ? UINT8_MAX : static_cast<uint8_t>(value);
+}
+
+// esp_timer task: only wakes the sender, so other timers are not held up by
+// the UART.
+static void on_sample(void *arg) {
+    xTaskNotifyGive(s_task);
+}
+
+static void telemetry_task(void *arg) {
+    uint16_t seq = 0;
+    while (true) {
+        // ticks missed while the UART was full collapse into one sample
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        link_telemetry_t sample = {};
+        sample.time_us = static_cast<uint32_t>(esp_timer_get_time());
+        motion_position_t position;
+        motion_engine_position(&position);
+        for (size_t i = 0; i < AXIS_COUNT; i++) {
+            sample.position[i] = position.steps[i];
+            sample.rate[i] = position.rate[i];
+        }
+        sample.motion_blocks = clamp_u8(motion_engine_queue_depth());
+        sample.planner_blocks = clamp_u8(s_config.planner_blocks());
+        sample.moves = clamp_u8(uxQueueMessagesWaiting(s_config.moves));
+        sample.state = machine_state_get();
+        const motion_override_t override = motion_engine_override();
+        sample.feed_percent = override.feed_percent;
+        sample.rapid_percent = override.rapid_percent;
+        sample.seq = seq++;
+        uint8_t frame[sizeof(sample) + LINK_FRAME_OVERHEAD];
+        const size_t len = link_encode_frame(LINK_FRAME_TELEMETRY, &sample, sizeof(sample), frame);
+        uart_write_bytes(s_config.port, frame, len);
+    }
+}
+
+esp_err_t telemetry_start(const telemetry_config_t *config) {
+    ESP_RETURN_ON_FALSE(config && config->moves && config->planner_blocks, ESP_ERR_INVALID_ARG, TAG, "invalid config");
+    s_config = *config;
+    ESP_RETURN_ON_FALSE(xTaskCreatePinnedToCore(telemetry_task, "telemetry", s_config.task_stack, NULL, s_config.task_priority,
+                                                &s_task, s_config.task_core) == pdPASS,
+                        ESP_ERR_NO_MEM, TAG, "telemetry task");
+    esp_timer_create_args_t timer_args = {};
+    timer_args.callback = on_sample;
+    timer_args.dispatch_method = ESP_TIMER_TASK;
+    timer_args.name = "telemetry";
+    timer_args.skip_unhandled_events = true;
+    ESP_RETURN_ON_ERROR(esp_timer_create(&timer_args, &s_timer), TAG, "timer");
+    return telemetry_set_rate(s_config.rate_hz);
+}
+
+esp_err_t telemetry_set_rate(uint32_t hz) {
+    ESP_RETURN_ON_FALSE(hz == 0 || (hz >= TELEMETRY_MIN_HZ && hz <= TELEMETRY_MAX_HZ), ESP_ERR_INVALID_ARG, TAG,
+                        "rate %lu Hz outside %lu..%lu", static_cast<unsigned long>(hz),
+                        static_cast<unsigned long>(TELEMETRY_MIN_HZ), static_cast<unsigned long>(TELEMETRY_MAX_HZ));
+    ESP_RETURN_ON_FALSE(s_timer, ESP_ERR_INVALID_STATE, TAG, "not started");
+    esp_err_t ret = ESP_OK;
+    if (s_rate.load() != 0) {
+        esp_timer_stop(s_timer);
+    }
+    if (hz) {
+        ret = esp_timer_start_periodic(s_timer, 1000000 / hz);
+    }
+    s_rate.store(ret == ESP_OK ? hz : 0);
+    return ret;
+}
+
+uint32_t telemetry_rate(void) {
+    return s_rate.load();
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <driver/uart.h>
+
+// Binary status channel on the link UART. At a fixed rate it sends one
+// LINK_FRAME_TELEMETRY frame (protocol.h): where every axis is at the pins
+// and how fast it moves (motion_engine_position), how full the motion ring,
+// the planner and the move queue are, the machine state and the overrides.
+// home.py --telemetry decodes them.
+//
+// An esp_timer paces the samples, so the rate is not bound to the FreeRTOS
+// tick, and a task on core 0 below the link sends them. Taking a sample holds
+// the stream lock about as long as one encoder refill step, so step timing
+// does not see it. 1000 Hz takes about half of the link at 921600 baud.
+// Frames and console text share the UART driver (serial_link_start), so a
+// frame goes out whole, never with text bytes cut into it.
+
+constexpr uint32_t TELEMETRY_MIN_HZ = 100;
+constexpr uint32_t TELEMETRY_MAX_HZ = 1000;
+
+struct telemetry_config_t {
+    uart_port_t port;                // installed by serial_link_start
+    QueueHandle_t moves;             // link -> planner
+    size_t (*planner_blocks)(void);  // blocks in the look-ahead
+    uint32_t rate_hz;                // 0 or TELEMETRY_MIN_HZ..TELEMETRY_MAX_HZ
+    uint32_t task_stack;
+    UBaseType_t task_priority;
+    BaseType_t task_core;
+};
+
+esp_err_t telemetry_start(const telemetry_config_t *config);
+
+// 0 stops the samples. From one task at a time, the link's `$TEL=<hz>`.
+esp_err_t telemetry_set_rate(uint32_t hz);
+uint32_t telemetry_rate(void);
@@ -0,0 +1,460 @@
+#include "homing.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <driver/gpio.h>
+#include <esp_attr.h>
+#include <esp_check.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "roboarm_config.h"
+#include "machine_state.h"
+#include "motion/motion_engine.h"
+
+static const char *TAG = "homing";
+
+// Homing blocks are this long, and this many are kept queued so the axes run
+// continuously between two passes of the scheduler.
+constexpr uint32_t CHUNK_MS = 10;
+constexpr size_t CHUNKS_AHEAD = 3;
+constexpr TickType_t RETRY_PAUSE = pdMS_TO_TICKS(500);
+
+enum phase_t : uint8_t {
+    PHASE_WAIT,     // for the axes in homing.after
+    PHASE_START,    // at rest, pressed or not
+    PHASE_CLEAR,    // off a switch that was pressed at the start
+    PHASE_APPROACH, // towards the switch until it trips
+    PHASE_PULLOFF,
+    PHASE_DONE,
+    PHASE_FAILED,
+};
+
+// One axis of a HOMING_HOME step.
+struct axis_run_t {
+    phase_t phase;
+    bool moving;          // the phase still queues steps, else it settles
+    bool negative;
+    uint32_t attempt;
+    uint32_t run;         // approaches finished in this attempt
+    uint32_t remaining;   // steps the phase may still take
+    float rate;           // steps/s
+    float accel;          // steps/s^2
+    float speed;          // at the end of the queued blocks
+    float frac;           // step carried to the next block
+    uint32_t sent;        // steps queued since the step began, minus those cut off
+    uint32_t last_chunk;  // chunk with the last step of the phase
+    bool settling;        // the phase's steps are out, waiting for `until`
+    TickType_t until;
+    homing_alarm_t alarm;
+};
+
+static const axis_config_t *s_axes;
+static homing_io_t s_io;
+static std::atomic<uint8_t> s_armed;        // axes approaching their switch
+static std::atomic<uint8_t> s_tripped;      // armed axes whose switch tripped
+static std::atomic<int32_t> s_latch[AXIS_COUNT]; // step count when it did
+static int32_t s_base[AXIS_COUNT];          // step count when the step began
+static std::atomic<TaskHandle_t> s_waiter;  // woken by the limit interrupts
+static std::atomic<bool> s_abort;           // homing_abort, cleared by homing_run
+static uint32_t s_chunks;                   // chunks handed over by this step
+static uint8_t s_dir_bits;                  // last direction sent for the axes in s_dir_known
+static uint8_t s_dir_known;
+
+// Stops the axis within microseconds of the edge and latches how far it got.
+// Once per approach.
+static bool IRAM_ATTR trip(size_t axis) {
+    const uint8_t bit = static_cast<uint8_t>(1u << axis);
+    if (!(s_armed.fetch_and(static_cast<uint8_t>(~bit)) & bit)) {
+        return false;
+    }
+    motion_engine_mask_axis_from_isr(axis);
+    s_latch[axis].store(motion_engine_step_count(axis));
+    s_tripped.fetch_or(bit);
+    return true;
+}
+
+static void IRAM_ATTR limit_isr(void *arg) {
+    TaskHandle_t waiter = s_waiter.load();
+    if (trip(reinterpret_cast<uintptr_t>(arg)) && waiter) {
+        BaseType_t woken = pdFALSE;
+        vTaskNotifyGiveFromISR(waiter, &woken);
+        portYIELD_FROM_ISR(woken);
+    }
+}
+
+static bool limit_active(size_t axis) {
+    const axis_homing_t &homing = s_axes[axis].homing;
+    return (gpio_get_level(homing.limit_pin) == 0) == homing.limit_active_low;
+}
+
+static uint32_t steps_of(size_t axis, float mm) {
+    return static_cast<uint32_t>(lroundf(fabsf(mm) * s_axes[axis].steps_per_mm));
+}
+
+static float rate_of(size_t axis, float mm_per_min) {
+    return std::min(mm_per_min / 60.0f * s_axes[axis].steps_per_mm, static_cast<float>(RAMP_MAX_RATE));
+}
+
+static void wait_idle(void) {
+    while (s_io.blocks_pending() || !s_io.idle()) {
+        vTaskDelay(1);
+    }
+}
+
+static void begin_phase(size_t axis, axis_run_t &run, phase_t phase) {
+    const axis_homing_t &homing = s_axes[axis].homing;
+    const bool towards = !homing.positive_direction; // negative steps reach the switch
+    run.phase = phase;
+    run.moving = true;
+    run.speed = 0.0f;
+    run.frac = 0.0f;
+    run.settling = false;
+    if (phase == PHASE_APPROACH) {
+        run.negative = towards;
+        run.rate = rate_of(axis, run.run == 0 ? homing.seek_mm_per_min : homing.feed_mm_per_min);
+        run.remaining = run.run == 0 ? steps_of(axis, homing.max_travel_mm * homing.seek_scaler)
+                                     : steps_of(axis, homing.pulloff_mm * homing.feed_scaler);
+        s_tripped.fetch_and(static_cast<uint8_t>(~(1u << axis)));
+        s_armed.fetch_or(static_cast<uint8_t>(1u << axis));
+    } else {
+        run.negative = !towards;
+        run.rate = rate_of(axis, homing.feed_mm_per_min);
+        run.remaining = steps_of(axis, homing.pulloff_mm);
+    }
+}
+
+static void fail(size_t axis, axis_run_t &run, homing_alarm_t alarm) {
+    // Both alarms a cycle can raise mean the switch was not where it was
+    // expected, so each is unlocked and the cycle run again, as the host did.
+    if (run.attempt < ROBOARM_HOMING_TRIES) {
+        run.attempt++;
+        printf("[MSG:Homing %c alarm %d, retry %lu/%d]\n", s_axes[axis].name, static_cast<int>(alarm),
+               static_cast<unsigned long>(run.attempt), ROBOARM_HOMING_TRIES);
+        fflush(stdout);
+        run.phase = PHASE_START;
+        run.run = 0;
+        run.settling = true;
+        run.until = xTaskGetTickCount() + RETRY_PAUSE;
+        return;
+    }
+    run.phase = PHASE_FAILED;
+    run.alarm = alarm;
+}
+
+// The steps queued after the trip were cut off; the axis stopped where the
+// latch says.
+static void apply_latch(size_t axis, axis_run_t &run, int32_t position[]) {
+    const uint32_t emitted = static_cast<uint32_t>(s_latch[axis].load() - s_base[axis]);
+    const int32_t dropped = static_cast<int32_t>(run.sent - emitted);
+    position[axis] -= run.negative ? -dropped : dropped;
+    run.sent = emitted;
+}
+
+// Phase changes once an axis is at rest and settled.
+static void step_phase(size_t axis, axis_run_t &run, int32_t position[]) {
+    switch (run.phase) {
+    case PHASE_START:
+        begin_phase(axis, run, limit_active(axis) ? PHASE_CLEAR : PHASE_APPROACH);
+        break;
+    case PHASE_CLEAR:
+        if (limit_active(axis)) {
+            fail(axis, run, HOMING_ALARM_PULLOFF);
+        } else {
+            begin_phase(axis, run, PHASE_APPROACH);
+        }
+        break;
+    case PHASE_APPROACH:
+        if (!(s_tripped.load() & (1u << axis))) {
+            s_armed.fetch_and(static_cast<uint8_t>(~(1u << axis)));
+            fail(axis, run, HOMING_ALARM_NOT_FOUND);
+        } else {
+            apply_latch(axis, run, position);
+            begin_phase(axis, run, PHASE_PULLOFF);
+        }
+        break;
+    case PHASE_PULLOFF:
+        if (limit_active(axis)) {
+            fail(axis, run, HOMING_ALARM_PULLOFF);
+        } else if (++run.run < HOMING_RUNS) {
+            begin_phase(axis, run, PHASE_APPROACH);
+        } else {
+            run.phase = PHASE_DONE;
+            position[axis] = lroundf(s_axes[axis].homing.mpos_mm * s_axes[axis].steps_per_mm);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// Advances every axis that is not moving: dependencies, the wait for its
+// last steps, the settle and the checks at its end.
+static void advance(axis_run_t runs[], uint8_t axes, int32_t position[]) {
+    const uint32_t completed = s_chunks - static_cast<uint32_t>(s_io.blocks_pending());
+    const TickType_t now = xTaskGetTickCount();
+    uint8_t done = 0;
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        done |= runs[i].phase == PHASE_DONE ? 1u << i : 0;
+    }
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        axis_run_t &run = runs[i];
+        if (!(axes & (1u << i)) || run.moving || run.phase == PHASE_DONE || run.phase == PHASE_FAILED) {
+            continue;
+        }
+        if (run.phase == PHASE_WAIT) {
+            const uint8_t after = s_axes[i].homing.after & axes;
+            if ((after & done) == after) {
+                run.phase = PHASE_START;
+                run.settling = true;
+                run.until = now;
+            }
+            continue;
+        }
+        if (!run.settling) {
+            // a latched trip is final at once; anything else waits until its
+            // steps are out and the switch has settled
+            const bool latched = run.phase == PHASE_APPROACH && (s_tripped.load() & (1u << i));
+            if (!latched && completed < run.last_chunk) {
+                continue;
+            }
+            run.settling = true;
+            run.until = now + (latched ? 0 : pdMS_TO_TICKS(s_axes[i].homing.settle_ms));
+        }
+        if (static_cast<int32_t>(now - run.until) >= 0) {
+            step_phase(i, run, position);
+        }
+    }
+}
+
+// Queues the next block with the steps of every moving axis. Returns false if
+// no axis is moving.
+static bool queue_chunk(axis_run_t runs[], int32_t position[]) {
+    constexpr float DT = CHUNK_MS / 1000.0f;
+    uint8_t moving = 0;
+    uint8_t dir_bits = s_dir_bits;
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        axis_run_t &run = runs[i];
+        if (!run.moving) {
+            continue;
+        }
+        if (run.phase == PHASE_APPROACH && limit_active(i)) {
+            trip(i); // in case the edge was missed
+        }
+        if (run.remaining == 0 || (run.phase == PHASE_APPROACH && (s_tripped.load() & (1u << i)))) {
+            run.moving = false;
+            continue;
+        }
+        moving |= 1u << i;
+        dir_bits = run.negative ? dir_bits | (1u << i) : dir_bits & ~(1u << i);
+    }
+    if (!moving) {
+        return false;
+    }
+    // A reversal on GPIO direction pins or a pin to reconnect makes the engine
+    // drain the stream, which would stop the other axes dead. Those brake to
+    // rest over chunks of their own first, then everything starts from rest.
+    const uint8_t reversed = motion_engine_dir_in_stream() ? 0 : (dir_bits ^ s_dir_bits) | ~s_dir_known;
+    const uint8_t drain = (reversed | motion_engine_masked_axes()) & moving;
+    uint8_t braking = 0;
+    for (size_t i = 0; drain && i < AXIS_COUNT; i++) {
+        braking |= (moving & ~drain & (1u << i)) && runs[i].speed > 0.0f ? 1u << i : 0;
+    }
+    if (braking) {
+        moving = braking;
+    }
+
+    motion_block_t block = {};
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        axis_run_t &run = runs[i];
+        if (!(moving & (1u << i))) {
+            continue;
+        }
+        const float speed = braking ? std::max(run.speed - run.accel * DT, 0.0f)
+                                    : std::min(run.speed + run.accel * DT, run.rate);
+        const float exact = (run.speed + speed) * 0.5f * DT + run.frac;
+        const uint32_t least = braking ? 0 : 1;
+        const uint32_t steps = std::min(std::max(static_cast<uint32_t>(exact), least), run.remaining);
+        run.frac = std::max(exact - static_cast<float>(steps), 0.0f);
+        run.speed = speed;
+        if (steps == 0) {
+            continue;
+        }
+        run.remaining -= steps;
+        run.sent += steps;
+        block.steps[i] = steps;
+        block.lead_steps = std::max(block.lead_steps, steps);
+        position[i] += run.negative ? -static_cast<int32_t>(steps) : static_cast<int32_t>(steps);
+        run.last_chunk = s_chunks + 1;
+    }
+    if (block.lead_steps == 0) {
+        return true; // braked to rest within the last chunk, the drain is next
+    }
+    // constant rate over the chunk, the speed changes between chunks; exit 0
+    // without decel steps lets a trip or the last chunk end the stream
+    // without that counting as an underrun
+    block.dir_bits = dir_bits & moving;
+    block.cruise_rate = std::max(block.lead_steps * 1000 / CHUNK_MS, 1u);
+    block.entry_rate = block.cruise_rate;
+    block.profile = RAMP_TRAPEZOID;
+    block.override = SPEED_OVERRIDE_OFF;
+    s_io.queue_block(block);
+    s_chunks++;
+    s_dir_bits = (dir_bits & moving) | (s_dir_bits & ~moving);
+    s_dir_known |= moving;
+    return true;
+}
+
+// Runs the cycles of `axes` side by side.
+static homing_alarm_t home_axes(uint8_t axes, int32_t position[]) {
+    axis_run_t runs[AXIS_COUNT] = {};
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        runs[i].phase = axes & (1u << i) ? PHASE_WAIT : PHASE_DONE;
+        runs[i].attempt = 1;
+        runs[i].accel = s_axes[i].accel_mm_per_s2 * s_axes[i].steps_per_mm;
+        s_base[i] = motion_engine_step_count(i);
+    }
+    s_chunks = 0;
+    s_dir_known = 0;
+    s_waiter.store(xTaskGetCurrentTaskHandle());
+    homing_alarm_t alarm = HOMING_OK;
+    while (true) {
+        advance(runs, axes, position);
+        bool finished = true;
+        for (size_t i = 0; i < AXIS_COUNT; i++) {
+            finished &= runs[i].phase == PHASE_DONE;
+            if (runs[i].phase == PHASE_FAILED) {
+                alarm = runs[i].alarm;
+            }
+        }
+        if (!finished && alarm == HOMING_OK && s_abort.load()) {
+            alarm = HOMING_ALARM_ABORTED;
+        }
+        if (finished || alarm != HOMING_OK) {
+            break;
+        }
+        while (s_io.blocks_pending() < CHUNKS_AHEAD && queue_chunk(runs, position)) {
+        }
+        ulTaskNotifyTake(pdTRUE, 1);
+    }
+    s_armed.store(0);
+    s_waiter.store(nullptr);
+    wait_idle();
+    return alarm;
+}
+
+// Rest-to-rest rapid, every axis within its own rate and acceleration.
+static void move_to(const homing_step_t &step, int32_t position[]) {
+    motion_block_t block = {};
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        if (!(step.axes & (1u << i))) {
+            continue;
+        }
+        const int32_t target = lroundf(step.target_mm[i] * s_axes[i].steps_per_mm);
+        block.steps[i] = static_cast<uint32_t>(abs(target - position[i]));
+        block.dir_bits |= target < position[i] ? 1u << i : 0;
+        block.lead_steps = std::max(block.lead_steps, block.steps[i]);
+        position[i] = target;
+    }
+    if (block.lead_steps == 0) {
+        return;
+    }
+    float rate = RAMP_MAX_RATE;
+    float accel = INFINITY;
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        if (block.steps[i]) {
+            const float scale = static_cast<float>(block.lead_steps) / static_cast<float>(block.steps[i]);
+            rate = std::min(rate, s_axes[i].max_rate_mm_per_min / 60.0f * s_axes[i].steps_per_mm * scale);
+            accel = std::min(accel, s_axes[i].accel_mm_per_s2 * s_axes[i].steps_per_mm * scale);
+        }
+    }
+    uint32_t accel_steps = static_cast<uint32_t>(rate * rate / (2.0f * accel));
+    if (2 * accel_steps > block.lead_steps) {
+        accel_steps = block.lead_steps / 2;
+        rate = sqrtf(accel * static_cast<float>(block.lead_steps));
+    }
+    block.cruise_rate = std::max(static_cast<uint32_t>(lroundf(rate)), 1u);
+    block.accel = std::max(static_cast<uint32_t>(lroundf(accel)), 1u);
+    block.decel_steps = accel_steps;
+    block.profile = RAMP_TRAPEZOID;
+    block.override = SPEED_OVERRIDE_OFF;
+    s_io.queue_block(block);
+    wait_idle();
+}
+
+esp_err_t homing_init(const axis_config_t *axes, const homing_io_t *io) {
+    ESP_RETURN_ON_FALSE(axes && io && io->queue_block && io->blocks_pending && io->idle, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid config");
+    uint8_t ordered = 0;
+    for (size_t pass = 0; pass < AXIS_COUNT; pass++) {
+        for (size_t i = 0; i < AXIS_COUNT; i++) {
+            ordered |= (axes[i].homing.after & ~ordered) == 0 ? 1u << i : 0;
+        }
+    }
+    ESP_RETURN_ON_FALSE(ordered == (1u << AXIS_COUNT) - 1, ESP_ERR_INVALID_ARG, TAG, "homing.after loops");
+    s_axes = axes;
+    s_io = *io;
+
+    // The limit interrupt can run with the cache off once the PCNT read that
+    // latches the step count is in IRAM.
+#if CONFIG_PCNT_CTRL_FUNC_IN_IRAM
+    const esp_err_t ret = gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
+#else
+    const esp_err_t ret = gpio_install_isr_service(0);
+#endif
+    ESP_RETURN_ON_FALSE(ret == ESP_OK || ret == ESP_ERR_INVALID_STATE, ret, TAG, "gpio isr service");
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        const axis_homing_t &homing = axes[i].homing;
+        if (homing.limit_pin == GPIO_NUM_NC) {
+            continue;
+        }
+        gpio_config_t limit_conf = {};
+        limit_conf.pin_bit_mask = 1ull << homing.limit_pin;
+        limit_conf.mode = GPIO_MODE_INPUT;
+        limit_conf.intr_type = homing.limit_active_low ? GPIO_INTR_NEGEDGE : GPIO_INTR_POSEDGE;
+        ESP_RETURN_ON_ERROR(gpio_config(&limit_conf), TAG, "limit pin %c", axes[i].name);
+        ESP_RETURN_ON_ERROR(gpio_isr_handler_add(homing.limit_pin, limit_isr, reinterpret_cast<void *>(i)), TAG,
+                            "limit isr %c", axes[i].name);
+    }
+    return ESP_OK;
+}
+
+uint8_t homing_unsupported(uint8_t axes) {
+    uint8_t unsupported = 0;
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        if ((axes & (1u << i)) && s_axes[i].homing.limit_pin == GPIO_NUM_NC) {
+            unsupported |= 1u << i;
+        }
+    }
+    return unsupported;
+}
+
+homing_alarm_t homing_run(const homing_step_t *program, size_t count, int32_t position[AXIS_COUNT]) {
+    s_abort.store(false);
+    machine_state_set(MACHINE_HOME);
+    for (size_t s = 0; s < count; s++) {
+        const homing_step_t &step = program[s];
+        homing_alarm_t alarm = HOMING_OK;
+        if (s_abort.load()) {
+            alarm = HOMING_ALARM_ABORTED;
+        } else if (step.op == HOMING_MOVE) {
+            move_to(step, position);
+        } else {
+            alarm = home_axes(step.axes, position);
+        }
+        if (alarm != HOMING_OK) {
+            machine_state_set(MACHINE_ALARM);
+            return alarm;
+        }
+    }
+    machine_state_set(MACHINE_IDLE);
+    return HOMING_OK;
+}
+
+void homing_abort(void) {
+    s_abort.store(true);
+    if (TaskHandle_t waiter = s_waiter.load()) {
+        xTaskNotifyGive(waiter);
+    }
+}
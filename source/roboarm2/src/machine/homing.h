@@ -0,0 +1,90 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <esp_err.h>
+#include "motion/axis_config.h"
+
+// Homing on the device. `$H` runs HOMING_PROGRAM, `$HX`..`$HA` one axis; the
+// host gets a single "ok" or "ALARM:<code>" once it is over, instead of
+// driving every cycle, move and Idle wait itself.
+//
+// A cycle approaches the switch HOMING_RUNS times (seek rate first, feed
+// rate after), pulling off in between, then sets the axis to its mpos_mm.
+// The axes of one HOMING_HOME step run their cycles at the same time, each
+// with its own phase, speed ramp and limit interrupt; an axis only starts
+// once the axes in its homing.after have finished. Motion is a stream of
+// short constant-rate blocks handed to the feeder like any other, carrying
+// the steps of every active axis. The limit interrupt cuts the tripped
+// axis' step pin off its RMT channel and latches its PCNT step count, so it
+// stops within microseconds of the edge, exactly where the latch says, and
+// needs no settle before pulling off. Reconnecting its pin for the pull-off
+// drains the stream (so does a direction change without direction channels),
+// so the other axes stop with it and ramp up again. Alarms 8 and 9 are retried
+// per axis, up to ROBOARM_HOMING_TRIES times, before the machine stays in Alarm.
+
+// Grbl alarm codes.
+enum homing_alarm_t : uint8_t {
+    HOMING_OK = 0,
+    HOMING_ALARM_ABORTED = 6,  // homing_abort during the run
+    HOMING_ALARM_PULLOFF = 8,  // pull-off did not clear the switch
+    HOMING_ALARM_NOT_FOUND = 9, // no switch within the search distance
+};
+
+enum homing_op_t : uint8_t {
+    HOMING_HOME, // home every axis of `axes`, in parallel as homing.after allows
+    HOMING_MOVE, // rapid the axes of `axes` to target_mm, back at rest after
+};
+
+struct homing_step_t {
+    homing_op_t op;
+    uint8_t axes;                // bit i is AXES[i]
+    float target_mm[AXIS_COUNT]; // HOMING_MOVE, absolute
+};
+
+constexpr uint8_t HOMING_X = 1u << 0;
+constexpr uint8_t HOMING_Y = 1u << 1;
+constexpr uint8_t HOMING_Z = 1u << 2;
+constexpr uint8_t HOMING_A = 1u << 3;
+
+// The arm's start-up sequence: the joints have to clear each other in this
+// order. A and Y do not interfere; X still waits for Z (AXES[0].homing.after).
+inline constexpr homing_step_t HOMING_PROGRAM[] = {
+    {HOMING_HOME, HOMING_Z, {}},
+    {HOMING_MOVE, HOMING_Z, {0.0f, 0.0f, 0.0f, 0.0f}},
+    {HOMING_HOME, HOMING_A | HOMING_Y, {}},
+    {HOMING_MOVE, HOMING_Y, {0.0f, 45.0f, 0.0f, 0.0f}},
+    {HOMING_HOME, HOMING_Z | HOMING_X, {}},
+    {HOMING_MOVE, HOMING_X | HOMING_Y | HOMING_Z | HOMING_A, {45.0f, 45.0f, -45.0f, 45.0f}},
+};
+
+// Axes `program` homes.
+constexpr uint8_t homing_axes_of(const homing_step_t *program, size_t count) {
+    uint8_t axes = 0;
+    for (size_t i = 0; i < count; i++) {
+        axes |= program[i].op == HOMING_HOME ? program[i].axes : 0;
+    }
+    return axes;
+}
+
+// How homing reaches the step engine; provided by the task that runs it.
+struct homing_io_t {
+    void (*queue_block)(const motion_block_t &block); // in order with all other motion
+    size_t (*blocks_pending)(void);                   // handed over, not fully encoded
+    bool (*idle)(void);                               // every step has gone out
+};
+
+// Configures the limit inputs and their interrupts.
+esp_err_t homing_init(const axis_config_t *axes, const homing_io_t *io);
+
+// Axes of `axes` that have no limit switch.
+uint8_t homing_unsupported(uint8_t axes);
+
+// Run `count` steps from `position` (steps, updated as the axes move and
+// home). Call with the machine at rest. Sets MACHINE_HOME while running and
+// MACHINE_IDLE or MACHINE_ALARM at the end.
+homing_alarm_t homing_run(const homing_step_t *program, size_t count, int32_t position[AXIS_COUNT]);
+
+// Any task, while homing_run is running: stop queueing homing motion. The
+// axes stop once the chunks already handed over have gone out (a rapid of
+// HOMING_MOVE runs to its end) and the run ends with HOMING_ALARM_ABORTED.
+void homing_abort(void);
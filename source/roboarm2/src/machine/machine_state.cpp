@@ -0,0 +1,97 @@
+#include "machine_state.h"
+#include <stdio.h>
+#include <atomic>
+
+// The state in the low byte, motion commands queued but not done above it:
+// one word, so Run -> Idle only succeeds while none are.
+static std::atomic<uint32_t> s_word{MACHINE_IDLE};
+constexpr uint32_t STATE_MASK = 0xff;
+constexpr uint32_t QUEUED_ONE = 0x100;
+
+static machine_state_t state_of(uint32_t word) {
+    return static_cast<machine_state_t>(word & STATE_MASK);
+}
+
+// Move from `from` to `to`; false if the state is not `from` (or Run -> Idle
+// with commands still queued).
+static bool transition(machine_state_t from, machine_state_t to) {
+    uint32_t word = s_word.load();
+    do {
+        if (state_of(word) != from || (to == MACHINE_IDLE && from == MACHINE_RUN && word >= QUEUED_ONE)) {
+            return false;
+        }
+    } while (!s_word.compare_exchange_weak(word, (word & ~STATE_MASK) | to));
+    return true;
+}
+
+const char *machine_state_name(machine_state_t state) {
+    switch (state) {
+    case MACHINE_IDLE:
+        return "Idle";
+    case MACHINE_RUN:
+        return "Run";
+    case MACHINE_HOME:
+        return "Home";
+    case MACHINE_HOLD:
+        return "Hold";
+    case MACHINE_ALARM:
+        return "Alarm";
+    }
+    return "Unknown";
+}
+
+static void report(machine_state_t state) {
+    printf("<%s>\n", machine_state_name(state));
+    fflush(stdout);
+}
+
+machine_state_t machine_state_get(void) {
+    return state_of(s_word.load(std::memory_order_relaxed));
+}
+
+void machine_state_set(machine_state_t state) {
+    uint32_t word = s_word.load();
+    while (!s_word.compare_exchange_weak(word, (word & ~STATE_MASK) | state)) {
+    }
+    if (state_of(word) != state) {
+        report(state);
+    }
+}
+
+void machine_state_motion(bool moving) {
+    if (transition(moving ? MACHINE_IDLE : MACHINE_RUN, moving ? MACHINE_RUN : MACHINE_IDLE)) {
+        report(moving ? MACHINE_RUN : MACHINE_IDLE);
+    }
+}
+
+void machine_state_motion_stopped(bool (*stopped)(void)) {
+    uint32_t word = s_word.load();
+    if (word != MACHINE_RUN || !stopped()) {
+        return;
+    }
+    if (s_word.compare_exchange_strong(word, MACHINE_IDLE)) {
+        report(MACHINE_IDLE);
+    }
+}
+
+void machine_state_motion_queued(void) {
+    uint32_t word = s_word.load();
+    uint32_t next;
+    do {
+        next = word + QUEUED_ONE;
+        if (state_of(word) == MACHINE_IDLE) {
+            next = (next & ~STATE_MASK) | MACHINE_RUN;
+        }
+    } while (!s_word.compare_exchange_weak(word, next));
+    if (state_of(word) == MACHINE_IDLE) {
+        report(MACHINE_RUN);
+    }
+}
+
+void machine_state_motion_done(void) {
+    s_word.fetch_sub(QUEUED_ONE);
+}
+
+void machine_state_report(void) {
+    report(machine_state_get());
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <stdint.h>
+
+// Machine state as reported to the host. Every change is pushed right away
+// as a GRBL-style "<State>" line on the console, so the host never has to
+// poll; '?' on the link still answers with the current state.
+
+enum machine_state_t : uint8_t {
+    MACHINE_IDLE,
+    MACHINE_RUN,
+    MACHINE_HOME,
+    MACHINE_HOLD,
+    MACHINE_ALARM,
+};
+
+const char *machine_state_name(machine_state_t state);
+
+machine_state_t machine_state_get(void);
+// Any task. Reports the new state if it changed.
+void machine_state_set(machine_state_t state);
+// Motion feedback: Idle <-> Run, ignored while homing, holding or alarmed.
+void machine_state_motion(bool moving);
+// A motion command on its way to the planner: Run from Idle right away, so a
+// '?' after its "ok" never answers Idle. The planner calls
+// machine_state_motion_done once the command is in its look-ahead.
+void machine_state_motion_queued(void);
+void machine_state_motion_done(void);
+// Run -> Idle if `stopped` finds nothing left downstream of the planner's
+// input, asked with no motion command queued; a command queued or done while
+// it looks keeps Run.
+void machine_state_motion_stopped(bool (*stopped)(void));
+// Report the current state again (answer to '?').
+void machine_state_report(void);
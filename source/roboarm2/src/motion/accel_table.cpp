@@ -0,0 +1,51 @@
+#include "accel_table.h"
+#include "motion_iram.h"
+#include "step_timing.h"
+
+// Below this many strides sqrt bends too much for linear interpolation.
+constexpr uint32_t MIN_INTERPOLATED_ENTRY = 4;
+
+void accel_table_build(accel_table_t &table, uint32_t *storage, uint32_t entries, uint32_t accel, uint32_t max_rate) {
+    table = {};
+    if (!storage || entries < MIN_INTERPOLATED_ENTRY + 2 || accel == 0) {
+        return;
+    }
+    // steps from rest to max_rate
+    const uint64_t range = (static_cast<uint64_t>(max_rate) * max_rate + 2ull * accel - 1) / (2ull * accel);
+    uint8_t shift = 0;
+    while ((static_cast<uint64_t>(entries - 1) << shift) < range) {
+        shift++;
+    }
+    for (uint32_t i = 0; i < entries; i++) {
+        uint64_t rate_sq = 2ull * accel * (static_cast<uint64_t>(i) << shift);
+        if (rate_sq > UINT32_MAX) {
+            rate_sq = UINT32_MAX; // the last stride may overshoot the Q16.16 range
+        }
+        storage[i] = isqrt64(rate_sq << 32);
+    }
+    table.speeds = storage;
+    table.entries = entries;
+    table.shift = shift;
+    table.accel = accel;
+}
+
+uint64_t MOTION_IRAM accel_table_index(const accel_table_t &table, uint64_t rate_sq) {
+    return (rate_sq << 16) / (2ull * table.accel);
+}
+
+uint32_t MOTION_IRAM accel_table_step(const accel_table_t &table, uint32_t accel) {
+    return static_cast<uint32_t>((static_cast<uint64_t>(accel) << 16) / table.accel);
+}
+
+bool MOTION_IRAM accel_table_speed(const accel_table_t &table, uint64_t m_q16, uint32_t &speed) {
+    const uint64_t index = m_q16 >> table.shift;
+    const uint64_t i = index >> 16;
+    if (i < MIN_INTERPOLATED_ENTRY || i + 1 >= table.entries) {
+        return false;
+    }
+    const uint32_t frac = static_cast<uint32_t>(index & 0xffff);
+    const uint32_t a = table.speeds[i];
+    const uint32_t b = table.speeds[i + 1];
+    speed = a + static_cast<uint32_t>(static_cast<uint64_t>(b - a) * frac >> 16);
+    return true;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Square-root table for the trapezoid ramp of one axis. Entry i holds the
+// Q16.16 speed reached after m = i << shift steps from rest at the axis'
+// table acceleration A0. A ramp at any other accel a walks the same curve at
+// m = v0^2 / (2 A0) + k a / A0, so the ISR interpolates instead of taking a
+// 64-bit square root per step. Pure C++, no ESP-IDF.
+
+struct accel_table_t {
+    const uint32_t *speeds; // Q16.16 steps/s
+    uint32_t entries;
+    uint8_t shift;          // table stride is 1 << shift steps
+    uint32_t accel;         // A0, steps/s^2
+};
+
+// Fill `storage` (entries words) so the table reaches `max_rate` at `accel`.
+// The stride grows in powers of two until the range fits.
+void accel_table_build(accel_table_t &table, uint32_t *storage, uint32_t entries, uint32_t accel, uint32_t max_rate);
+
+// Q16.16 index for a ramp that starts at `rate_sq` (steps/s)^2, and the
+// per-step increment for `accel`.
+uint64_t accel_table_index(const accel_table_t &table, uint64_t rate_sq);
+uint32_t accel_table_step(const accel_table_t &table, uint32_t accel);
+
+// Speed at Q16.16 index m. Returns false near standstill (where the curve is
+// too steep to interpolate) and past the end of the table.
+bool accel_table_speed(const accel_table_t &table, uint64_t m_q16, uint32_t &speed);
+
+static inline size_t accel_table_bytes(const accel_table_t &table) { return table.entries * sizeof(uint32_t); }
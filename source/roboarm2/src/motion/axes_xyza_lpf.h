@@ -0,0 +1,18 @@
+// Generated by source/py/gen_axis_config.py from config_xyza_lpf.yaml, do not edit.
+// Included by axis_config.h.
+#pragma once
+
+inline constexpr axis_config_t AXES[AXIS_COUNT] = {
+    {'X', GPIO_NUM_13, GPIO_NUM_27, true, 20.445999f, 5400.0f, 10.0f,
+     {GPIO_NUM_18, true, false, -23.0f, 1350.0f, 300.0f, 7.0f, 1000.0f, 1.1f, 1.1f, 250, 1u << 2}},
+    {'Y', GPIO_NUM_2, GPIO_NUM_19, false, 133.600006f, 5400.0f, 60.0f,
+     {GPIO_NUM_5, false, false, -13.622f, 1350.0f, 270.0f, 6.0f, 1000.0f, 1.1f, 1.1f, 250, 0}},
+    {'Z', GPIO_NUM_26, GPIO_NUM_25, false, 133.699997f, 5400.0f, 60.0f,
+     {GPIO_NUM_16, false, false, -90.5f, 1350.0f, 270.0f, 9.0f, 1000.0f, 1.1f, 1.1f, 250, 0}},
+    {'A', GPIO_NUM_33, GPIO_NUM_32, true, 14.814815f, 21600.0f, 90.0f,
+     {GPIO_NUM_17, true, false, -166.5f, 5400.0f, 1080.0f, 6.0f, 1000.0f, 1.1f, 1.1f, 250, 0}},
+};
+
+inline constexpr uint32_t HOMING_RUNS = 2;
+inline constexpr float JUNCTION_DEVIATION_MM = 0.01f;
+inline constexpr float ARC_TOLERANCE_MM = 0.002f;
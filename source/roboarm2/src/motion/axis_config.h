@@ -0,0 +1,90 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <soc/gpio_num.h>
+#include "roboarm_config.h"
+#include "motion_block.h"
+#include "step_ramp.h"
+
+// Axis wiring and limits from source/py/config_xyza*.yaml, compiled in by
+// gen_axis_config.py. Units follow the YAML: "mm" are joint degrees on this
+// arm.
+
+// Limit switch and homing cycle of one axis (the YAML's homing: block and
+// motor0 limit pin). `after` replaces the YAML's homing cycle numbers, which
+// are 0 on every axis.
+struct axis_homing_t {
+    gpio_num_t limit_pin;     // GPIO_NUM_NC: the axis cannot home
+    bool limit_active_low;    // 'gpio.N:low'
+    bool positive_direction;  // the switch is at the positive end
+    float mpos_mm;            // machine position once pulled off the switch
+    float seek_mm_per_min;    // first approach
+    float feed_mm_per_min;    // later approaches and pull-offs
+    float pulloff_mm;
+    float max_travel_mm;
+    float seek_scaler;        // seek search distance, times max_travel_mm
+    float feed_scaler;        // locate search distance, times pulloff_mm
+    uint32_t settle_ms;       // pause after every stop at the switch
+    uint8_t after;            // bit i: AXES[i] homes first when in the same step
+};
+
+struct axis_config_t {
+    char name;
+    gpio_num_t step_pin;
+    gpio_num_t dir_pin;
+    bool dir_invert;     // 'gpio.N:low' in the YAML
+    float steps_per_mm;
+    float max_rate_mm_per_min;
+    float accel_mm_per_s2;
+    axis_homing_t homing;
+};
+
+// The axis table, HOMING_RUNS (approaches to the switch per cycle, the
+// first at the seek rate), JUNCTION_DEVIATION_MM and ARC_TOLERANCE_MM (how
+// far tool-space lines may stray once split into joint moves), generated
+// from the YAML of the build variant.
+#if ROBOARM_AXES_VARIANT == 0
+#include "axes_xyza.h"
+#elif ROBOARM_AXES_VARIANT == 1
+#include "axes_xyza_lpf.h"
+#else
+#error "unknown ROBOARM_AXES_VARIANT"
+#endif
+
+// Per-axis constants folded at compile time: conversions multiply by a
+// constant instead of looking the config up and dividing.
+template<size_t AXIS>
+struct axis_traits {
+    static_assert(AXIS < AXIS_COUNT, "no such axis");
+    static constexpr float STEPS_PER_MM = AXES[AXIS].steps_per_mm;
+    static constexpr float MM_PER_STEP = 1.0f / STEPS_PER_MM;
+    static constexpr float MAX_RATE_STEPS_PER_S = AXES[AXIS].max_rate_mm_per_min / 60.0f * STEPS_PER_MM;
+    static constexpr float ACCEL_STEPS_PER_S2 = AXES[AXIS].accel_mm_per_s2 * STEPS_PER_MM;
+
+    static_assert(STEPS_PER_MM > 0.0f, "steps_per_mm must be positive");
+    static_assert(MAX_RATE_STEPS_PER_S >= 1.0f && MAX_RATE_STEPS_PER_S <= RAMP_MAX_RATE,
+                  "max_rate_mm_per_min out of the step engine's range");
+    static_assert(ACCEL_STEPS_PER_S2 >= 1.0f, "acceleration_mm_per_sec2 below one step/s^2");
+
+    // Nearest step, halves away from zero like lroundf.
+    static constexpr int32_t steps(float mm) {
+        const float s = mm * STEPS_PER_MM;
+        return static_cast<int32_t>(s < 0.0f ? s - 0.5f : s + 0.5f);
+    }
+    static constexpr float mm(int32_t steps) { return static_cast<float>(steps) * MM_PER_STEP; }
+};
+
+// Calls f(axis_traits<i>{}, i) for every axis, unrolled.
+template<typename F>
+constexpr void for_each_axis(F &&f) {
+    [&]<size_t... I>(std::index_sequence<I...>) { (f(axis_traits<I>{}, I), ...); }(std::make_index_sequence<AXIS_COUNT>{});
+}
+
+inline void axes_to_steps(const float mm[AXIS_COUNT], int32_t steps[AXIS_COUNT]) {
+    for_each_axis([&](auto axis, size_t i) { steps[i] = axis.steps(mm[i]); });
+}
+
+inline void axes_to_mm(const int32_t steps[AXIS_COUNT], float mm[AXIS_COUNT]) {
+    for_each_axis([&](auto axis, size_t i) { mm[i] = axis.mm(steps[i]); });
+}
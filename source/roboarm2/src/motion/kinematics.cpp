@@ -0,0 +1,265 @@
+#include "kinematics.h"
+#include <math.h>
+#include <string.h>
+
+constexpr float DEG = 0.017453292f;
+constexpr float TWO_PI = 6.2831853f;
+// Pivots below this fraction of the largest Jacobian entry count as singular.
+constexpr float SINGULAR = 1e-4f;
+// Shortest segment tried, as a fraction of the longest one.
+constexpr float MIN_STEP_RATIO = 1.0f / 1024.0f;
+
+static float to_model(const arm_geometry_t &arm, size_t i, float joint) {
+    return (joint - arm.joint_zero_deg[i]) / arm.joint_sign[i] * DEG;
+}
+
+static float to_joint(const arm_geometry_t &arm, size_t i, float model) {
+    return model / DEG * arm.joint_sign[i] + arm.joint_zero_deg[i];
+}
+
+// Pose vector (pitch in radians) of model angles, and d pose / d angle.
+static void forward_model(const arm_geometry_t &arm, const float q[AXIS_COUNT], float p[AXIS_COUNT],
+                          float jacobian[AXIS_COUNT][AXIS_COUNT]) {
+    const float b = q[1] + q[2];
+    const float c = b + q[3];
+    const float s1 = sinf(q[0]), c1 = cosf(q[0]);
+    const float sa = sinf(q[1]), ca = cosf(q[1]);
+    const float sb = sinf(b), cb = cosf(b);
+    const float sc = sinf(c), cc = cosf(c);
+    const float r = arm.upper_arm_mm * ca + arm.forearm_mm * cb + arm.tool_mm * cc;
+    p[KIN_POSE_X] = r * c1;
+    p[KIN_POSE_Y] = r * s1;
+    p[KIN_POSE_Z] = arm.base_height_mm + arm.upper_arm_mm * sa + arm.forearm_mm * sb + arm.tool_mm * sc;
+    p[KIN_POSE_PITCH] = c;
+    if (!jacobian) {
+        return;
+    }
+    const float dr[AXIS_COUNT] = {0.0f, -(arm.upper_arm_mm * sa + arm.forearm_mm * sb + arm.tool_mm * sc),
+                                  -(arm.forearm_mm * sb + arm.tool_mm * sc), -arm.tool_mm * sc};
+    const float dh[AXIS_COUNT] = {0.0f, r, arm.forearm_mm * cb + arm.tool_mm * cc, arm.tool_mm * cc};
+    for (size_t j = 1; j < AXIS_COUNT; j++) {
+        jacobian[KIN_POSE_X][j] = c1 * dr[j];
+        jacobian[KIN_POSE_Y][j] = s1 * dr[j];
+        jacobian[KIN_POSE_Z][j] = dh[j];
+        jacobian[KIN_POSE_PITCH][j] = 1.0f;
+    }
+    jacobian[KIN_POSE_X][0] = -r * s1;
+    jacobian[KIN_POSE_Y][0] = r * c1;
+    jacobian[KIN_POSE_Z][0] = 0.0f;
+    jacobian[KIN_POSE_PITCH][0] = 0.0f;
+}
+
+// Gauss-Jordan with partial pivoting. False if `m` is singular.
+static bool invert(float m[AXIS_COUNT][AXIS_COUNT], float inverse[AXIS_COUNT][AXIS_COUNT]) {
+    float scale = 0.0f;
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        for (size_t j = 0; j < AXIS_COUNT; j++) {
+            inverse[i][j] = i == j ? 1.0f : 0.0f;
+            scale = fmaxf(scale, fabsf(m[i][j]));
+        }
+    }
+    for (size_t col = 0; col < AXIS_COUNT; col++) {
+        size_t pivot = col;
+        for (size_t row = col + 1; row < AXIS_COUNT; row++) {
+            if (fabsf(m[row][col]) > fabsf(m[pivot][col])) {
+                pivot = row;
+            }
+        }
+        if (fabsf(m[pivot][col]) <= SINGULAR * scale) {
+            return false;
+        }
+        for (size_t j = 0; j < AXIS_COUNT; j++) {
+            float t = m[col][j];
+            m[col][j] = m[pivot][j];
+            m[pivot][j] = t;
+            t = inverse[col][j];
+            inverse[col][j] = inverse[pivot][j];
+            inverse[pivot][j] = t;
+        }
+        const float k = 1.0f / m[col][col];
+        for (size_t j = 0; j < AXIS_COUNT; j++) {
+            m[col][j] *= k;
+            inverse[col][j] *= k;
+        }
+        for (size_t row = 0; row < AXIS_COUNT; row++) {
+            if (row == col || m[row][col] == 0.0f) {
+                continue;
+            }
+            const float f = m[row][col];
+            for (size_t j = 0; j < AXIS_COUNT; j++) {
+                m[row][j] -= f * m[col][j];
+                inverse[row][j] -= f * inverse[col][j];
+            }
+        }
+    }
+    return true;
+}
+
+// Analytic inverse Jacobian at the line's current angles.
+static bool rebuild(kin_line_t &line) {
+    float jacobian[AXIS_COUNT][AXIS_COUNT];
+    forward_model(*line.arm, line.q, line.p, jacobian);
+    line.rebuilds++;
+    return invert(jacobian, line.h);
+}
+
+// "Good" Broyden update of the inverse Jacobian (Sherman-Morrison), so that
+// it maps the pose change dp of the last segment to its angle change dq.
+static void broyden(float h[AXIS_COUNT][AXIS_COUNT], const float dq[AXIS_COUNT], const float dp[AXIS_COUNT]) {
+    float hdp[AXIS_COUNT] = {};
+    float qh[AXIS_COUNT] = {};
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        for (size_t j = 0; j < AXIS_COUNT; j++) {
+            hdp[i] += h[i][j] * dp[j];
+            qh[j] += dq[i] * h[i][j];
+        }
+    }
+    float denom = 0.0f;
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        denom += dq[i] * hdp[i];
+    }
+    if (fabsf(denom) < 1e-12f) {
+        return;
+    }
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        const float u = (dq[i] - hdp[i]) / denom;
+        for (size_t j = 0; j < AXIS_COUNT; j++) {
+            h[i][j] += u * qh[j];
+        }
+    }
+}
+
+// Distance of two pose vectors, the pitch counted as travel of the tool length.
+static float pose_distance(const arm_geometry_t &arm, const float a[AXIS_COUNT], const float b[AXIS_COUNT]) {
+    const float dx = a[KIN_POSE_X] - b[KIN_POSE_X];
+    const float dy = a[KIN_POSE_Y] - b[KIN_POSE_Y];
+    const float dz = a[KIN_POSE_Z] - b[KIN_POSE_Z];
+    return sqrtf(dx * dx + dy * dy + dz * dz) + arm.tool_mm * fabsf(a[KIN_POSE_PITCH] - b[KIN_POSE_PITCH]);
+}
+
+void kinematics_forward(const arm_geometry_t &arm, const float joints[AXIS_COUNT], float pose[AXIS_COUNT]) {
+    float q[AXIS_COUNT];
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        q[i] = to_model(arm, i, joints[i]);
+    }
+    forward_model(arm, q, pose, nullptr);
+    pose[KIN_POSE_PITCH] /= DEG;
+}
+
+bool kinematics_inverse(const arm_geometry_t &arm, const float pose[AXIS_COUNT], const float seed[AXIS_COUNT],
+                        float joints[AXIS_COUNT]) {
+    float near[AXIS_COUNT];
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        near[i] = to_model(arm, i, seed[i]);
+    }
+    const float pitch = pose[KIN_POSE_PITCH] * DEG;
+    const float r = sqrtf(pose[KIN_POSE_X] * pose[KIN_POSE_X] + pose[KIN_POSE_Y] * pose[KIN_POSE_Y]);
+    const float rw = r - arm.tool_mm * cosf(pitch);
+    const float hw = pose[KIN_POSE_Z] - arm.base_height_mm - arm.tool_mm * sinf(pitch);
+    const float l2 = arm.upper_arm_mm, l3 = arm.forearm_mm;
+    float d = (rw * rw + hw * hw - l2 * l2 - l3 * l3) / (2.0f * l2 * l3);
+    if (d > 1.0f + 1e-5f || d < -1.0f - 1e-5f) {
+        return false;
+    }
+    d = fminf(fmaxf(d, -1.0f), 1.0f);
+
+    float q[AXIS_COUNT];
+    q[0] = r > 1e-3f ? atan2f(pose[KIN_POSE_Y], pose[KIN_POSE_X]) : near[0];
+    q[2] = near[2] < 0.0f ? -acosf(d) : acosf(d);
+    q[1] = atan2f(hw, rw) - atan2f(l3 * sinf(q[2]), l2 + l3 * cosf(q[2]));
+    q[3] = pitch - q[1] - q[2];
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        q[i] += TWO_PI * roundf((near[i] - q[i]) / TWO_PI);
+        joints[i] = to_joint(arm, i, q[i]);
+    }
+    return true;
+}
+
+bool kin_line_begin(kin_line_t &line, const arm_geometry_t &arm, const float start_joints[AXIS_COUNT],
+                    const float end_pose[AXIS_COUNT], const float end_joints[AXIS_COUNT], float tolerance_mm,
+                    float max_segment_mm) {
+    memset(&line, 0, sizeof(line));
+    line.arm = &arm;
+    line.tolerance_mm = tolerance_mm;
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        line.q[i] = to_model(arm, i, start_joints[i]);
+        line.end_joints[i] = end_joints[i];
+    }
+    if (!rebuild(line)) {
+        return false;
+    }
+    memcpy(line.start, line.p, sizeof(line.start));
+    float end[AXIS_COUNT];
+    memcpy(end, end_pose, sizeof(end));
+    end[KIN_POSE_PITCH] *= DEG;
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        line.delta[i] = end[i] - line.start[i];
+    }
+    line.length_mm = pose_distance(arm, end, line.start);
+    line.max_step = line.length_mm > max_segment_mm ? max_segment_mm / line.length_mm : 1.0f;
+    line.min_step = line.max_step * MIN_STEP_RATIO;
+    line.step = line.max_step;
+    return true;
+}
+
+bool kin_line_next(kin_line_t &line, float joints[AXIS_COUNT], float &segment_mm) {
+    if (line.s >= 1.0f) {
+        return false;
+    }
+    const arm_geometry_t &arm = *line.arm;
+    bool fresh = line.segments == 0;
+    while (true) {
+        const float s = fminf(line.s + line.step, 1.0f);
+        float target[AXIS_COUNT], dq[AXIS_COUNT] = {}, q[AXIS_COUNT], p[AXIS_COUNT];
+        for (size_t i = 0; i < AXIS_COUNT; i++) {
+            target[i] = line.start[i] + s * line.delta[i];
+        }
+        for (size_t i = 0; i < AXIS_COUNT; i++) {
+            for (size_t j = 0; j < AXIS_COUNT; j++) {
+                dq[i] += line.h[i][j] * (target[j] - line.p[j]);
+            }
+            q[i] = line.q[i] + dq[i];
+        }
+        forward_model(arm, q, p, nullptr);
+
+        // The Newton residual is about twice the bow of the joint-space
+        // segment between the two ends, so half the tolerance bounds both.
+        const float error = pose_distance(arm, target, p);
+        if (error > 0.5f * line.tolerance_mm && line.step > line.min_step) {
+            if (!fresh && rebuild(line)) {
+                fresh = true;
+            } else {
+                line.step = fmaxf(line.step * 0.5f, line.min_step);
+            }
+            continue;
+        }
+
+        if (error > line.tolerance_mm) {
+            // no segment short enough: a singularity on the way
+            line.singular = true;
+            memcpy(joints, line.end_joints, sizeof(line.end_joints));
+            segment_mm = (1.0f - line.s) * line.length_mm;
+            line.s = 1.0f;
+            line.segments++;
+            return true;
+        }
+
+        float dp[AXIS_COUNT];
+        for (size_t i = 0; i < AXIS_COUNT; i++) {
+            dp[i] = p[i] - line.p[i];
+        }
+        broyden(line.h, dq, dp);
+        memcpy(line.q, q, sizeof(q));
+        memcpy(line.p, p, sizeof(p));
+        segment_mm = (s - line.s) * line.length_mm;
+        line.s = s;
+        line.segments++;
+        if (error < 0.125f * line.tolerance_mm) {
+            line.step = fminf(line.step * 1.5f, line.max_step);
+        }
+        for (size_t i = 0; i < AXIS_COUNT; i++) {
+            joints[i] = s >= 1.0f ? line.end_joints[i] : to_joint(arm, i, line.q[i]);
+        }
+        return true;
+    }
+}
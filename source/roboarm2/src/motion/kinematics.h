@@ -0,0 +1,81 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "motion_block.h"
+
+// Tool-space kinematics of the arm. Pure C++, no ESP-IDF, single precision.
+//
+// X is the base yaw, Y the shoulder and Z the elbow pitch and A the wrist
+// pitch, each relative to the link before it; joint values are the axis
+// units of axis_config.h (degrees). A tool pose is the tool tip in mm (x, y,
+// z, z up from the base plate) and the tool pitch in degrees from horizontal.
+//
+// A straight tool-space line becomes a series of joint-space segments, each
+// short enough that the tip stays within `tolerance` of the line. Segments
+// are found by Newton steps on an inverse Jacobian that is carried from one
+// segment to the next with a Broyden update and only rebuilt from the
+// analytic Jacobian when its prediction gets poor, so a segment costs one
+// forward solve and a few dozen multiply-adds instead of a full IK solve.
+
+// Link lengths and how the joint zeros sit on the kinematic model: joint
+// angle = sign * model angle + zero. Nominal values of the cad/ assembly;
+// measure the built arm before relying on tool-space moves.
+struct arm_geometry_t {
+    float base_height_mm;   // base plate to the shoulder axis
+    float upper_arm_mm;     // shoulder axis to elbow axis
+    float forearm_mm;       // elbow axis to wrist axis
+    float tool_mm;          // wrist axis to the tool tip
+    float joint_zero_deg[AXIS_COUNT];
+    float joint_sign[AXIS_COUNT];
+};
+
+inline constexpr arm_geometry_t ARM_GEOMETRY = {
+    120.0f, 160.0f, 140.0f, 60.0f,
+    {0.0f, 0.0f, 0.0f, 0.0f},
+    {1.0f, 1.0f, 1.0f, 1.0f},
+};
+
+// Pose vector: x, y, z (mm), pitch (degrees).
+constexpr size_t KIN_POSE_X = 0;
+constexpr size_t KIN_POSE_Y = 1;
+constexpr size_t KIN_POSE_Z = 2;
+constexpr size_t KIN_POSE_PITCH = 3;
+
+void kinematics_forward(const arm_geometry_t &arm, const float joints[AXIS_COUNT], float pose[AXIS_COUNT]);
+
+// Closed-form solution on the elbow side of `seed` (joint values), each
+// angle picked within half a turn of the seed. False if out of reach.
+bool kinematics_inverse(const arm_geometry_t &arm, const float pose[AXIS_COUNT], const float seed[AXIS_COUNT],
+                        float joints[AXIS_COUNT]);
+
+struct kin_line_t {
+    const arm_geometry_t *arm;
+    float start[AXIS_COUNT];        // pose vectors, pitch in radians
+    float delta[AXIS_COUNT];
+    float end_joints[AXIS_COUNT];   // joint values
+    float length_mm;                // tip travel, or tool_mm times the pitch change
+    float tolerance_mm;
+    float max_step;                 // longest segment, fraction of the line
+    float min_step;
+    float s;                        // fraction of the line done
+    float step;                     // fraction tried for the next segment
+    float q[AXIS_COUNT];            // model angles (radians) at s
+    float p[AXIS_COUNT];            // their pose vector
+    float h[AXIS_COUNT][AXIS_COUNT]; // inverse Jacobian near q
+    uint32_t segments;
+    uint32_t rebuilds;              // analytic inverse Jacobians computed
+    bool singular;                  // the rest of the line went to end_joints in one joint move
+};
+
+// Start a line from `start_joints` to the tool pose `end_pose`, reached at
+// `end_joints` (kinematics_inverse). Segments are at most max_segment_mm of
+// tip travel. False at a singular start.
+bool kin_line_begin(kin_line_t &line, const arm_geometry_t &arm, const float start_joints[AXIS_COUNT],
+                    const float end_pose[AXIS_COUNT], const float end_joints[AXIS_COUNT], float tolerance_mm,
+                    float max_segment_mm);
+
+// Joint values at the end of the next segment and its tip travel. The last
+// segment ends exactly at end_joints; near a singularity, where no segment
+// stays within the tolerance, it is the rest of the line and `singular` is
+// set. False once the line is done.
+bool kin_line_next(kin_line_t &line, float joints[AXIS_COUNT], float &segment_mm);
@@ -0,0 +1,32 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "step_ramp.h"
+
+constexpr size_t AXIS_COUNT = 4;
+
+// Which realtime override scales a block's speed (step_stream.h).
+enum speed_override_t : uint8_t {
+    SPEED_OVERRIDE_FEED = 0,  // feed moves and precompiled blocks
+    SPEED_OVERRIDE_RAPID = 1, // G0
+    SPEED_OVERRIDE_OFF = 2,   // homing: planned speed, not held either
+};
+
+// One precomputed straight-line move, ready for the step encoders. Speeds are
+// in steps/s of the lead axis (the one with the most steps); every other axis
+// is distributed over the lead steps.
+//
+// Lead profile: entry_rate -> cruise_rate at `accel`, cruise, then
+// cruise_rate -> exit_rate over the final decel_steps.
+struct motion_block_t {
+    uint32_t steps[AXIS_COUNT];
+    uint32_t lead_steps;
+    uint32_t entry_rate;
+    uint32_t cruise_rate;
+    uint32_t exit_rate;
+    uint32_t accel;       // lead steps/s^2
+    uint32_t decel_steps;
+    uint8_t dir_bits;     // bit i set: axis i moves negative
+    ramp_profile_t profile;
+    speed_override_t override;
+};
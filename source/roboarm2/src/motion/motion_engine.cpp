@@ -0,0 +1,576 @@
+#include "motion_engine.h"
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <driver/gpio.h>
+#include <driver/pulse_cnt.h>
+#include <driver/rmt_tx.h>
+#include <esp_attr.h>
+#include <esp_check.h>
+#include <esp_rom_gpio.h>
+#include <freertos/task.h>
+#include <hal/gpio_ll.h>
+#include <soc/gpio_sig_map.h>
+#include <soc/gpio_struct.h>
+#include <soc/soc_caps.h>
+#include "arena.h"
+#include "diag/instrumentation.h"
+#include "stepper_encoder.h"
+#include "stream_encoder.h"
+
+static const char *TAG = "motion_engine";
+
+constexpr size_t AXIS_TRANS_QUEUE_DEPTH = 4;
+// The PCNT counters are 16 bit; the driver accumulates every wrap.
+constexpr int STEP_COUNT_LIMIT = 32767;
+// Far shorter than any step pulse, rejects ringing on the step line.
+constexpr uint32_t STEP_COUNT_GLITCH_NS = 1000;
+
+static_assert(sizeof(step_stream_t) + AXIS_COUNT * ROBOARM_ACCEL_TABLE_ENTRIES * sizeof(uint32_t) +
+                  SOC_RMT_TX_CANDIDATES_PER_GROUP * SOC_RMT_MEM_WORDS_PER_CHANNEL / 2 * sizeof(rmt_symbol_word_t) <=
+                  ROBOARM_ARENA_RMT_BYTES,
+              "ROBOARM_ARENA_RMT_BYTES too small for the step stream");
+
+// Split the TX-capable RMT RAM evenly between the channels in use, in whole
+// memory blocks: 4 axes with their direction channels get 64 symbols each on
+// the ESP32, 2 axes 128. The driver refills each half while the other one is
+// being sent.
+static constexpr size_t axis_mem_block_symbols(size_t channels) {
+    const size_t blocks = SOC_RMT_TX_CANDIDATES_PER_GROUP / (channels ? channels : 1);
+    return (blocks ? blocks : 1) * SOC_RMT_MEM_WORDS_PER_CHANNEL;
+}
+
+struct axis_channel_t {
+    rmt_channel_handle_t channel;
+    rmt_encoder_handle_t encoder;
+    rmt_encoder_handle_t stream_encoder;
+    rmt_channel_handle_t dir_channel;     // paired streams only
+    rmt_encoder_handle_t dir_encoder;
+    stepper_ramp_t ramps[2];
+    pcnt_unit_handle_t counter;  // rising edges on the step pin
+    uint32_t step_signal;        // GPIO matrix signal of the RMT channel
+    uint32_t dir_signal;         // and of the direction channel
+};
+
+static motion_engine_config_t s_config;
+static size_t s_mem_block_symbols;
+static axis_channel_t s_axes[AXIS_COUNT];
+static rmt_channel_handle_t s_channels[2 * AXIS_COUNT];
+static size_t s_channel_count;
+#if SOC_RMT_SUPPORT_TX_SYNCHRO
+static rmt_sync_manager_handle_t s_sync;
+#endif
+// The stream, the encoders' staging buffers and the ramp speed tables are
+// read from the RMT interrupt; ARENA_RMT keeps them in internal RAM.
+static step_stream_t *s_stream;
+static accel_table_t s_accel_tables[AXIS_COUNT];
+static portMUX_TYPE s_stream_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool s_streaming;
+static bool s_paired;  // direction pins on RMT channels of their own
+static uint8_t s_dir_bits;
+static std::atomic<uint8_t> s_masked; // step pins cut off from their channel
+static motion_override_t s_override = {100, 100, false}; // under s_stream_lock
+static uint32_t s_count_base[AXIS_COUNT]; // PCNT count when the tallies had counted nothing, under s_stream_lock
+
+static const rmt_transmit_config_t TRANSMIT_CONFIG = {
+    .loop_count = 0,
+    .flags = {.eot_level = 0, .queue_nonblocking = true},
+};
+
+#if ROBOARM_INSTRUMENTATION
+static bool IRAM_ATTR on_trans_done(rmt_channel_handle_t channel, const rmt_tx_done_event_data_t *edata, void *user_ctx) {
+    instr_trans_done(reinterpret_cast<size_t>(user_ctx), instr_cycles());
+    return false;
+}
+#endif
+
+static void set_direction(size_t axis, bool negative) {
+    const axis_config_t &config = s_config.axes[axis];
+    if (s_paired) {
+        // taken back from the direction channel, see connect_dir_channels()
+        esp_rom_gpio_connect_out_signal(config.dir_pin, SIG_GPIO_OUT_IDX, false, false);
+    }
+    gpio_set_level(config.dir_pin, negative != config.dir_invert);
+    s_dir_bits = negative ? s_dir_bits | (1u << axis) : s_dir_bits & ~(1u << axis);
+}
+
+// Counts the pulses that actually reach the driver. Set up before the RMT
+// channel takes the pin as its output.
+static esp_err_t new_step_counter(size_t axis) {
+    pcnt_unit_config_t unit_config = {};
+    unit_config.low_limit = -STEP_COUNT_LIMIT;
+    unit_config.high_limit = STEP_COUNT_LIMIT;
+    unit_config.flags.accum_count = 1;
+    pcnt_unit_handle_t &unit = s_axes[axis].counter;
+    ESP_RETURN_ON_ERROR(pcnt_new_unit(&unit_config, &unit), TAG, "counter");
+    pcnt_chan_config_t chan_config = {};
+    chan_config.edge_gpio_num = s_config.axes[axis].step_pin;
+    chan_config.level_gpio_num = -1;
+    pcnt_channel_handle_t channel;
+    ESP_RETURN_ON_ERROR(pcnt_new_channel(unit, &chan_config, &channel), TAG, "counter channel");
+    ESP_RETURN_ON_ERROR(pcnt_channel_set_edge_action(channel, PCNT_CHANNEL_EDGE_ACTION_INCREASE, PCNT_CHANNEL_EDGE_ACTION_HOLD),
+                        TAG, "counter edge");
+    ESP_RETURN_ON_ERROR(pcnt_unit_add_watch_point(unit, STEP_COUNT_LIMIT), TAG, "counter wrap");
+    pcnt_glitch_filter_config_t filter = {};
+    filter.max_glitch_ns = STEP_COUNT_GLITCH_NS;
+    ESP_RETURN_ON_ERROR(pcnt_unit_set_glitch_filter(unit, &filter), TAG, "counter filter");
+    ESP_RETURN_ON_ERROR(pcnt_unit_enable(unit), TAG, "counter enable");
+    ESP_RETURN_ON_ERROR(pcnt_unit_clear_count(unit), TAG, "counter clear");
+    return pcnt_unit_start(unit);
+}
+
+// Direction pin of `axis` as an RMT channel of its own, fed from the same
+// stream as its step channel.
+static esp_err_t new_dir_channel(size_t axis) {
+    const axis_config_t &config = s_config.axes[axis];
+    rmt_tx_channel_config_t tx_chan_config = {};
+    tx_chan_config.gpio_num = config.dir_pin;
+    tx_chan_config.clk_src = RMT_CLK_SRC_DEFAULT;
+    tx_chan_config.resolution_hz = s_config.resolution_hz;
+    tx_chan_config.mem_block_symbols = s_mem_block_symbols;
+    tx_chan_config.trans_queue_depth = AXIS_TRANS_QUEUE_DEPTH;
+    tx_chan_config.intr_priority = ROBOARM_RMT_INTR_PRIORITY;
+    tx_chan_config.flags.invert_out = config.dir_invert;
+    axis_channel_t &channel = s_axes[axis];
+    ESP_RETURN_ON_ERROR(rmt_new_tx_channel(&tx_chan_config, &channel.dir_channel), TAG, "tx channel");
+    channel.dir_signal = GPIO.func_out_sel_cfg[config.dir_pin].func_sel;
+
+    stream_encoder_config_t stream_config = {};
+    stream_config.stream = s_stream;
+    stream_config.axis = axis;
+    stream_config.lock = &s_stream_lock;
+    stream_config.chunk_symbols = s_mem_block_symbols / 2;
+    stream_config.staging = arena_new<rmt_symbol_word_t>(ARENA_RMT, stream_config.chunk_symbols);
+    stream_config.direction = true;
+    ESP_RETURN_ON_FALSE(stream_config.staging, ESP_ERR_NO_MEM, TAG, "staging");
+    ESP_RETURN_ON_ERROR(rmt_new_stream_encoder(&stream_config, &channel.dir_encoder), TAG, "encoder");
+    ESP_RETURN_ON_ERROR(rmt_enable(channel.dir_channel), TAG, "enable");
+    s_channels[s_channel_count++] = channel.dir_channel;
+    return ESP_OK;
+}
+
+// Hands the direction pins back to their channels after direct moves.
+static void connect_dir_channels(void) {
+    for (size_t i = 0; i < s_config.axis_count; i++) {
+        const axis_config_t &config = s_config.axes[i];
+        esp_rom_gpio_connect_out_signal(config.dir_pin, s_axes[i].dir_signal, config.dir_invert, false);
+    }
+}
+
+// One table per axis, reaching the axis' max rate at its max acceleration.
+// Ramps led by that axis look their speeds up instead of taking square roots.
+static esp_err_t build_accel_tables(void) {
+    size_t bytes = 0;
+    for (size_t i = 0; i < s_config.axis_count; i++) {
+        const axis_config_t &axis = s_config.axes[i];
+#if ROBOARM_ACCEL_TABLE_ENTRIES
+        const uint32_t accel = std::max<uint32_t>(lroundf(axis.accel_mm_per_s2 * axis.steps_per_mm), 1);
+        const uint32_t max_rate = std::min<uint32_t>(lroundf(axis.max_rate_mm_per_min / 60.0f * axis.steps_per_mm), RAMP_MAX_RATE);
+        uint32_t *speeds = arena_new<uint32_t>(ARENA_RMT, ROBOARM_ACCEL_TABLE_ENTRIES);
+        ESP_RETURN_ON_FALSE(speeds, ESP_ERR_NO_MEM, TAG, "accel table %c", axis.name);
+        accel_table_build(s_accel_tables[i], speeds, ROBOARM_ACCEL_TABLE_ENTRIES, accel, max_rate);
+        ESP_LOGI(TAG, "accel table %c: %u entries every %u steps up to %lu steps/s", axis.name,
+                 static_cast<unsigned>(s_accel_tables[i].entries), 1u << s_accel_tables[i].shift,
+                 static_cast<unsigned long>(max_rate));
+#else
+        s_accel_tables[i] = {};
+#endif
+        bytes += accel_table_bytes(s_accel_tables[i]);
+        s_stream->tables[i] = s_accel_tables[i].speeds ? &s_accel_tables[i] : nullptr;
+    }
+    ESP_LOGI(TAG, "accel tables use %u bytes of DRAM, RMT RAM is %u symbols per channel", static_cast<unsigned>(bytes),
+             static_cast<unsigned>(s_mem_block_symbols));
+    return ESP_OK;
+}
+
+esp_err_t motion_engine_init(const motion_engine_config_t *config) {
+    ESP_RETURN_ON_FALSE(config && config->axes && config->axis_count <= AXIS_COUNT, ESP_ERR_INVALID_ARG, TAG, "invalid config");
+    ESP_RETURN_ON_FALSE(config->resolution_hz == motion_timing::TICKS_PER_S, ESP_ERR_INVALID_ARG, TAG,
+                        "step timing is built for %lu Hz", static_cast<unsigned long>(motion_timing::TICKS_PER_S));
+    s_config = *config;
+    s_stream = arena_new<step_stream_t>(ARENA_RMT);
+    ESP_RETURN_ON_FALSE(s_stream, ESP_ERR_NO_MEM, TAG, "no room for the step stream");
+    // Direction channels when the RMT has a channel left for each; otherwise
+    // the direction pins are GPIOs and a reversal drains the stream.
+    s_paired = 2 * s_config.axis_count + s_config.reserved_channels <= SOC_RMT_TX_CANDIDATES_PER_GROUP;
+    s_channel_count = 0;
+    if (s_paired) {
+        s_mem_block_symbols = std::min(axis_mem_block_symbols(2 * s_config.axis_count + s_config.reserved_channels),
+                                       STEP_HISTORY_SYMBOLS / 2);
+    } else {
+        s_mem_block_symbols = axis_mem_block_symbols(s_config.axis_count + s_config.reserved_channels);
+    }
+    instr_init();
+
+    for (size_t i = 0; i < s_config.axis_count; i++) {
+        const axis_config_t &axis = s_config.axes[i];
+        gpio_config_t dir_conf = {};
+        dir_conf.pin_bit_mask = 1ull << axis.dir_pin;
+        dir_conf.mode = GPIO_MODE_OUTPUT;
+        ESP_RETURN_ON_ERROR(gpio_config(&dir_conf), TAG, "dir pin %c", axis.name);
+        set_direction(i, false);
+        ESP_RETURN_ON_ERROR(new_step_counter(i), TAG, "step counter %c", axis.name);
+
+        rmt_tx_channel_config_t tx_chan_config = {};
+        tx_chan_config.gpio_num = axis.step_pin;
+        tx_chan_config.clk_src = RMT_CLK_SRC_DEFAULT;
+        tx_chan_config.resolution_hz = s_config.resolution_hz;
+        tx_chan_config.mem_block_symbols = s_mem_block_symbols;
+        tx_chan_config.trans_queue_depth = AXIS_TRANS_QUEUE_DEPTH;
+        tx_chan_config.intr_priority = ROBOARM_RMT_INTR_PRIORITY;
+        ESP_RETURN_ON_ERROR(rmt_new_tx_channel(&tx_chan_config, &s_axes[i].channel), TAG, "tx channel %c", axis.name);
+        s_axes[i].step_signal = GPIO.func_out_sel_cfg[axis.step_pin].func_sel;
+#if ROBOARM_INSTRUMENTATION
+        rmt_tx_event_callbacks_t callbacks = {};
+        callbacks.on_trans_done = on_trans_done;
+        ESP_RETURN_ON_ERROR(rmt_tx_register_event_callbacks(s_axes[i].channel, &callbacks, reinterpret_cast<void *>(i)), TAG,
+                            "callbacks %c", axis.name);
+#endif
+
+        stepper_encoder_config_t encoder_config = {};
+        encoder_config.resolution = s_config.resolution_hz;
+        ESP_RETURN_ON_ERROR(rmt_new_stepper_encoder(&encoder_config, &s_axes[i].encoder), TAG, "encoder %c", axis.name);
+
+        stream_encoder_config_t stream_config = {};
+        stream_config.stream = s_stream;
+        stream_config.axis = i;
+        stream_config.lock = &s_stream_lock;
+        stream_config.chunk_symbols = s_mem_block_symbols / 2;
+        stream_config.staging = arena_new<rmt_symbol_word_t>(ARENA_RMT, stream_config.chunk_symbols);
+        ESP_RETURN_ON_FALSE(stream_config.staging, ESP_ERR_NO_MEM, TAG, "staging %c", axis.name);
+        ESP_RETURN_ON_ERROR(rmt_new_stream_encoder(&stream_config, &s_axes[i].stream_encoder), TAG, "stream encoder %c", axis.name);
+
+        ESP_RETURN_ON_ERROR(rmt_enable(s_axes[i].channel), TAG, "enable %c", axis.name);
+        s_channels[s_channel_count++] = s_axes[i].channel;
+        if (s_paired) {
+            ESP_RETURN_ON_ERROR(new_dir_channel(i), TAG, "dir channel %c", axis.name);
+        }
+    }
+
+    ESP_RETURN_ON_ERROR(build_accel_tables(), TAG, "accel tables");
+
+#if SOC_RMT_SUPPORT_TX_SYNCHRO
+    rmt_sync_manager_config_t sync_config = {};
+    sync_config.tx_channel_array = s_channels;
+    sync_config.array_size = s_channel_count;
+    ESP_RETURN_ON_ERROR(rmt_new_sync_manager(&sync_config, &s_sync), TAG, "sync manager");
+#else
+    ESP_LOGW(TAG, "no RMT TX sync on this target, channels start back to back");
+#endif
+    ESP_LOGI(TAG, "%u axes on RMT at %lu Hz, %u symbols per channel, direction %s", static_cast<unsigned>(s_config.axis_count),
+             static_cast<unsigned long>(s_config.resolution_hz), static_cast<unsigned>(s_mem_block_symbols),
+             s_paired ? "in the stream" : "on GPIO");
+    return ESP_OK;
+}
+
+static inline uint32_t scale(uint32_t value, uint32_t num, uint32_t den) {
+    return static_cast<uint32_t>(static_cast<uint64_t>(value) * num / den);
+}
+
+static esp_err_t start_all(bool stream) {
+    esp_err_t ret = ESP_OK;
+#if SOC_RMT_SUPPORT_TX_SYNCHRO
+    ESP_RETURN_ON_ERROR(rmt_sync_reset(s_sync), TAG, "sync reset");
+#else
+    // Keep other tasks on this core from landing between the starts.
+    vTaskSuspendAll();
+#endif
+    // Direction first: without a sync manager its edges then lead the steps
+    // by the start skew, which only adds setup time.
+    for (size_t i = 0; i < s_config.axis_count && ret == ESP_OK && stream && s_paired; i++) {
+        ret = rmt_transmit(s_axes[i].dir_channel, s_axes[i].dir_encoder, s_stream, sizeof(*s_stream), &TRANSMIT_CONFIG);
+    }
+    for (size_t i = 0; i < s_config.axis_count && ret == ESP_OK; i++) {
+        if (stream) {
+            ret = rmt_transmit(s_axes[i].channel, s_axes[i].stream_encoder, s_stream, sizeof(*s_stream), &TRANSMIT_CONFIG);
+        } else {
+            ret = rmt_transmit(s_axes[i].channel, s_axes[i].encoder, s_axes[i].ramps, sizeof(s_axes[i].ramps), &TRANSMIT_CONFIG);
+        }
+    }
+#if !SOC_RMT_SUPPORT_TX_SYNCHRO
+    xTaskResumeAll();
+#endif
+    return ret;
+}
+
+static esp_err_t wait_all(void) {
+    for (size_t i = 0; i < s_config.axis_count; i++) {
+        ESP_RETURN_ON_ERROR(rmt_tx_wait_all_done(s_axes[i].channel, -1), TAG, "wait %c", s_config.axes[i].name);
+        if (s_paired) {
+            ESP_RETURN_ON_ERROR(rmt_tx_wait_all_done(s_axes[i].dir_channel, -1), TAG, "wait dir %c", s_config.axes[i].name);
+        }
+    }
+    return ESP_OK;
+}
+
+// Lead axis profile: trapezoid, or triangle when the move is too short to cruise.
+static void plan_rest_to_rest(const motion_move_t *move, uint32_t lead_steps, uint32_t *peak, uint32_t *accel_steps) {
+    *peak = move->rate > RAMP_MAX_RATE ? RAMP_MAX_RATE : move->rate;
+    *accel_steps = static_cast<uint32_t>(static_cast<uint64_t>(*peak) * *peak / (2ull * move->accel));
+    if (2ull * *accel_steps > lead_steps) {
+        *accel_steps = lead_steps / 2;
+        *peak = std::max(isqrt64(static_cast<uint64_t>(move->accel) * lead_steps), 1u);
+    }
+}
+
+static uint32_t lead_steps_of(const motion_move_t *move) {
+    uint32_t lead_steps = 0;
+    for (size_t i = 0; i < s_config.axis_count; i++) {
+        lead_steps = std::max(lead_steps, static_cast<uint32_t>(abs(move->steps[i])));
+    }
+    return lead_steps;
+}
+
+esp_err_t motion_engine_move(const motion_move_t *move) {
+    ESP_RETURN_ON_FALSE(move && move->rate && move->accel, ESP_ERR_INVALID_ARG, TAG, "invalid move");
+    ESP_RETURN_ON_FALSE(!s_streaming, ESP_ERR_INVALID_STATE, TAG, "stream running");
+
+    const uint32_t lead_steps = lead_steps_of(move);
+    if (lead_steps == 0) {
+        return ESP_OK;
+    }
+    uint32_t peak, accel_steps;
+    plan_rest_to_rest(move, lead_steps, &peak, &accel_steps);
+
+    for (size_t i = 0; i < s_config.axis_count; i++) {
+        const uint32_t steps = abs(move->steps[i]);
+        stepper_ramp_t *ramps = s_axes[i].ramps;
+        if (steps == 0) {
+            ramps[0] = {};
+            ramps[1] = {};
+            continue;
+        }
+        // Same ratio on every term keeps the per-axis durations equal.
+        const uint32_t axis_peak = std::max(scale(peak, steps, lead_steps), 1u);
+        const uint32_t axis_accel = std::max(scale(move->accel, steps, lead_steps), 1u);
+        const uint32_t axis_ramp = scale(accel_steps, steps, lead_steps);
+        ramps[0] = {0, axis_peak, axis_accel, steps - axis_ramp, RAMP_TRAPEZOID};
+        ramps[1] = {axis_peak, 0, axis_accel, axis_ramp, RAMP_TRAPEZOID};
+        set_direction(i, move->steps[i] < 0);
+    }
+
+    ESP_RETURN_ON_ERROR(start_all(false), TAG, "start move");
+    ESP_RETURN_ON_ERROR(wait_all(), TAG, "move");
+    // the stepper encoder keeps no tally, the whole move has reached the pins
+    portENTER_CRITICAL(&s_stream_lock);
+    for (size_t i = 0; i < s_config.axis_count; i++) {
+        step_stream_tally_t &tally = s_stream->tallies[i];
+        const int32_t position = tally.position.load(std::memory_order_relaxed) + move->steps[i];
+        tally.steps.fetch_add(abs(move->steps[i]), std::memory_order_relaxed);
+        step_stream_set_position(*s_stream, i, position);
+    }
+    portEXIT_CRITICAL(&s_stream_lock);
+    return ESP_OK;
+}
+
+static step_override_t step_override_of(const motion_override_t &override) {
+    return {override.feed_percent * Q16_ONE / 100, override.rapid_percent * Q16_ONE / 100, override.hold};
+}
+
+esp_err_t motion_engine_stream_start(void) {
+    ESP_RETURN_ON_FALSE(!s_streaming, ESP_ERR_INVALID_STATE, TAG, "stream running");
+    step_stream_reset(*s_stream, s_config.axis_count, s_paired);
+    // taken before the first step
+    step_stream_override(*s_stream, step_override_of(s_override));
+    if (s_paired) {
+        connect_dir_channels();
+    }
+    s_streaming = true;
+    esp_err_t ret = start_all(true);
+    if (ret != ESP_OK) {
+        s_stream->stop.store(true);
+        wait_all();
+        s_streaming = false;
+    }
+    return ret;
+}
+
+esp_err_t motion_engine_stream_stop(void) {
+    ESP_RETURN_ON_FALSE(s_streaming, ESP_ERR_INVALID_STATE, TAG, "stream not running");
+    s_stream->stop.store(true);
+    ESP_RETURN_ON_ERROR(wait_all(), TAG, "stream stop");
+    s_streaming = false;
+    return ESP_OK;
+}
+
+static bool stream_drained(void) {
+    portENTER_CRITICAL(&s_stream_lock);
+    // idle symbols may sit in the channel RAM and in the encoder's staging half
+    const bool drained = step_stream_drained(*s_stream, s_mem_block_symbols + s_mem_block_symbols / 2);
+    portEXIT_CRITICAL(&s_stream_lock);
+    return drained;
+}
+
+esp_err_t motion_engine_queue(const motion_block_t *block, TickType_t wait) {
+    ESP_RETURN_ON_FALSE(block && block->lead_steps && block->cruise_rate && block->decel_steps <= block->lead_steps,
+                        ESP_ERR_INVALID_ARG, TAG, "invalid block");
+    ESP_RETURN_ON_FALSE(s_streaming, ESP_ERR_INVALID_STATE, TAG, "stream not running");
+
+    uint8_t moving = 0;
+    for (size_t i = 0; i < s_config.axis_count; i++) {
+        moving |= block->steps[i] ? 1u << i : 0;
+    }
+    // Paired streams put reversals in the symbols, GPIO direction pins can
+    // only flip at rest.
+    const uint8_t reversed = s_paired ? 0 : (block->dir_bits ^ s_dir_bits) & moving;
+    const uint8_t unmask = s_masked.load() & moving;
+    if (reversed || unmask) {
+        // The encoders run ahead of the pins, so flip direction or reconnect
+        // a step pin only once the previous steps have actually left the RMT
+        // RAM.
+        while (!stream_drained()) {
+            vTaskDelay(1);
+        }
+        for (size_t i = 0; i < s_config.axis_count; i++) {
+            if (reversed & (1u << i)) {
+                set_direction(i, block->dir_bits & (1u << i));
+            }
+            if (unmask & (1u << i)) {
+                esp_rom_gpio_connect_out_signal(s_config.axes[i].step_pin, s_axes[i].step_signal, false, false);
+            }
+        }
+        s_masked.fetch_and(static_cast<uint8_t>(~unmask));
+    }
+
+    const TickType_t start = xTaskGetTickCount();
+    while (!s_stream->ring.try_push(*block)) {
+        if (xTaskGetTickCount() - start >= wait) {
+            return ESP_ERR_TIMEOUT;
+        }
+        vTaskDelay(1);
+    }
+    return ESP_OK;
+}
+
+esp_err_t motion_engine_queue_move(const motion_move_t *move, TickType_t wait) {
+    ESP_RETURN_ON_FALSE(move && move->rate && move->accel, ESP_ERR_INVALID_ARG, TAG, "invalid move");
+    motion_block_t block = {};
+    block.lead_steps = lead_steps_of(move);
+    if (block.lead_steps == 0) {
+        return ESP_OK;
+    }
+    for (size_t i = 0; i < s_config.axis_count; i++) {
+        block.steps[i] = abs(move->steps[i]);
+        block.dir_bits |= move->steps[i] < 0 ? 1u << i : 0;
+    }
+    uint32_t accel_steps;
+    plan_rest_to_rest(move, block.lead_steps, &block.cruise_rate, &accel_steps);
+    block.accel = move->accel;
+    block.decel_steps = accel_steps;
+    block.profile = RAMP_TRAPEZOID;
+    return motion_engine_queue(&block, wait);
+}
+
+size_t motion_engine_queue_free(void) {
+    return s_stream->ring.free_slots();
+}
+
+bool motion_engine_idle(void) {
+    return !s_streaming || stream_drained();
+}
+
+size_t motion_engine_queue_depth(void) {
+    return s_stream->ring.size();
+}
+
+void IRAM_ATTR motion_engine_mask_axis_from_isr(size_t axis) {
+    const gpio_num_t pin = s_config.axes[axis].step_pin;
+    gpio_ll_set_level(&GPIO, pin, 0);
+    esp_rom_gpio_connect_out_signal(pin, SIG_GPIO_OUT_IDX, false, false);
+    s_masked.fetch_or(static_cast<uint8_t>(1u << axis));
+}
+
+uint8_t motion_engine_masked_axes(void) {
+    return s_masked.load();
+}
+
+bool motion_engine_dir_in_stream(void) {
+    return s_paired;
+}
+
+int32_t IRAM_ATTR motion_engine_step_count(size_t axis) {
+    int count = 0;
+    pcnt_unit_get_count(s_axes[axis].counter, &count);
+    return count;
+}
+
+// Step back from the generated position over the steps the driver has not
+// seen yet, into the previous direction if the pins are short of the last
+// reversal. Caller holds s_stream_lock.
+static int32_t pins_position(size_t axis) {
+    const step_stream_tally_t &tally = s_stream->tallies[axis];
+    const int32_t position = tally.position.load(std::memory_order_relaxed);
+    if (s_masked.load() & (1u << axis)) {
+        return position;
+    }
+    const uint32_t steps = tally.steps.load(std::memory_order_relaxed);
+    const uint32_t emitted = static_cast<uint32_t>(motion_engine_step_count(axis)) - s_count_base[axis];
+    uint32_t pending = steps - emitted;
+    if (static_cast<int32_t>(pending) < 0) {
+        pending = 0; // an edge counted that the encoder never sent
+    }
+    const uint32_t since_reversal = steps - tally.reversal_steps;
+    const int32_t sign = tally.negative ? -1 : 1;
+    if (pending <= since_reversal) {
+        return position - sign * static_cast<int32_t>(pending);
+    }
+    return tally.reversal_position + sign * static_cast<int32_t>(pending - since_reversal);
+}
+
+void motion_engine_position(motion_position_t *position) {
+    *position = {};
+    portENTER_CRITICAL(&s_stream_lock);
+    for (size_t i = 0; i < s_config.axis_count; i++) {
+        position->steps[i] = pins_position(i);
+        position->rate[i] = s_stream->tallies[i].velocity.load(std::memory_order_relaxed);
+    }
+    portEXIT_CRITICAL(&s_stream_lock);
+}
+
+void motion_engine_set_position(const int32_t position[AXIS_COUNT]) {
+    portENTER_CRITICAL(&s_stream_lock);
+    for (size_t i = 0; i < s_config.axis_count; i++) {
+        step_stream_set_position(*s_stream, i, position[i]);
+        s_count_base[i] = static_cast<uint32_t>(motion_engine_step_count(i)) -
+                          s_stream->tallies[i].steps.load(std::memory_order_relaxed);
+    }
+    portEXIT_CRITICAL(&s_stream_lock);
+}
+
+esp_err_t motion_engine_set_override(const motion_override_t *override) {
+    ESP_RETURN_ON_FALSE(override && override->feed_percent >= 1 && override->feed_percent <= 100 &&
+                            override->rapid_percent >= 1 && override->rapid_percent <= 100,
+                        ESP_ERR_INVALID_ARG, TAG, "invalid override");
+    portENTER_CRITICAL(&s_stream_lock);
+    const bool taken = !s_streaming || step_stream_override(*s_stream, step_override_of(*override));
+    if (taken) {
+        s_override = *override;
+    }
+    portEXIT_CRITICAL(&s_stream_lock);
+    ESP_RETURN_ON_FALSE(taken, ESP_ERR_TIMEOUT, TAG, "overrides not taken up yet");
+    return ESP_OK;
+}
+
+motion_override_t motion_engine_override(void) {
+    portENTER_CRITICAL(&s_stream_lock);
+    const motion_override_t override = s_override;
+    portEXIT_CRITICAL(&s_stream_lock);
+    return override;
+}
+
+uint32_t motion_engine_underruns(void) {
+    return s_stream->underruns.load(std::memory_order_relaxed);
+}
+
+void motion_engine_get_stats(motion_engine_stats_t *stats) {
+    *stats = {};
+    stats->mem_block_symbols = s_mem_block_symbols;
+    stats->trans_queue_depth = AXIS_TRANS_QUEUE_DEPTH;
+    stats->underruns = motion_engine_underruns();
+    portENTER_CRITICAL(&s_stream_lock);
+    for (size_t i = 0; i < s_config.axis_count; i++) {
+        stats->refills[i] = s_stream->axes[i].refills;
+    }
+    portEXIT_CRITICAL(&s_stream_lock);
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <stdint.h>
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include "axis_config.h"
+#include "motion_block.h"
+
+// Drives every axis from its own RMT TX channel, and its direction pin from a
+// second one when the RMT has enough channels (4 axes on the ESP32).
+//
+// Streaming mode (motion_engine_stream_start) keeps one never-ending
+// transaction per channel whose encoder drains a lock-free ring of
+// motion_block_t; planner tasks only push blocks. Direct mode
+// (motion_engine_move) runs one blocking move at a time and is only available
+// while the stream is stopped; it sets the direction pins as GPIOs.
+
+struct motion_engine_config_t {
+    uint32_t resolution_hz;     // must be ROBOARM_TICKS_PER_S
+    const axis_config_t *axes;
+    size_t axis_count;          // <= AXIS_COUNT
+    size_t reserved_channels;   // RMT channels whose RAM is left to other users, e.g. an RX capture
+};
+
+// Relative move in steps. rate/accel apply to the axis with the most steps;
+// the other axes are scaled so every axis starts and stops together.
+struct motion_move_t {
+    int32_t steps[AXIS_COUNT];
+    uint32_t rate;  // steps/s
+    uint32_t accel; // steps/s^2
+};
+
+// Realtime overrides on top of the planned speeds, in percent of them (see
+// step_stream.h). A hold brings every axis to rest at the acceleration of its
+// block, wherever in the block it is; resuming accelerates back to the
+// planned profile. Homing moves run as planned.
+struct motion_override_t {
+    uint8_t feed_percent;  // 1..100, feed moves and precompiled blocks
+    uint8_t rapid_percent; // 1..100, rapids
+    bool hold;
+};
+
+// Where the axes are, in steps: the steps the encoders have generated less
+// those still in the RMT RAM, as the PCNT counters tell. Exact while at most
+// one reversal of an axis is in flight; an axis whose step pin is cut off
+// reports what was generated. Speeds are those of the last generated step,
+// a few ms ahead of the pins.
+struct motion_position_t {
+    int32_t steps[AXIS_COUNT];
+    int32_t rate[AXIS_COUNT];  // steps/s, negative when moving negative
+};
+
+struct motion_engine_stats_t {
+    size_t mem_block_symbols;   // RMT RAM per channel, refilled half by half
+    size_t trans_queue_depth;
+    uint32_t underruns;
+    uint32_t refills[AXIS_COUNT];
+};
+
+// Call from the core that should service the RMT interrupt.
+esp_err_t motion_engine_init(const motion_engine_config_t *config);
+
+// Blocks until every axis has finished the move.
+esp_err_t motion_engine_move(const motion_move_t *move);
+
+esp_err_t motion_engine_stream_start(void);
+// Lets queued blocks finish, then ends the transactions.
+esp_err_t motion_engine_stream_stop(void);
+
+// Producer side of the motion ring. Waits up to `wait` ticks for a free slot.
+// Without direction channels, a block that reverses an axis first waits for
+// the stream to drain so the direction pin can be flipped between steps.
+esp_err_t motion_engine_queue(const motion_block_t *block, TickType_t wait);
+
+// Queue a rest-to-rest trapezoid for `move`.
+esp_err_t motion_engine_queue_move(const motion_move_t *move, TickType_t wait);
+
+size_t motion_engine_queue_free(void);
+// True once every queued step has left the RMT RAM, within a few ms.
+bool motion_engine_idle(void);
+// Blocks queued and not yet fully encoded.
+size_t motion_engine_queue_depth(void);
+// Cuts the step pin of `axis` off its channel at once; the encoder runs on
+// and its remaining steps are dropped. The pin is reconnected by the next
+// queued block that moves the axis, once the stream has drained. ISR safe.
+void motion_engine_mask_axis_from_isr(size_t axis);
+// Axes whose step pin is cut off and waits for a block to reconnect it.
+uint8_t motion_engine_masked_axes(void);
+// True when direction changes go out with the steps; reversals then need no
+// drain and the planner need not stop for them.
+bool motion_engine_dir_in_stream(void);
+// Rising edges on the step pin of `axis` since init, i.e. steps that reached
+// the driver (PCNT). ISR safe; also with the cache off when
+// CONFIG_PCNT_CTRL_FUNC_IN_IRAM is set.
+int32_t motion_engine_step_count(size_t axis);
+
+// Any task; takes the stream lock for a few hundred cycles, like the encoder.
+void motion_engine_position(motion_position_t *position);
+// Where the axes are now, e.g. after homing. Only while motion_engine_idle().
+void motion_engine_set_position(const int32_t position[AXIS_COUNT]);
+
+// Applied from the next symbol the encoders generate, a few ms ahead of the
+// pins, to the blocks already queued too. Any task.
+esp_err_t motion_engine_set_override(const motion_override_t *override);
+motion_override_t motion_engine_override(void);
+
+// Times the ring ran dry while an axis was still moving.
+uint32_t motion_engine_underruns(void);
+void motion_engine_get_stats(motion_engine_stats_t *stats);
@@ -0,0 +1,14 @@
+#pragma once
+
+// Placement of the code the RMT and limit interrupts run. On the device it
+// goes to IRAM, so the step stream keeps flowing while the flash cache is off
+// (CONFIG_RMT_ISR_IRAM_SAFE in the perf build); on a host build the markers
+// are empty. Small header helpers on the path are forced inline instead, an
+// out-of-line copy of them would land in flash.
+#if __has_include(<esp_attr.h>)
+#include <esp_attr.h>
+#define MOTION_IRAM IRAM_ATTR
+#else
+#define MOTION_IRAM
+#endif
+#define MOTION_INLINE inline __attribute__((always_inline))
@@ -0,0 +1,215 @@
+#include "planner.h"
+#include <math.h>
+#include <string.h>
+
+static inline size_t next_index(size_t index) { return index + 1 == ROBOARM_PLANNER_BLOCKS ? 0 : index + 1; }
+static inline size_t prev_index(size_t index) { return index == 0 ? ROBOARM_PLANNER_BLOCKS - 1 : index - 1; }
+
+void planner_init(planner_t &planner, const planner_config_t &config) {
+    memset(&planner, 0, sizeof(planner));
+    planner.config = config;
+}
+
+void planner_set_position(planner_t &planner, const int32_t position[AXIS_COUNT]) {
+    memcpy(planner.position, position, sizeof(planner.position));
+    planner.previous_valid = false;
+}
+
+// Largest value along `unit` that keeps every axis within its own limit.
+static float limit_by_axes(const planner_t &planner, const float limits[AXIS_COUNT], const float unit[AXIS_COUNT]) {
+    float value = INFINITY;
+    for (size_t i = 0; i < planner.config.axis_count; i++) {
+        if (unit[i] != 0.0f) {
+            value = fminf(value, fabsf(limits[i] / unit[i]));
+        }
+    }
+    return value;
+}
+
+static void recalculate(planner_t &planner) {
+    // Backward pass: newest block must be able to stop, every earlier one must
+    // be able to slow down to its successor's entry speed.
+    size_t index = prev_index(planner.head);
+    plan_block_t *current = &planner.blocks[index];
+    current->entry_speed_sqr = fminf(current->max_entry_speed_sqr, 2.0f * current->acceleration * current->millimeters);
+    if (index == planner.planned) {
+        return;
+    }
+    index = prev_index(index);
+    while (index != planner.planned) {
+        plan_block_t *next = current;
+        current = &planner.blocks[index];
+        if (current->entry_speed_sqr != current->max_entry_speed_sqr) {
+            const float entry_speed_sqr = next->entry_speed_sqr + 2.0f * current->acceleration * current->millimeters;
+            current->entry_speed_sqr = fminf(entry_speed_sqr, current->max_entry_speed_sqr);
+        }
+        index = prev_index(index);
+    }
+
+    // Forward pass: limit entries to what the previous block can reach, and
+    // move the planned pointer past blocks that can no longer improve.
+    plan_block_t *next = &planner.blocks[planner.planned];
+    index = next_index(planner.planned);
+    while (index != planner.head) {
+        current = next;
+        next = &planner.blocks[index];
+        if (current->entry_speed_sqr < next->entry_speed_sqr) {
+            const float entry_speed_sqr = current->entry_speed_sqr + 2.0f * current->acceleration * current->millimeters;
+            if (entry_speed_sqr < next->entry_speed_sqr) {
+                next->entry_speed_sqr = entry_speed_sqr;
+                planner.planned = index;
+            }
+        }
+        if (next->entry_speed_sqr == next->max_entry_speed_sqr) {
+            planner.planned = index;
+        }
+        index = next_index(index);
+    }
+}
+
+bool planner_buffer_line(planner_t &planner, const int32_t target[AXIS_COUNT], float feed) {
+    if (planner_full(planner)) {
+        return false;
+    }
+    const planner_config_t &config = planner.config;
+    plan_block_t block = {};
+    float delta_mm[AXIS_COUNT] = {};
+    float millimeters_sqr = 0.0f;
+    for (size_t i = 0; i < config.axis_count; i++) {
+        const int32_t delta = target[i] - planner.position[i];
+        block.steps[i] = delta < 0 ? -delta : delta;
+        block.dir_bits |= delta < 0 ? 1u << i : 0;
+        if (block.steps[i] > block.lead_steps) {
+            block.lead_steps = block.steps[i];
+        }
+        delta_mm[i] = delta * config.mm_per_step[i];
+        millimeters_sqr += delta_mm[i] * delta_mm[i];
+    }
+    if (block.lead_steps == 0) {
+        return true;
+    }
+    block.rapid = feed <= 0.0f;
+    block.millimeters = sqrtf(millimeters_sqr);
+
+    float unit[AXIS_COUNT] = {};
+    for (size_t i = 0; i < config.axis_count; i++) {
+        unit[i] = delta_mm[i] / block.millimeters;
+    }
+    block.acceleration = limit_by_axes(planner, config.accel, unit);
+    const float rapid = limit_by_axes(planner, config.max_rate, unit);
+    const float nominal = feed > 0.0f ? fminf(feed, rapid) : rapid;
+    block.nominal_speed_sqr = nominal * nominal;
+
+    // Junction speed with the previous block.
+    float junction_speed_sqr = 0.0f;
+    uint8_t moving = 0;
+    for (size_t i = 0; i < config.axis_count; i++) {
+        moving |= block.steps[i] ? 1u << i : 0;
+    }
+    const bool reversed = ((block.dir_bits ^ planner.previous_dir_bits) & moving) != 0;
+    if (planner.previous_valid && !(config.stop_on_reversal && reversed)) {
+        float cos_theta = 0.0f;
+        float junction_unit[AXIS_COUNT] = {};
+        for (size_t i = 0; i < config.axis_count; i++) {
+            cos_theta -= planner.previous_unit[i] * unit[i];
+            junction_unit[i] = unit[i] - planner.previous_unit[i];
+        }
+        if (cos_theta < -0.999999f) {
+            // straight line, only the nominal speeds limit the junction
+            junction_speed_sqr = INFINITY;
+        } else if (cos_theta <= 0.999999f) {
+            float norm = 0.0f;
+            for (size_t i = 0; i < config.axis_count; i++) {
+                norm += junction_unit[i] * junction_unit[i];
+            }
+            norm = sqrtf(norm);
+            for (size_t i = 0; i < config.axis_count; i++) {
+                junction_unit[i] /= norm;
+            }
+            const float junction_accel = limit_by_axes(planner, config.accel, junction_unit);
+            const float sin_theta_d2 = sqrtf(0.5f * (1.0f - cos_theta));
+            junction_speed_sqr = junction_accel * config.junction_deviation * sin_theta_d2 / (1.0f - sin_theta_d2);
+        }
+    }
+    block.max_entry_speed_sqr = fminf(junction_speed_sqr, fminf(block.nominal_speed_sqr, planner.previous_nominal_speed_sqr));
+    if (!planner.previous_valid) {
+        block.max_entry_speed_sqr = 0.0f;
+    }
+
+    const bool was_empty = planner.count == 0;
+    planner.blocks[planner.head] = block;
+    if (was_empty) {
+        planner.planned = planner.head;
+    }
+    planner.head = next_index(planner.head);
+    planner.count++;
+
+    memcpy(planner.position, target, sizeof(planner.position));
+    memcpy(planner.previous_unit, unit, sizeof(planner.previous_unit));
+    planner.previous_nominal_speed_sqr = block.nominal_speed_sqr;
+    planner.previous_dir_bits = (planner.previous_dir_bits & ~moving) | block.dir_bits;
+    planner.previous_valid = true;
+
+    recalculate(planner);
+    return true;
+}
+
+static uint32_t to_rate(float speed_sqr, float steps_per_mm) {
+    const float rate = sqrtf(fmaxf(speed_sqr, 0.0f)) * steps_per_mm;
+    if (rate >= RAMP_MAX_RATE) {
+        return RAMP_MAX_RATE;
+    }
+    return static_cast<uint32_t>(lroundf(rate));
+}
+
+bool planner_pop(planner_t &planner, motion_block_t &out, bool flush) {
+    if (planner.count == 0 || (planner.count == 1 && !flush)) {
+        return false;
+    }
+    const plan_block_t &block = planner.blocks[planner.tail];
+    const size_t next = next_index(planner.tail);
+    const float exit_speed_sqr = planner.count > 1 ? planner.blocks[next].entry_speed_sqr : 0.0f;
+
+    // Everything below in lead-axis steps.
+    const float steps_per_mm = block.lead_steps / block.millimeters;
+    const float accel = block.acceleration * steps_per_mm;
+    const float entry_sqr = block.entry_speed_sqr * steps_per_mm * steps_per_mm;
+    const float exit_sqr = exit_speed_sqr * steps_per_mm * steps_per_mm;
+    float cruise_sqr = block.nominal_speed_sqr * steps_per_mm * steps_per_mm;
+
+    float accel_steps = (cruise_sqr - entry_sqr) / (2.0f * accel);
+    float decel_steps = (cruise_sqr - exit_sqr) / (2.0f * accel);
+    if (accel_steps + decel_steps > block.lead_steps) {
+        // No room to cruise: accelerate up to where the two ramps meet.
+        accel_steps = fmaxf(0.0f, fminf(block.lead_steps, (2.0f * accel * block.lead_steps + exit_sqr - entry_sqr) / (4.0f * accel)));
+        decel_steps = block.lead_steps - accel_steps;
+        cruise_sqr = entry_sqr + 2.0f * accel * accel_steps;
+    }
+
+    out = {};
+    memcpy(out.steps, block.steps, sizeof(out.steps));
+    out.lead_steps = block.lead_steps;
+    out.dir_bits = block.dir_bits;
+    out.entry_rate = to_rate(entry_sqr, 1.0f);
+    out.exit_rate = to_rate(exit_sqr, 1.0f);
+    out.cruise_rate = to_rate(cruise_sqr, 1.0f);
+    if (out.cruise_rate == 0) {
+        out.cruise_rate = 1;
+    }
+    out.accel = static_cast<uint32_t>(lroundf(fmaxf(accel, 1.0f)));
+    out.decel_steps = static_cast<uint32_t>(fmaxf(0.0f, ceilf(fminf(decel_steps - 1e-3f, static_cast<float>(block.lead_steps)))));
+    out.profile = RAMP_TRAPEZOID;
+    out.override = block.rapid ? SPEED_OVERRIDE_RAPID : SPEED_OVERRIDE_FEED;
+
+    planner.tail = next;
+    planner.count--;
+    if (planner.count == 0) {
+        // The queue ends at rest: the next line starts from zero.
+        planner.previous_valid = false;
+        planner.planned = planner.tail;
+    } else if (planner.planned == prev_index(planner.tail)) {
+        // The new oldest block's entry now matches a committed exit.
+        planner.planned = planner.tail;
+    }
+    return true;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "roboarm_config.h"
+#include "motion_block.h"
+
+// Look-ahead trajectory planner (Grbl style). Lines are kept in a fixed ring
+// of ROBOARM_PLANNER_BLOCKS; each new line runs a backward pass (every block
+// must be able to stop by the end of the queue) and a forward pass (no block
+// may enter faster than its predecessor can accelerate to). Junction speeds
+// come from the junction deviation model across all axes, so shallow corners
+// keep their speed and only reversals come to a stop.
+//
+// The oldest block leaves the planner through planner_pop(), converted to the
+// lead-axis motion_block_t the step encoders run. Pure C++, no ESP-IDF.
+
+struct planner_config_t {
+    size_t axis_count;
+    float mm_per_step[AXIS_COUNT];
+    float max_rate[AXIS_COUNT];   // mm/s
+    float accel[AXIS_COUNT];      // mm/s^2
+    float junction_deviation;     // mm
+    bool stop_on_reversal;        // direction pins can only flip at rest
+};
+
+struct plan_block_t {
+    uint32_t steps[AXIS_COUNT];
+    uint32_t lead_steps;
+    uint8_t dir_bits;
+    bool rapid;
+    float millimeters;
+    float acceleration;           // mm/s^2
+    float nominal_speed_sqr;
+    float entry_speed_sqr;
+    float max_entry_speed_sqr;
+};
+
+struct planner_t {
+    planner_config_t config;
+    plan_block_t blocks[ROBOARM_PLANNER_BLOCKS];
+    size_t tail;
+    size_t head;
+    size_t planned;               // blocks from tail up to here are final
+    size_t count;
+    int32_t position[AXIS_COUNT]; // steps, end of the newest block
+    float previous_unit[AXIS_COUNT];
+    float previous_nominal_speed_sqr;
+    uint8_t previous_dir_bits;    // last direction of every axis that moved
+    bool previous_valid;          // false after the queue drained to rest
+};
+
+void planner_init(planner_t &planner, const planner_config_t &config);
+void planner_set_position(planner_t &planner, const int32_t position[AXIS_COUNT]);
+
+static inline bool planner_full(const planner_t &planner) { return planner.count == ROBOARM_PLANNER_BLOCKS; }
+static inline size_t planner_count(const planner_t &planner) { return planner.count; }
+
+// Queue a straight move to `target` (steps). feed is mm/s, 0 for a rapid.
+// Returns false if the planner is full; zero-length moves are accepted and dropped.
+bool planner_buffer_line(planner_t &planner, const int32_t target[AXIS_COUNT], float feed);
+
+// Take the oldest block. Its exit speed becomes the next block's fixed entry;
+// the newest block is only handed out with `flush` and then ends at rest.
+bool planner_pop(planner_t &planner, motion_block_t &block, bool flush);
@@ -0,0 +1,71 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "motion_iram.h"
+
+// Fixed-capacity single-producer/single-consumer ring, no locks and no
+// FreeRTOS queue. Indices are free running and wrap through uint32_t; the slot
+// is index & (N - 1). The producer only writes head_, the consumer only
+// writes tail_, and each sits on its own cache line.
+//
+// Besides try_pop() the consumer can peek ahead with read_index()/at() and
+// release several slots at once, which lets the step encoders of every axis
+// walk the same blocks before they are handed back to the producer.
+
+constexpr size_t RING_CACHE_LINE = 32; // ESP32 cache line size
+
+template <typename T, size_t N>
+class spsc_ring {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "capacity must be a power of two");
+
+public:
+    static constexpr size_t capacity() { return N; }
+
+    // producer
+    bool try_push(const T &item) {
+        const uint32_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) >= N) {
+            return false;
+        }
+        slots_[head & (N - 1)] = item;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t free_slots() const { return N - size(); }
+
+    // consumer
+    MOTION_INLINE bool try_pop(T &item) {
+        const uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = slots_[tail & (N - 1)];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    MOTION_INLINE uint32_t read_index() const { return tail_.load(std::memory_order_relaxed); }
+    MOTION_INLINE uint32_t write_index() const { return head_.load(std::memory_order_acquire); }
+    MOTION_INLINE T &at(uint32_t index) { return slots_[index & (N - 1)]; }
+    MOTION_INLINE const T &at(uint32_t index) const { return slots_[index & (N - 1)]; }
+
+    // Hand every slot below `index` back to the producer.
+    MOTION_INLINE void release_to(uint32_t index) { tail_.store(index, std::memory_order_release); }
+
+    // either side
+    MOTION_INLINE size_t size() const { return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire); }
+    bool empty() const { return size() == 0; }
+
+    // Only while neither side is running.
+    void clear() {
+        head_.store(0, std::memory_order_relaxed);
+        tail_.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    alignas(RING_CACHE_LINE) std::atomic<uint32_t> head_{0};
+    alignas(RING_CACHE_LINE) std::atomic<uint32_t> tail_{0};
+    alignas(RING_CACHE_LINE) T slots_[N];
+};
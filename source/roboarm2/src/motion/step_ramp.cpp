@@ -0,0 +1,118 @@
+#include "step_ramp.h"
+
+static MOTION_INLINE uint32_t clamp_rate(uint32_t rate) {
+    return rate > RAMP_MAX_RATE ? RAMP_MAX_RATE : rate;
+}
+
+// Blend of linear and smoothstep, x in Q24. Pure smoothstep in step space never
+// leaves standstill, the linear half keeps the first step finite while still
+// halving the acceleration jump at both ends of the ramp.
+static MOTION_INLINE uint64_t scurve_q24(uint64_t x) {
+    const uint64_t smooth = (x * x >> 24) * ((3ull << 24) - 2 * x) >> 24;
+    return (x + smooth) >> 1;
+}
+
+void MOTION_IRAM ramp_begin(ramp_state_t &state, const stepper_ramp_t &ramp, const accel_table_t *table) {
+    const uint32_t start = clamp_rate(ramp.start_rate);
+    const uint32_t end = clamp_rate(ramp.end_rate);
+
+    state.v_start_sq = static_cast<uint64_t>(start) * start << 32;
+    state.v_end_sq = static_cast<uint64_t>(end) * end << 32;
+    state.v_prev = q16_from_int(start);
+    state.v_end = q16_from_int(end);
+    state.accel = ramp.accel;
+    state.step = 0;
+    state.steps = ramp.steps;
+    state.frac = 0;
+    state.last_period = 0;
+    state.decel = end < start;
+    state.cruise = false;
+    state.profile = ramp.profile;
+    state.table = nullptr;
+
+    if (ramp.accel == 0 || start == end) {
+        state.ramp_steps = 0;
+        state.v_prev = state.v_end;
+    } else {
+        const uint64_t delta = state.decel
+            ? static_cast<uint64_t>(start) * start - static_cast<uint64_t>(end) * end
+            : static_cast<uint64_t>(end) * end - static_cast<uint64_t>(start) * start;
+        const uint64_t ramp_steps = (delta + 2ull * ramp.accel - 1) / (2ull * ramp.accel);
+        state.ramp_steps = ramp_steps < ramp.steps ? static_cast<uint32_t>(ramp_steps) : ramp.steps;
+        if (table && table->speeds && ramp.profile == RAMP_TRAPEZOID) {
+            state.table = table;
+            state.m_start = accel_table_index(*table, static_cast<uint64_t>(start) * start);
+            state.m_step = accel_table_step(*table, ramp.accel);
+        }
+    }
+}
+
+// Q16.16 speed after step k of the ramp, by square root.
+static uint32_t MOTION_IRAM ramp_speed_sqrt(const ramp_state_t &state, uint32_t k) {
+    uint64_t v_sq;
+    if (state.profile == RAMP_SCURVE) {
+        const uint64_t x = (static_cast<uint64_t>(k) << 24) / state.ramp_steps;
+        const uint64_t s = scurve_q24(x);
+        v_sq = state.decel
+            ? state.v_start_sq - (((state.v_start_sq - state.v_end_sq) >> 24) * s)
+            : state.v_start_sq + (((state.v_end_sq - state.v_start_sq) >> 24) * s);
+    } else {
+        const uint64_t gained = (2ull * state.accel * k) << 32;
+        if (state.decel) {
+            v_sq = state.v_start_sq > gained ? state.v_start_sq - gained : 0;
+        } else {
+            v_sq = state.v_start_sq + gained;
+        }
+    }
+    if (state.decel ? v_sq < state.v_end_sq : v_sq > state.v_end_sq) {
+        v_sq = state.v_end_sq;
+    }
+    // sqrt of a Q32.32 value is Q16.16
+    return isqrt64(v_sq);
+}
+
+// Same from the axis table, false where the table cannot answer.
+static bool MOTION_IRAM ramp_speed_table(const ramp_state_t &state, uint32_t k, uint32_t &v) {
+    const uint64_t moved = static_cast<uint64_t>(state.m_step) * k;
+    uint64_t m = 0;
+    if (!state.decel) {
+        m = state.m_start + moved;
+    } else if (state.m_start > moved) {
+        m = state.m_start - moved;
+    }
+    if (!accel_table_speed(*state.table, m, v)) {
+        return false;
+    }
+    if (state.decel ? v < state.v_end : v > state.v_end) {
+        v = state.v_end;
+    }
+    return true;
+}
+
+uint32_t MOTION_IRAM ramp_next_period(ramp_state_t &state) {
+    if (state.cruise) {
+        state.step++;
+        return motion_timing::take_ticks(state.last_period, state.frac);
+    }
+    uint32_t v_next = state.v_end;
+    if (state.step < state.ramp_steps) {
+        const uint32_t k = state.step + 1;
+        if (!state.table || !ramp_speed_table(state, k, v_next)) {
+            v_next = ramp_speed_sqrt(state, k);
+        }
+    }
+
+    // Average speed over the step; exact for constant acceleration.
+    const uint64_t v_sum = static_cast<uint64_t>(state.v_prev) + v_next;
+    uint64_t period_q16 = state.last_period;
+    if (v_sum != 0) {
+        period_q16 = motion_timing::period_q16(v_sum);
+        state.last_period = period_q16;
+        // at the end rate from both sides the period stays, skip the divide
+        state.cruise = state.step >= state.ramp_steps && state.v_prev == v_next;
+    }
+    state.v_prev = v_next;
+    state.step++;
+
+    return motion_timing::take_ticks(period_q16, state.frac);
+}
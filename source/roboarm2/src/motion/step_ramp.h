@@ -0,0 +1,68 @@
+#pragma once
+#include <stdint.h>
+#include "accel_table.h"
+#include "step_timing.h"
+
+// Step-period generation for one ramp segment. Pure integer math on
+// motion_timing so it can run inside the RMT encoder callback (no FPU use in
+// ISR context on the ESP32).
+
+enum ramp_profile_t : uint8_t {
+    RAMP_TRAPEZOID = 0, // constant acceleration, v^2 linear in steps
+    RAMP_SCURVE = 1,    // v^2 eased over the ramp, softer start/end
+};
+
+// `steps` pulses that start at `start_rate` and move towards `end_rate` at
+// `accel`. Once end_rate is reached the remainder of the segment cruises.
+// accel == 0 jumps straight to end_rate. Rates are capped at RAMP_MAX_RATE.
+struct stepper_ramp_t {
+    uint32_t start_rate; // steps/s
+    uint32_t end_rate;   // steps/s
+    uint32_t accel;      // steps/s^2
+    uint32_t steps;
+    ramp_profile_t profile;
+};
+
+constexpr uint32_t RAMP_MAX_RATE = 0xffff;
+
+struct ramp_state_t {
+    uint64_t v_start_sq;  // Q32.32 (steps/s)^2
+    uint64_t v_end_sq;
+    uint32_t v_prev;      // Q16.16 steps/s at the previous step boundary
+    uint32_t v_end;       // Q16.16
+    uint32_t accel;
+    uint32_t ramp_steps;  // steps spent changing speed, the rest cruises
+    uint32_t step;        // next step index
+    uint32_t steps;
+    uint32_t frac;        // carried sub-tick remainder, Q0.16
+    uint64_t last_period; // Q16.16 ticks, reused when the target speed is zero
+    bool decel;
+    bool cruise;          // every step from here takes last_period
+
+    ramp_profile_t profile;
+    const accel_table_t *table; // trapezoid speeds come from here when set
+    uint64_t m_start;           // Q16.16 table index of the start rate
+    uint32_t m_step;            // Q16.16 table index per step
+};
+
+// `table` is optional; without it (or outside its range) every step takes a
+// square root.
+void ramp_begin(ramp_state_t &state, const stepper_ramp_t &ramp, const accel_table_t *table = nullptr);
+
+static MOTION_INLINE bool ramp_done(const ramp_state_t &state) { return state.step >= state.steps; }
+
+// Ticks between the previous step and the next one. Only valid while !ramp_done().
+uint32_t ramp_next_period(ramp_state_t &state);
+
+// Q16.16 ticks of every step left once the ramp cruises at its end rate, 0
+// while the speed still changes.
+static MOTION_INLINE uint64_t ramp_cruise_period(const ramp_state_t &state) { return state.cruise ? state.last_period : 0; }
+
+// Ticks of the next `count` steps while cruising, the sum `count` calls of
+// ramp_next_period would return. `count` must not pass the end of the ramp.
+static MOTION_INLINE uint64_t ramp_cruise_steps(ramp_state_t &state, uint32_t count) {
+    const uint64_t total = state.last_period * count + state.frac;
+    state.frac = static_cast<uint32_t>(total & 0xffff);
+    state.step += count;
+    return total >> 16;
+}
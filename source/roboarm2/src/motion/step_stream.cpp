@@ -0,0 +1,405 @@
+#include "step_stream.h"
+#include <algorithm>
+
+constexpr uint32_t SYMBOL_MAX = motion_timing::SYMBOL_MAX;
+constexpr uint32_t MIN_PERIOD = motion_timing::MIN_PERIOD;
+
+static_assert((STEP_HISTORY_SYMBOLS & (STEP_HISTORY_SYMBOLS - 1)) == 0, "STEP_HISTORY_SYMBOLS must be a power of two");
+// The direction edge of a reversal fits between two steps at the top rate.
+static_assert(motion_timing::period_ticks(RAMP_MAX_RATE) >
+                  motion_timing::PULSE_TICKS + motion_timing::DIR_SETUP_TICKS + MIN_PERIOD,
+              "step pulse and direction setup do not fit the fastest step period");
+
+void step_stream_reset(step_stream_t &stream, size_t axis_count, bool paired) {
+    stream.ring.clear();
+    stream.axis_count = axis_count;
+    stream.paired = paired;
+    for (auto &axis : stream.axes) {
+        axis = {};
+        axis.override = STEP_OVERRIDE_NONE;
+    }
+    stream.stamped = 0;
+    stream.finished = 0;
+    stream.last_end = 0;
+    stream.last_exit_rate = 0;
+    stream.starved_at = 0;
+    stream.override_head = 0;
+    stream.underruns.store(0, std::memory_order_relaxed);
+    stream.stop.store(false, std::memory_order_relaxed);
+}
+
+bool step_stream_override(step_stream_t &stream, const step_override_t &override) {
+    uint64_t at = 0;
+    uint32_t waiting = 0;
+    bool newest_taken = false;
+    for (size_t i = 0; i < stream.axis_count; i++) {
+        const step_stream_axis_t &axis = stream.axes[i];
+        at = std::max(at, axis.time);
+        waiting = std::max(waiting, stream.override_head - axis.override_read);
+        newest_taken |= axis.override_read == stream.override_head;
+    }
+    if (waiting == OVERRIDE_EVENTS) {
+        // an axis is far behind: amend the newest event while nobody has it
+        if (newest_taken) {
+            return false;
+        }
+        stream.override_events[(stream.override_head - 1) & (OVERRIDE_EVENTS - 1)] = override;
+        return true;
+    }
+    const uint32_t slot = stream.override_head & (OVERRIDE_EVENTS - 1);
+    stream.override_events[slot] = override;
+    stream.override_at[slot] = at;
+    stream.override_head++;
+    return true;
+}
+
+void step_stream_set_position(step_stream_t &stream, size_t index, int32_t position) {
+    step_stream_tally_t &tally = stream.tallies[index];
+    tally.position.store(position, std::memory_order_relaxed);
+    tally.velocity.store(0, std::memory_order_relaxed);
+    tally.reversal_steps = tally.steps.load(std::memory_order_relaxed);
+    tally.reversal_position = position;
+}
+
+// One more step of `axis` in its tally, at the speed the lead has reached.
+static MOTION_INLINE void count_step(step_stream_tally_t &tally, const step_stream_axis_t &axis) {
+    const int32_t position = tally.position.load(std::memory_order_relaxed);
+    const uint32_t steps = tally.steps.load(std::memory_order_relaxed);
+    if (axis.negative != tally.negative) {
+        tally.negative = axis.negative;
+        tally.reversal_steps = steps;
+        tally.reversal_position = position;
+    }
+    const uint32_t lead_speed = axis.limited ? axis.speed : axis.lead.v_prev;
+    const int32_t rate = static_cast<int32_t>(static_cast<uint64_t>(lead_speed) * axis.rate_ratio >> 32);
+    tally.position.store(axis.negative ? position - 1 : position + 1, std::memory_order_relaxed);
+    tally.steps.store(steps + 1, std::memory_order_relaxed);
+    tally.velocity.store(axis.negative ? -rate : rate, std::memory_order_relaxed);
+}
+
+static MOTION_INLINE void at_rest(step_stream_tally_t &tally) {
+    tally.velocity.store(0, std::memory_order_relaxed);
+}
+
+// Overrides due at the axis' current tick.
+static MOTION_INLINE void take_overrides(const step_stream_t &stream, step_stream_axis_t &axis) {
+    while (axis.override_read != stream.override_head) {
+        const uint32_t slot = axis.override_read & (OVERRIDE_EVENTS - 1);
+        if (stream.override_at[slot] > axis.time) {
+            return;
+        }
+        axis.override = stream.override_events[slot];
+        axis.override_read++;
+    }
+}
+
+// Ticks to the next lead step: the ramp's own, or while an override is in
+// force the ramp's speed scaled and approached at the block's acceleration.
+// False while a hold keeps the axis at rest.
+static bool MOTION_IRAM lead_period(step_stream_axis_t &axis, const motion_block_t &block, uint32_t &period) {
+    uint32_t scale = Q16_ONE;
+    if (block.override != SPEED_OVERRIDE_OFF) {
+        const step_override_t &override = axis.override;
+        scale = override.hold ? 0 : block.override == SPEED_OVERRIDE_RAPID ? override.rapid_scale : override.feed_scale;
+        scale = std::min(scale, Q16_ONE);
+    }
+    if (!axis.limited) {
+        if (scale == Q16_ONE) {
+            period = ramp_next_period(axis.lead);
+            return true;
+        }
+        axis.limited = true;
+        axis.speed = axis.lead.v_prev;
+        axis.speed_frac = 0;
+    }
+    if (scale == 0 && axis.speed == 0) {
+        return false;
+    }
+    const uint32_t ramp_period = ramp_next_period(axis.lead);
+    const uint32_t planned = axis.lead.v_prev;
+    const uint64_t target = static_cast<uint64_t>(planned) * scale >> 16;
+    const uint64_t speed_sq = static_cast<uint64_t>(axis.speed) * axis.speed;
+    const uint64_t target_sq = target * target;
+    // v^2 changes by 2 a per step at constant acceleration, Q32.32
+    const uint64_t change = block.accel ? (2ull * block.accel) << 32 : UINT64_MAX;
+    uint64_t next_sq = target_sq;
+    if (speed_sq > target_sq && speed_sq - target_sq > change) {
+        next_sq = speed_sq - change;
+    } else if (target_sq > speed_sq && target_sq - speed_sq > change) {
+        next_sq = speed_sq + change;
+    }
+    // never above the planned speed, so the block still comes to rest where
+    // it was planned to
+    const uint32_t v_next = std::min(isqrt64(next_sq), planned);
+    const uint64_t v_sum = static_cast<uint64_t>(axis.speed) + v_next;
+    period = v_sum ? motion_timing::take_ticks(motion_timing::period_q16(v_sum), axis.speed_frac) : ramp_period;
+    axis.speed = v_next;
+    if (scale == Q16_ONE && v_next == planned) {
+        axis.limited = false;
+    }
+    return true;
+}
+
+// Idle time while held, IDLE_QUANTUM per symbol so a resume is picked up as
+// soon as a new block would be, and never past the next override.
+static MOTION_INLINE void hold_pad(const step_stream_t &stream, step_stream_axis_t &axis) {
+    uint64_t ticks = motion_timing::IDLE_QUANTUM;
+    if (axis.override_read != stream.override_head) {
+        // later than axis.time, take_overrides has run
+        ticks = std::min(ticks, stream.override_at[axis.override_read & (OVERRIDE_EVENTS - 1)] - axis.time);
+    }
+    axis.pending_ticks += ticks;
+    axis.time += ticks;
+}
+
+static void MOTION_IRAM begin_phase(step_stream_axis_t &axis, const motion_block_t &block) {
+    stepper_ramp_t ramp;
+    if (axis.phase == 0) {
+        ramp = {block.entry_rate, block.cruise_rate, block.accel, block.lead_steps - block.decel_steps, block.profile};
+    } else {
+        ramp = {block.cruise_rate, block.exit_rate, block.accel, block.decel_steps, block.profile};
+    }
+    ramp_begin(axis.lead, ramp, axis.lead_table);
+}
+
+// Start the block at the axis cursor if the producer has pushed it. The first
+// axis to reach a block decides its start tick for everyone: right after the
+// previous block, or after the idle time any axis has already padded.
+static bool MOTION_IRAM begin_block(step_stream_t &stream, size_t index, step_stream_axis_t &axis) {
+    if (axis.cursor == stream.ring.write_index()) {
+        return false;
+    }
+    if (axis.cursor == stream.stamped) {
+        uint64_t start = stream.last_end;
+        for (size_t i = 0; i < stream.axis_count; i++) {
+            if (stream.axes[i].time > start) {
+                start = stream.axes[i].time;
+            }
+        }
+        stream.block_start[axis.cursor & (MOTION_RING_BLOCKS - 1)] = start;
+        stream.stamped++;
+    }
+    const uint64_t start = stream.block_start[axis.cursor & (MOTION_RING_BLOCKS - 1)];
+    axis.pending_ticks += start - axis.time;
+    axis.time = start;
+
+    const motion_block_t &block = stream.ring.at(axis.cursor);
+    if (block.steps[index]) {
+        axis.negative = block.dir_bits & (1u << index);
+        axis.rate_ratio = static_cast<uint32_t>((static_cast<uint64_t>(block.steps[index]) << 16) / block.lead_steps);
+    } else {
+        at_rest(stream.tallies[index]);
+    }
+    axis.in_block = true;
+    axis.phase = 0;
+    axis.lead_step = 0;
+    axis.distribution.begin(block.lead_steps);
+    axis.lead_table = nullptr;
+    for (size_t i = 0; i < stream.axis_count; i++) {
+        if (block.steps[i] == block.lead_steps) {
+            axis.lead_table = stream.tables[i];
+            break;
+        }
+    }
+    axis.idle_symbols = 0;
+    begin_phase(axis, block);
+    return true;
+}
+
+static void MOTION_IRAM finish_block(step_stream_t &stream, step_stream_axis_t &axis, const motion_block_t &block) {
+    if (axis.cursor == stream.finished) {
+        stream.last_end = axis.time;
+        stream.last_exit_rate = block.exit_rate;
+        stream.finished++;
+    }
+    axis.in_block = false;
+    axis.cursor++;
+
+    uint32_t tail = axis.cursor;
+    for (size_t i = 0; i < stream.axis_count; i++) {
+        if (static_cast<int32_t>(stream.axes[i].cursor - tail) < 0) {
+            tail = stream.axes[i].cursor;
+        }
+    }
+    if (tail != stream.ring.read_index()) {
+        stream.ring.release_to(tail);
+    }
+}
+
+// Lead steps advance_block can take in one go: the lead cruises at a constant
+// period with no override in force or waiting, so the steps up to this axis'
+// next one, the end of the phase or the last one the loop would still take
+// before a filler symbol all cost the same. 0 to walk them one by one.
+static MOTION_INLINE uint32_t cruise_run(const step_stream_t &stream, const step_stream_axis_t &axis,
+                                         const motion_block_t &block, uint32_t steps) {
+    const uint64_t period = ramp_cruise_period(axis.lead);
+    if (period < q16_from_int(MIN_PERIOD) || axis.limited || axis.override_read != stream.override_head) {
+        return 0;
+    }
+    if (block.override != SPEED_OVERRIDE_OFF) {
+        const step_override_t &override = axis.override;
+        if (override.hold || (block.override == SPEED_OVERRIDE_RAPID ? override.rapid_scale : override.feed_scale) < Q16_ONE) {
+            return 0;
+        }
+    }
+    // the loop takes another step while pending_ticks <= SYMBOL_MAX
+    const uint64_t longest = (period + 0xffff) >> 16;
+    uint64_t run = (SYMBOL_MAX - axis.pending_ticks) / longest + 1;
+    run = std::min<uint64_t>(run, axis.lead.steps - axis.lead.step);
+    if (steps) {
+        run = std::min<uint64_t>(run, axis.distribution.until_step(steps, block.lead_steps));
+    }
+    return run > 1 ? static_cast<uint32_t>(run) : 0;
+}
+
+// Walk lead steps until this axis steps, the block ends, or enough low time
+// has piled up to emit a filler symbol. False while held.
+static bool MOTION_IRAM advance_block(step_stream_t &stream, size_t index, step_stream_axis_t &axis) {
+    const motion_block_t &block = stream.ring.at(axis.cursor);
+    const uint32_t steps = block.steps[index];
+    while (axis.pending_ticks <= SYMBOL_MAX) {
+        if (axis.lead_step == block.lead_steps) {
+            finish_block(stream, axis, block);
+            return true;
+        }
+        if (ramp_done(axis.lead)) {
+            axis.phase++;
+            begin_phase(axis, block);
+        }
+        take_overrides(stream, axis);
+        if (const uint32_t run = cruise_run(stream, axis, block, steps)) {
+            const uint64_t ticks = ramp_cruise_steps(axis.lead, run);
+            axis.pending_ticks += ticks;
+            axis.time += ticks;
+            axis.lead_step += run;
+            if (steps && axis.distribution.skip(steps, block.lead_steps, run)) {
+                axis.pending_step = true;
+                count_step(stream.tallies[index], axis);
+                return true;
+            }
+            continue;
+        }
+        uint32_t period;
+        if (!lead_period(axis, block, period)) {
+            return false;
+        }
+        if (period < MIN_PERIOD) {
+            period = MIN_PERIOD;
+        }
+        axis.pending_ticks += period;
+        axis.time += period;
+        axis.lead_step++;
+        if (axis.distribution.step(steps, block.lead_steps)) {
+            axis.pending_step = true;
+            count_step(stream.tallies[index], axis);
+            return true;
+        }
+    }
+    return true;
+}
+
+static bool MOTION_IRAM generate_symbol(step_stream_t &stream, size_t index, step_symbol_t &symbol) {
+    step_stream_axis_t &axis = stream.axes[index];
+    while (true) {
+        if (const uint32_t chunk = motion_timing::split(axis.pending_ticks)) {
+            symbol = motion_timing::symbol(chunk, false);
+            axis.pending_ticks -= chunk;
+            return true;
+        }
+        if (axis.pending_step) {
+            symbol = motion_timing::symbol(static_cast<uint32_t>(axis.pending_ticks), true);
+            axis.pending_ticks = 0;
+            axis.pending_step = false;
+            return true;
+        }
+        if (axis.in_block) {
+            if (advance_block(stream, index, axis)) {
+                continue;
+            }
+            at_rest(stream.tallies[index]);
+            hold_pad(stream, axis);
+            if (axis.pending_ticks > motion_timing::STEP_SYMBOL_MAX || axis.pending_ticks < MIN_PERIOD) {
+                continue;
+            }
+            symbol = motion_timing::symbol(static_cast<uint32_t>(axis.pending_ticks), false);
+            axis.pending_ticks = 0;
+            return true;
+        }
+        if (begin_block(stream, index, axis)) {
+            continue;
+        }
+        take_overrides(stream, axis);
+        at_rest(stream.tallies[index]);
+
+        // Ring is dry: pad with idle time.
+        if (axis.cursor == stream.finished && stream.last_exit_rate != 0 && stream.starved_at != stream.finished) {
+            stream.starved_at = stream.finished;
+            stream.underruns.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (stream.stop.load(std::memory_order_relaxed) && axis.pending_ticks < MIN_PERIOD) {
+            return false;
+        }
+        if (!stream.stop.load(std::memory_order_relaxed)) {
+            axis.pending_ticks += motion_timing::IDLE_QUANTUM;
+            axis.time += motion_timing::IDLE_QUANTUM;
+        }
+        if (axis.pending_ticks > SYMBOL_MAX) {
+            continue;
+        }
+        symbol = motion_timing::symbol(static_cast<uint32_t>(axis.pending_ticks), false);
+        axis.pending_ticks = 0;
+        axis.idle_symbols++;
+        return true;
+    }
+}
+
+// Next history symbol at `read`, generating it if this channel is the one
+// ahead. The other channel never falls STEP_HISTORY_SYMBOLS behind, see there.
+static bool MOTION_IRAM read_history(step_stream_t &stream, size_t index, uint32_t &read, step_symbol_t &symbol) {
+    step_stream_axis_t &axis = stream.axes[index];
+    if (read == axis.generated) {
+        if (!generate_symbol(stream, index, symbol)) {
+            return false;
+        }
+        symbol.level0 = axis.negative;
+        axis.history[axis.generated++ & (STEP_HISTORY_SYMBOLS - 1)] = symbol;
+    }
+    symbol = axis.history[read++ & (STEP_HISTORY_SYMBOLS - 1)];
+    return true;
+}
+
+bool MOTION_IRAM step_stream_next_symbol(step_stream_t &stream, size_t index, step_symbol_t &symbol) {
+    if (!stream.paired) {
+        return generate_symbol(stream, index, symbol);
+    }
+    if (!read_history(stream, index, stream.axes[index].step_read, symbol)) {
+        return false;
+    }
+    symbol.level0 = 0;
+    return true;
+}
+
+bool MOTION_IRAM step_stream_next_dir_symbol(step_stream_t &stream, size_t index, step_symbol_t &symbol) {
+    step_stream_axis_t &axis = stream.axes[index];
+    step_symbol_t step;
+    if (!read_history(stream, index, axis.dir_read, step)) {
+        return false;
+    }
+    const bool negative = step.level0;
+    step.level0 = 0;
+    symbol = motion_timing::dir_symbol(step, axis.dir_level, negative);
+    axis.dir_level = negative;
+    return true;
+}
+
+bool step_stream_drained(const step_stream_t &stream, uint32_t idle_symbols) {
+    const uint32_t head = stream.ring.write_index();
+    for (size_t i = 0; i < stream.axis_count; i++) {
+        const step_stream_axis_t &axis = stream.axes[i];
+        const uint32_t unread = stream.paired ? std::max(axis.generated - axis.step_read, axis.generated - axis.dir_read) : 0;
+        if (axis.cursor != head || axis.in_block || axis.idle_symbols < idle_symbols + unread) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,147 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "motion_block.h"
+#include "spsc_ring.h"
+#include "step_ramp.h"
+#include "step_timing.h"
+
+// Continuous multi-axis step stream fed from a ring of motion blocks.
+//
+// Every axis walks the same blocks on its own RMT channel. Each one replays the
+// lead axis period sequence and distributes its own steps over it
+// (Bresenham), so all axes spend exactly the same number of ticks on a block
+// and stay in lockstep for as long as the stream runs. When the ring runs dry
+// the axes pad with idle time; the next block is then stamped with a common
+// start tick so they pick it up together again. Once the lead cruises its
+// period no longer changes, and an axis takes the lead steps up to its own
+// next step (or the next filler symbol) in one go instead of one by one.
+//
+// A stream can also drive the direction pins from RMT channels of their own.
+// The symbols of an axis are then generated once into a short history that
+// the step and the direction channel read at their own pace; the direction
+// symbols span exactly the same ticks, so a reversal is an edge placed
+// DIR_SETUP_TICKS before the first step of the new direction, with no stop.
+//
+// Realtime overrides (step_stream_override) scale the planned speed of the
+// blocks already in the ring without replanning them. Each axis limits its
+// own speed to the scaled ramp, changing it at the block's acceleration, and
+// a hold brings it to rest the same way and pads idle time from there. An
+// override takes effect on every axis at the same timeline tick, the
+// furthest any of them has generated, so the axes stay in lockstep.
+//
+// Every step an axis generates is counted into its tally, which survives
+// stream resets: the signed position and the speed at that step. The tally
+// leads the pins by whatever sits in the RMT RAM; the owner corrects for
+// that with the steps the driver has actually seen (motion_engine.h).
+//
+// Pure C++, no ESP-IDF: step_stream_next_symbol() is called from the RMT
+// encoder with the caller holding the stream lock.
+
+constexpr size_t MOTION_RING_BLOCKS = 64;
+// Symbols one channel of an axis may run ahead of the other, a power of two.
+// Bounded by one channel RAM plus its staging half and the start skew.
+constexpr size_t STEP_HISTORY_SYMBOLS = 256;
+using motion_ring_t = spsc_ring<motion_block_t, MOTION_RING_BLOCKS>;
+// Overrides waiting for the slowest axis, a power of two.
+constexpr size_t OVERRIDE_EVENTS = 8;
+
+// Q16.16 scales of the planned speed by block class (motion_block_t::override).
+// At most Q16_ONE: the queued blocks were planned for full speed, so only
+// slowing down keeps their accelerations and junctions within limits.
+struct step_override_t {
+    uint32_t feed_scale;
+    uint32_t rapid_scale;
+    bool hold;            // decelerate to rest and stay there
+};
+inline constexpr step_override_t STEP_OVERRIDE_NONE = {Q16_ONE, Q16_ONE, false};
+
+// Steps of one axis as generated. Written by the encoder under the stream
+// lock; the atomics can be read from any task without it, the lock gives a
+// consistent set.
+struct step_stream_tally_t {
+    std::atomic<int32_t> position;  // signed steps generated
+    std::atomic<uint32_t> steps;    // unsigned steps generated, wraps
+    std::atomic<int32_t> velocity;  // signed steps/s at the last step, 0 at rest
+    bool negative;                  // direction of the last step
+    uint32_t reversal_steps;        // `steps` when `negative` last changed
+    int32_t reversal_position;      // `position` then
+};
+
+struct step_stream_axis_t {
+    uint32_t cursor;        // ring index of the block being walked
+    bool in_block;
+    uint8_t phase;          // 0 accel + cruise, 1 decel
+    ramp_state_t lead;
+    const accel_table_t *lead_table; // table of the block's lead axis, may be null
+    uint32_t lead_step;
+    bresenham_t distribution;
+    uint64_t pending_ticks; // low time not yet turned into symbols
+    bool pending_step;      // pending_ticks ends with a step pulse
+    uint64_t time;          // timeline position at the end of pending_ticks
+    uint32_t idle_symbols;  // idle symbols since the last block
+    uint32_t refills;       // chunks the encoder has handed to the RMT RAM
+    bool negative;          // direction of the axis' current or next steps
+    uint32_t rate_ratio;    // Q16 own steps per lead step of the block
+
+    step_override_t override;
+    uint32_t override_read; // override events taken
+    bool limited;           // speed follows `speed` instead of the ramp
+    uint32_t speed;         // Q16.16 steps/s at the last step boundary, while limited
+    uint32_t speed_frac;    // sub-tick remainder of the limited periods
+
+    // paired streams only
+    uint32_t generated;     // symbols put in `history`
+    uint32_t step_read;     // next history symbol of the step channel
+    uint32_t dir_read;      // next history symbol of the direction channel
+    bool dir_level;         // level the direction channel has reached
+    step_symbol_t history[STEP_HISTORY_SYMBOLS]; // level0 holds the direction
+};
+
+struct step_stream_t {
+    motion_ring_t ring;
+
+    // consumer side, only touched under the stream lock
+    size_t axis_count;
+    bool paired;            // direction channels read the stream too
+    const accel_table_t *tables[AXIS_COUNT]; // set once by the owner, kept over resets
+    step_stream_tally_t tallies[AXIS_COUNT]; // kept over resets
+    step_stream_axis_t axes[AXIS_COUNT];
+    uint32_t stamped;       // blocks below this index have a start tick
+    uint32_t finished;      // blocks below this index have been walked by some axis
+    uint64_t block_start[MOTION_RING_BLOCKS];
+    uint64_t last_end;      // end tick of block finished - 1
+    uint32_t last_exit_rate;
+    uint32_t starved_at;    // finished count the last underrun was counted for
+    step_override_t override_events[OVERRIDE_EVENTS];
+    uint64_t override_at[OVERRIDE_EVENTS]; // timeline tick each event applies from
+    uint32_t override_head; // override events pushed
+
+    std::atomic<uint32_t> underruns;
+    std::atomic<bool> stop;
+};
+
+void step_stream_reset(step_stream_t &stream, size_t axis_count, bool paired);
+
+// Apply `override` to every axis from the furthest tick any of them has
+// generated. Caller holds the stream lock. False if OVERRIDE_EVENTS are still
+// waiting for an axis and the newest of them has already been taken.
+bool step_stream_override(step_stream_t &stream, const step_override_t &override);
+
+// Restart the tally of `axis` at `position`, e.g. after homing, with the
+// stream drained. Caller holds the stream lock.
+void step_stream_set_position(step_stream_t &stream, size_t axis, int32_t position);
+
+// Next RMT symbol for the step pin of `axis`. Returns false once stop is set
+// and the axis has nothing left to send.
+bool step_stream_next_symbol(step_stream_t &stream, size_t axis, step_symbol_t &symbol);
+
+// Next RMT symbol for the direction pin of `axis`, high while it moves in the
+// negative direction. Paired streams only.
+bool step_stream_next_dir_symbol(step_stream_t &stream, size_t axis, step_symbol_t &symbol);
+
+// True when the ring is empty and every axis has been idle for at least
+// `idle_symbols` symbols, i.e. the last block has left the RMT RAM too. Counts
+// the symbols both channels of a paired axis have read.
+bool step_stream_drained(const step_stream_t &stream, uint32_t idle_symbols);
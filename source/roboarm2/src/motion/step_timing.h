@@ -0,0 +1,187 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <array>
+#include "roboarm_config.h"
+#include "motion_iram.h"
+
+// Compile-time step timing for a fixed RMT tick rate. Everything the encoders
+// need per step is integer math on constants of the instance: Q16.16 periods,
+// symbol splitting for the 15-bit duration fields, direction edges and
+// Bresenham distribution. Pure C++, no ESP-IDF, safe in ISR context (no FPU).
+
+// Bit layout of rmt_symbol_word_t.
+union step_symbol_t {
+    struct {
+        uint16_t duration0 : 15;
+        uint16_t level0 : 1;
+        uint16_t duration1 : 15;
+        uint16_t level1 : 1;
+    };
+    uint32_t val;
+};
+static_assert(sizeof(step_symbol_t) == 4, "step_symbol_t must be one RMT word");
+
+constexpr uint32_t Q16_ONE = 1u << 16;
+
+static constexpr uint32_t q16_from_int(uint32_t value) { return value << 16; }
+static constexpr uint32_t q16_mul(uint32_t a, uint32_t b) { return static_cast<uint32_t>(static_cast<uint64_t>(a) * b >> 16); }
+static constexpr uint32_t q16_div(uint32_t a, uint32_t b) { return static_cast<uint32_t>((static_cast<uint64_t>(a) << 16) / b); }
+
+MOTION_INLINE constexpr uint32_t isqrt64(uint64_t value) {
+    uint64_t result = 0;
+    uint64_t bit = 1ull << 62;
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (value >= result + bit) {
+            value -= result + bit;
+            result = (result >> 1) + bit;
+        } else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+    return static_cast<uint32_t>(result);
+}
+
+// PULSE_US is the width of the step pulse, 0 for half the period.
+// DIR_DELAY_US is the extra direction setup time before the first step after a
+// reversal, on top of a 1 us minimum every driver needs.
+template<uint32_t TICKS, uint32_t PULSE_US = 0, uint32_t DIR_DELAY_US = 0, uint32_t DURATION_BITS = 15>
+struct step_timing {
+    static constexpr uint32_t TICKS_PER_S = TICKS;
+    static constexpr uint32_t HALF_MAX = (1u << DURATION_BITS) - 1;
+    // longest symbol, both halves full
+    static constexpr uint32_t SYMBOL_MAX = 2 * HALF_MAX;
+    static constexpr uint32_t PULSE_TICKS = static_cast<uint32_t>(static_cast<uint64_t>(TICKS) * PULSE_US / 1000000);
+    static constexpr uint32_t DIR_SETUP_TICKS =
+        static_cast<uint32_t>(static_cast<uint64_t>(TICKS) * (DIR_DELAY_US + 1) / 1000000);
+    // longest symbol ending in a step; a fixed pulse leaves the rest to the low half
+    static constexpr uint32_t STEP_SYMBOL_MAX = PULSE_TICKS ? HALF_MAX + PULSE_TICKS : SYMBOL_MAX;
+    // both halves must be at least one tick, a zero duration ends the transmission
+    static constexpr uint32_t MIN_PERIOD = 2;
+    // 250 us of idle padding per symbol. Bounds how late a new block can
+    // start and how long a finished stream takes to report drained.
+    static constexpr uint32_t IDLE_QUANTUM = TICKS / 4000 < SYMBOL_MAX ? TICKS / 4000 : SYMBOL_MAX;
+    // slowest rate whose period still fits one symbol
+    static constexpr uint32_t MIN_SINGLE_SYMBOL_RATE = (TICKS + SYMBOL_MAX - 1) / SYMBOL_MAX;
+    static constexpr uint32_t MAX_RATE = TICKS / MIN_PERIOD;
+
+    static_assert(TICKS >= 1000 && DURATION_BITS <= 15, "unsupported step timing");
+    static_assert(PULSE_TICKS < HALF_MAX && DIR_SETUP_TICKS < HALF_MAX, "step pulse or direction setup too long");
+    // numerator of period_q16() must not overflow
+    static_assert((static_cast<uint64_t>(TICKS) << 33 >> 33) == TICKS, "tick rate too high for Q16.16 periods");
+
+    // Q16.16 ticks per step for an average of (v_prev + v_next) / 2, both
+    // Q16.16 steps/s. Exact for constant acceleration.
+    static constexpr uint64_t period_q16(uint64_t v_sum_q16) { return (static_cast<uint64_t>(TICKS) << 33) / v_sum_q16; }
+
+    // Whole ticks per step at a constant rate (steps/s).
+    static constexpr uint32_t period_ticks(uint32_t rate) { return rate ? (TICKS + rate / 2) / rate : UINT32_MAX; }
+
+    // Add a Q16.16 period to the carried fraction, return whole ticks.
+    static constexpr uint32_t take_ticks(uint64_t period_q16, uint32_t &frac) {
+        const uint64_t total = period_q16 + frac;
+        frac = static_cast<uint32_t>(total & 0xffff);
+        const uint64_t ticks = total >> 16;
+        return ticks > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(ticks);
+    }
+
+    // Symbols needed for `ticks` of low time ending in one step.
+    static constexpr uint32_t symbols_for(uint64_t ticks) {
+        return ticks <= STEP_SYMBOL_MAX ? 1 : static_cast<uint32_t>((ticks - MIN_PERIOD + SYMBOL_MAX - 1) / SYMBOL_MAX) + 1;
+    }
+
+    // Ticks to send as a low filler symbol before `pending` fits one symbol,
+    // always leaving at least MIN_PERIOD for the symbol that follows. 0 once
+    // `pending` fits.
+    static constexpr uint32_t split(uint64_t pending) {
+        if (pending <= STEP_SYMBOL_MAX) {
+            return 0;
+        }
+        const uint64_t chunk = pending - MIN_PERIOD;
+        return chunk > SYMBOL_MAX ? SYMBOL_MAX : static_cast<uint32_t>(chunk);
+    }
+
+    // Symbol of `ticks` (<= STEP_SYMBOL_MAX with a step, else SYMBOL_MAX), low
+    // first, the second half high for PULSE_TICKS if it carries a step.
+    static constexpr step_symbol_t symbol(uint32_t ticks, bool step) {
+        step_symbol_t out = {};
+        const uint32_t second = step && PULSE_TICKS && PULSE_TICKS < ticks / 2 ? PULSE_TICKS : ticks / 2;
+        out.level0 = 0;
+        out.duration0 = ticks - second;
+        out.level1 = step ? 1 : 0;
+        out.duration1 = second;
+        return out;
+    }
+
+    // Direction pin level over the time of `step`, a symbol of the step pin.
+    // When it changes from `from` to `to` the edge goes DIR_SETUP_TICKS before
+    // the symbol's step edge, or as early as the duration fields allow.
+    static constexpr step_symbol_t dir_symbol(step_symbol_t step, bool from, bool to) {
+        step_symbol_t out = {};
+        const uint32_t total = step.duration0 + step.duration1;
+        uint32_t first = step.duration0;
+        if (from != to) {
+            first = first > DIR_SETUP_TICKS ? first - DIR_SETUP_TICKS : 1;
+            first = total - first > HALF_MAX ? total - HALF_MAX : first;
+        }
+        out.level0 = from;
+        out.duration0 = first;
+        out.level1 = to;
+        out.duration1 = total - first;
+        return out;
+    }
+
+    // Q16.16 speeds at the end of the first N steps from rest at a constant
+    // `accel` (steps/s^2), v^2 = 2 a k. Replaces the square root per step;
+    // periods follow from period_q16(v[k - 1] + v[k]).
+    template<size_t N>
+    static constexpr std::array<uint32_t, N> accel_speed_table(uint32_t accel) {
+        std::array<uint32_t, N> table = {};
+        for (size_t k = 0; k < N; k++) {
+            table[k] = isqrt64((2ull * accel * (k + 1)) << 32);
+        }
+        return table;
+    }
+};
+
+// Distributes `steps` over `lead` lead-axis steps; the lead axis itself steps
+// every time. Starting at half the lead centres the minor steps.
+struct bresenham_t {
+    uint32_t error;
+
+    constexpr void begin(uint32_t lead) { error = lead / 2; }
+    constexpr bool step(uint32_t steps, uint32_t lead) {
+        error += steps;
+        if (error >= lead) {
+            error -= lead;
+            return true;
+        }
+        return false;
+    }
+    // Lead steps up to and including the next one that steps, steps > 0.
+    constexpr uint32_t until_step(uint32_t steps, uint32_t lead) const { return (lead - error - 1) / steps + 1; }
+    // `count` lead steps at once, at most until_step(): true if the last steps.
+    constexpr bool skip(uint32_t steps, uint32_t lead, uint32_t count) {
+        const uint64_t error64 = error + static_cast<uint64_t>(steps) * count;
+        if (error64 >= lead) {
+            error = static_cast<uint32_t>(error64 - lead);
+            return true;
+        }
+        error = static_cast<uint32_t>(error64);
+        return false;
+    }
+};
+
+// Timing of the firmware's RMT channels.
+using motion_timing = step_timing<ROBOARM_TICKS_PER_S, ROBOARM_PULSE_US, ROBOARM_DIR_DELAY_US>;
+
+static_assert(motion_timing::symbol(5, true).duration0 == 3 && motion_timing::symbol(5, true).duration1 == 2);
+static_assert(step_timing<1000000, 4>::symbol(100, true).duration0 == 96 && step_timing<1000000, 4>::symbol(100, true).duration1 == 4);
+static_assert(step_timing<1000000>::dir_symbol(step_timing<1000000>::symbol(10, true), false, true).duration0 == 4);
+static_assert(motion_timing::split(motion_timing::SYMBOL_MAX + 1) == motion_timing::SYMBOL_MAX - 1);
+static_assert(motion_timing::accel_speed_table<2>(4)[1] == 4u << 16);
+static_assert(bresenham_t{5}.until_step(3, 10) == 2 && bresenham_t{9}.until_step(10, 10) == 1);
@@ -0,0 +1,130 @@
+#include "stepper_encoder.h"
+#include <stdlib.h>
+#include <string.h>
+#include <esp_check.h>
+
+static const char *TAG = "stepper_encoder";
+
+struct rmt_stepper_encoder_t {
+    rmt_encoder_t base;
+    rmt_encoder_handle_t copy_encoder;
+    size_t segment;         // index into the stepper_ramp_t payload
+    bool segment_started;
+    ramp_state_t ramp;
+    uint64_t pending_ticks; // ticks of the current step not yet turned into symbols
+    bool have_symbol;
+    rmt_symbol_word_t symbol;
+};
+
+static inline void add_state(rmt_encode_state_t *state, rmt_encode_state_t flag) {
+    *state = static_cast<rmt_encode_state_t>(*state | flag);
+}
+
+// Produce the next symbol of the step train. Periods that do not fit one
+// symbol are emitted as low filler symbols followed by the step itself.
+// Returns false once every segment is exhausted.
+static bool next_symbol(rmt_stepper_encoder_t *enc, const stepper_ramp_t *ramps, size_t count) {
+    if (enc->pending_ticks == 0) {
+        while (enc->segment < count) {
+            if (!enc->segment_started) {
+                ramp_begin(enc->ramp, ramps[enc->segment]);
+                enc->segment_started = true;
+            }
+            if (!ramp_done(enc->ramp)) {
+                break;
+            }
+            enc->segment++;
+            enc->segment_started = false;
+        }
+        if (enc->segment >= count) {
+            return false;
+        }
+        enc->pending_ticks = ramp_next_period(enc->ramp);
+        if (enc->pending_ticks < motion_timing::MIN_PERIOD) {
+            enc->pending_ticks = motion_timing::MIN_PERIOD;
+        }
+    }
+
+    step_symbol_t symbol;
+    if (const uint32_t chunk = motion_timing::split(enc->pending_ticks)) {
+        symbol = motion_timing::symbol(chunk, false);
+        enc->pending_ticks -= chunk;
+    } else {
+        symbol = motion_timing::symbol(static_cast<uint32_t>(enc->pending_ticks), true);
+        enc->pending_ticks = 0;
+    }
+    memcpy(&enc->symbol, &symbol, sizeof(symbol));
+    return true;
+}
+
+static size_t rmt_encode_stepper(rmt_encoder_t *encoder, rmt_channel_handle_t channel,
+                                 const void *primary_data, size_t data_size, rmt_encode_state_t *ret_state) {
+    rmt_stepper_encoder_t *enc = __containerof(encoder, rmt_stepper_encoder_t, base);
+    const stepper_ramp_t *ramps = static_cast<const stepper_ramp_t *>(primary_data);
+    const size_t count = data_size / sizeof(stepper_ramp_t);
+    rmt_encode_state_t state = RMT_ENCODING_RESET;
+    size_t encoded_symbols = 0;
+
+    while (true) {
+        if (!enc->have_symbol) {
+            if (!next_symbol(enc, ramps, count)) {
+                enc->segment = 0;
+                enc->segment_started = false;
+                add_state(&state, RMT_ENCODING_COMPLETE);
+                break;
+            }
+            enc->have_symbol = true;
+        }
+        rmt_encode_state_t copy_state = RMT_ENCODING_RESET;
+        encoded_symbols += enc->copy_encoder->encode(enc->copy_encoder, channel, &enc->symbol,
+                                                     sizeof(enc->symbol), &copy_state);
+        if (copy_state & RMT_ENCODING_COMPLETE) {
+            enc->have_symbol = false;
+        }
+        if (copy_state & RMT_ENCODING_MEM_FULL) {
+            add_state(&state, RMT_ENCODING_MEM_FULL);
+            break;
+        }
+    }
+    *ret_state = state;
+    return encoded_symbols;
+}
+
+static esp_err_t rmt_stepper_encoder_reset(rmt_encoder_t *encoder) {
+    rmt_stepper_encoder_t *enc = __containerof(encoder, rmt_stepper_encoder_t, base);
+    rmt_encoder_reset(enc->copy_encoder);
+    enc->segment = 0;
+    enc->segment_started = false;
+    enc->pending_ticks = 0;
+    enc->have_symbol = false;
+    return ESP_OK;
+}
+
+static esp_err_t rmt_del_stepper_encoder(rmt_encoder_t *encoder) {
+    rmt_stepper_encoder_t *enc = __containerof(encoder, rmt_stepper_encoder_t, base);
+    rmt_del_encoder(enc->copy_encoder);
+    free(enc);
+    return ESP_OK;
+}
+
+esp_err_t rmt_new_stepper_encoder(const stepper_encoder_config_t *config, rmt_encoder_handle_t *ret_encoder) {
+    ESP_RETURN_ON_FALSE(config && ret_encoder, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(config->resolution == motion_timing::TICKS_PER_S, ESP_ERR_INVALID_ARG, TAG,
+                        "resolution must be ROBOARM_TICKS_PER_S");
+    rmt_stepper_encoder_t *enc = static_cast<rmt_stepper_encoder_t *>(rmt_alloc_encoder_mem(sizeof(rmt_stepper_encoder_t)));
+    ESP_RETURN_ON_FALSE(enc, ESP_ERR_NO_MEM, TAG, "no mem for stepper encoder");
+    *enc = {};
+    enc->base.encode = rmt_encode_stepper;
+    enc->base.reset = rmt_stepper_encoder_reset;
+    enc->base.del = rmt_del_stepper_encoder;
+
+    rmt_copy_encoder_config_t copy_encoder_config = {};
+    esp_err_t ret = rmt_new_copy_encoder(&copy_encoder_config, &enc->copy_encoder);
+    if (ret != ESP_OK) {
+        free(enc);
+        ESP_LOGE(TAG, "create copy encoder failed");
+        return ret;
+    }
+    *ret_encoder = &enc->base;
+    return ESP_OK;
+}
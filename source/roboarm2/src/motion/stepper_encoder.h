@@ -0,0 +1,16 @@
+#pragma once
+#include <driver/rmt_encoder.h>
+#include "step_ramp.h"
+
+// RMT encoder that turns an array of stepper_ramp_t into step pulses. Periods
+// are generated symbol by symbol from inside the RMT driver, so a full move
+// (accel, cruise, decel) is a single rmt_transmit() with loop_count = 0.
+//
+//     stepper_ramp_t move[3] = {...};
+//     rmt_transmit(chan, encoder, move, sizeof(move), &tx_config);
+
+struct stepper_encoder_config_t {
+    uint32_t resolution; // channel resolution_hz, must be motion_timing::TICKS_PER_S
+};
+
+esp_err_t rmt_new_stepper_encoder(const stepper_encoder_config_t *config, rmt_encoder_handle_t *ret_encoder);
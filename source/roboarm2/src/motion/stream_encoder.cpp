@@ -0,0 +1,149 @@
+#include "stream_encoder.h"
+#include <stdlib.h>
+#include <string.h>
+#include <esp_check.h>
+#include "diag/instrumentation.h"
+#include "motion_iram.h"
+
+static const char *TAG = "stream_encoder";
+
+static_assert(sizeof(step_symbol_t) == sizeof(rmt_symbol_word_t), "step_symbol_t must match rmt_symbol_word_t");
+
+struct rmt_stream_encoder_t {
+    rmt_encoder_t base;
+    rmt_encoder_handle_t copy_encoder;
+    step_stream_t *stream;
+    size_t axis;
+    portMUX_TYPE *lock;
+    size_t chunk_symbols;
+    bool direction;
+    size_t staged;          // symbols in `staging` not yet fully copied
+    bool last_chunk;        // the stream ended while filling `staging`
+    rmt_symbol_word_t *staging;
+};
+
+// Pull up to chunk_symbols from the stream into the staging buffer.
+static void MOTION_IRAM fill_staging(rmt_stream_encoder_t *enc) {
+#if ROBOARM_INSTRUMENTATION
+    const uint32_t underruns = enc->stream->underruns.load(std::memory_order_relaxed);
+#endif
+    uint32_t ticks = 0;
+    enc->staged = 0;
+    while (enc->staged < enc->chunk_symbols) {
+        step_symbol_t symbol;
+        portENTER_CRITICAL_SAFE(enc->lock);
+        const bool more = enc->direction ? step_stream_next_dir_symbol(*enc->stream, enc->axis, symbol)
+                                         : step_stream_next_symbol(*enc->stream, enc->axis, symbol);
+        portEXIT_CRITICAL_SAFE(enc->lock);
+        if (!more) {
+            enc->last_chunk = true;
+            break;
+        }
+        ticks += symbol.duration0 + symbol.duration1;
+        memcpy(&enc->staging[enc->staged++], &symbol, sizeof(symbol));
+    }
+    if (enc->direction) {
+        return;
+    }
+    portENTER_CRITICAL_SAFE(enc->lock);
+    enc->stream->axes[enc->axis].refills++;
+    portEXIT_CRITICAL_SAFE(enc->lock);
+    instr_refill_chunk(enc->axis, ticks);
+#if ROBOARM_INSTRUMENTATION
+    if (enc->stream->underruns.load(std::memory_order_relaxed) != underruns) {
+        instr_underrun(enc->axis);
+    }
+#endif
+}
+
+// The driver calls this each time half of the channel RAM has been sent, so
+// symbols go to the copy encoder in half-block chunks rather than one by one.
+static size_t MOTION_IRAM rmt_encode_stream(rmt_encoder_t *encoder, rmt_channel_handle_t channel,
+                                const void *primary_data, size_t data_size, rmt_encode_state_t *ret_state) {
+    rmt_stream_encoder_t *enc = __containerof(encoder, rmt_stream_encoder_t, base);
+    rmt_encode_state_t state = RMT_ENCODING_RESET;
+    size_t encoded_symbols = 0;
+    const uint32_t entry = instr_cycles();
+    if (!enc->direction) {
+        instr_refill_begin(enc->axis, entry);
+    }
+#if ROBOARM_INSTRUMENTATION
+    if (enc->axis == 0 && !enc->direction) {
+        instr_record(INSTR_RING_LEVEL, enc->stream->ring.size());
+    }
+#endif
+
+    while (true) {
+        if (enc->staged == 0) {
+            if (enc->last_chunk) {
+                state = static_cast<rmt_encode_state_t>(state | RMT_ENCODING_COMPLETE);
+                break;
+            }
+            fill_staging(enc);
+            if (enc->staged == 0) {
+                continue;
+            }
+        }
+        rmt_encode_state_t copy_state = RMT_ENCODING_RESET;
+        encoded_symbols += enc->copy_encoder->encode(enc->copy_encoder, channel, enc->staging,
+                                                     enc->staged * sizeof(rmt_symbol_word_t), &copy_state);
+        if (copy_state & RMT_ENCODING_COMPLETE) {
+            enc->staged = 0;
+        }
+        if (copy_state & RMT_ENCODING_MEM_FULL) {
+            state = static_cast<rmt_encode_state_t>(state | RMT_ENCODING_MEM_FULL);
+            break;
+        }
+    }
+    *ret_state = state;
+    if (!enc->direction) {
+        instr_record(INSTR_ENCODE_CYCLES, instr_cycles() - entry);
+    }
+    return encoded_symbols;
+}
+
+static esp_err_t MOTION_IRAM rmt_stream_encoder_reset(rmt_encoder_t *encoder) {
+    rmt_stream_encoder_t *enc = __containerof(encoder, rmt_stream_encoder_t, base);
+    rmt_encoder_reset(enc->copy_encoder);
+    enc->staged = 0;
+    enc->last_chunk = false;
+    if (!enc->direction) {
+        instr_refill_reset(enc->axis);
+    }
+    return ESP_OK;
+}
+
+static esp_err_t rmt_del_stream_encoder(rmt_encoder_t *encoder) {
+    rmt_stream_encoder_t *enc = __containerof(encoder, rmt_stream_encoder_t, base);
+    rmt_del_encoder(enc->copy_encoder);
+    free(enc);
+    return ESP_OK;
+}
+
+esp_err_t rmt_new_stream_encoder(const stream_encoder_config_t *config, rmt_encoder_handle_t *ret_encoder) {
+    ESP_RETURN_ON_FALSE(config && ret_encoder && config->stream && config->lock && config->axis < AXIS_COUNT &&
+                        config->staging && config->chunk_symbols,
+                        ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    rmt_stream_encoder_t *enc = static_cast<rmt_stream_encoder_t *>(rmt_alloc_encoder_mem(sizeof(rmt_stream_encoder_t)));
+    ESP_RETURN_ON_FALSE(enc, ESP_ERR_NO_MEM, TAG, "no mem for stream encoder");
+    *enc = {};
+    enc->base.encode = rmt_encode_stream;
+    enc->base.reset = rmt_stream_encoder_reset;
+    enc->base.del = rmt_del_stream_encoder;
+    enc->stream = config->stream;
+    enc->axis = config->axis;
+    enc->lock = config->lock;
+    enc->staging = config->staging;
+    enc->chunk_symbols = config->chunk_symbols;
+    enc->direction = config->direction;
+
+    rmt_copy_encoder_config_t copy_encoder_config = {};
+    esp_err_t ret = rmt_new_copy_encoder(&copy_encoder_config, &enc->copy_encoder);
+    if (ret != ESP_OK) {
+        free(enc);
+        ESP_LOGE(TAG, "create copy encoder failed");
+        return ret;
+    }
+    *ret_encoder = &enc->base;
+    return ESP_OK;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <driver/rmt_encoder.h>
+#include <freertos/FreeRTOS.h>
+#include "step_stream.h"
+
+// RMT encoder for one axis of a step_stream_t. The transaction never completes
+// on its own: the encoder keeps draining the motion ring (padding with idle
+// time when it is empty) until stream->stop is set. The payload passed to
+// rmt_transmit() is not used.
+//
+// Symbols are generated into a staging buffer of chunk_symbols, supplied by
+// the caller in internal RAM, and copied to the channel RAM in one go; use
+// half of the channel's mem_block_symbols so each ping-pong refill is a
+// single copy.
+//
+// With `direction` set the encoder sends the axis' direction pin instead
+// (step_stream_next_dir_symbol), for a paired stream.
+
+struct stream_encoder_config_t {
+    step_stream_t *stream;
+    size_t axis;
+    portMUX_TYPE *lock;          // shared by every encoder of the stream
+    rmt_symbol_word_t *staging;  // chunk_symbols long, kept for the encoder's lifetime
+    size_t chunk_symbols;        // staging buffer size
+    bool direction;              // direction channel of the axis
+};
+
+esp_err_t rmt_new_stream_encoder(const stream_encoder_config_t *config, rmt_encoder_handle_t *ret_encoder);
@@ -0,0 +1,109 @@
+#pragma once
+
+// Build-time sizing of the firmware. Override from platformio.ini
+// build_flags, e.g. -DROBOARM_PLANNER_BLOCKS=256.
+
+// RMT tick rate of the step channels. The step timing math is specialised on
+// it at compile time.
+#ifndef ROBOARM_TICKS_PER_S
+#define ROBOARM_TICKS_PER_S 16000000
+#endif
+
+// Axis table compiled in (motion/axis_config.h): 0 config_xyza.yaml,
+// 1 config_xyza_lpf.yaml.
+#ifndef ROBOARM_AXES_VARIANT
+#define ROBOARM_AXES_VARIANT 0
+#endif
+
+// Step pulse width and the direction setup time beyond 1 us (stepping:
+// pulse_us and dir_delay_us of config_xyza.yaml).
+#ifndef ROBOARM_PULSE_US
+#define ROBOARM_PULSE_US 4
+#endif
+#ifndef ROBOARM_DIR_DELAY_US
+#define ROBOARM_DIR_DELAY_US 0
+#endif
+
+// Interrupt level of the RMT step channels. 3 is the highest level the ESP32
+// allows for C handlers; it keeps the refills ahead of UART and timer work.
+#ifndef ROBOARM_RMT_INTR_PRIORITY
+#define ROBOARM_RMT_INTR_PRIORITY 3
+#endif
+
+// Look-ahead depth of the planner, in blocks.
+#ifndef ROBOARM_PLANNER_BLOCKS
+#define ROBOARM_PLANNER_BLOCKS 128
+#endif
+static_assert(ROBOARM_PLANNER_BLOCKS >= 64 && ROBOARM_PLANNER_BLOCKS <= 256, "ROBOARM_PLANNER_BLOCKS must be 64..256");
+
+// Blocks kept queued for the step encoders; everything else stays in the
+// planner where its speeds can still be raised.
+#ifndef ROBOARM_PLANNER_COMMIT_BLOCKS
+#define ROBOARM_PLANNER_COMMIT_BLOCKS 8
+#endif
+
+// Entries per axis in the ramp speed tables (4 bytes each, internal RAM).
+// 0 disables the tables and every ramp step takes a square root.
+#ifndef ROBOARM_ACCEL_TABLE_ENTRIES
+#define ROBOARM_ACCEL_TABLE_ENTRIES 1024
+#endif
+
+// Host link (link/serial_link.h). The devkit's USB port is the bridge on UART0.
+#ifndef ROBOARM_LINK_UART
+#define ROBOARM_LINK_UART 0
+#endif
+#ifndef ROBOARM_LINK_BAUD
+#define ROBOARM_LINK_BAUD 921600
+#endif
+// Moves received but not yet in the planner; also the host's credit.
+#ifndef ROBOARM_LINK_MOVE_QUEUE
+#define ROBOARM_LINK_MOVE_QUEUE 32
+#endif
+// Telemetry samples per second from boot (link/telemetry.h): 0 for none until
+// `$TEL=<hz>`, else 100..1000.
+#ifndef ROBOARM_TELEMETRY_HZ
+#define ROBOARM_TELEMETRY_HZ 0
+#endif
+// Each of the two read-ahead buffers of a stored job (link/job_spool.h).
+#ifndef ROBOARM_JOB_BUFFER_BYTES
+#define ROBOARM_JOB_BUFFER_BYTES 4096
+#endif
+
+// Static memory regions (arena.h), in bytes. The defaults fit the settings
+// above for four axes; every user checks its share at compile time or logs
+// the shortfall at boot, and `$MEM` shows how much each region ever used.
+#ifndef ROBOARM_ARENA_PLANNER_BYTES
+#define ROBOARM_ARENA_PLANNER_BYTES ((ROBOARM_PLANNER_BLOCKS + ROBOARM_PLANNER_COMMIT_BLOCKS) * 48 + 512)
+#endif
+#ifndef ROBOARM_ARENA_RMT_BYTES
+#define ROBOARM_ARENA_RMT_BYTES (4 * 4 * ROBOARM_ACCEL_TABLE_ENTRIES + 12288)
+#endif
+#ifndef ROBOARM_ARENA_LINK_BYTES
+#define ROBOARM_ARENA_LINK_BYTES (ROBOARM_LINK_MOVE_QUEUE * 128 + 256)
+#endif
+#ifndef ROBOARM_ARENA_JOB_BYTES
+#define ROBOARM_ARENA_JOB_BYTES (2 * ROBOARM_JOB_BUFFER_BYTES + 256)
+#endif
+
+// Attempts per homing cycle (machine/homing.h) before alarms 8 and 9 stick.
+#ifndef ROBOARM_HOMING_TRIES
+#define ROBOARM_HOMING_TRIES 5
+#endif
+
+// Step path timing histograms (diag/instrumentation.h), dumped by `$STATS`.
+#ifndef ROBOARM_INSTRUMENTATION
+#define ROBOARM_INSTRUMENTATION 0
+#endif
+
+#ifndef ROBOARM_ARENA_INSTR_BYTES
+#define ROBOARM_ARENA_INSTR_BYTES (ROBOARM_INSTRUMENTATION ? 1024 : 0)
+#endif
+
+// Benchmark build (bench/step_bench.h) instead of the firmware tasks.
+#ifndef ROBOARM_BENCHMARK
+#define ROBOARM_BENCHMARK 0
+#endif
+// RX pin jumpered to the X step pin; -1 captures on the step pin itself.
+#ifndef ROBOARM_BENCH_RX_GPIO
+#define ROBOARM_BENCH_RX_GPIO -1
+#endif
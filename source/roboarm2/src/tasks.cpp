@@ -0,0 +1,281 @@
+#include "tasks.h"
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <atomic>
+#include <esp_log.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include "arena.h"
+#include "motion/kinematics.h"
+#include "motion/motion_engine.h"
+#include "motion/planner.h"
+#include "link/job_spool.h"
+#include "link/serial_link.h"
+#include "link/telemetry.h"
+#include "machine/homing.h"
+#include "machine/machine_state.h"
+
+static const char *TAG = "tasks";
+
+// Planner lines end at rest once no new move has arrived for this long.
+constexpr TickType_t PLANNER_IDLE_FLUSH = pdMS_TO_TICKS(50);
+constexpr TickType_t STATUS_CHECK_PERIOD = pdMS_TO_TICKS(10);
+// Longest joint segment of a tool-space line, however straight the joints run.
+constexpr float KIN_MAX_SEGMENT_MM = 5.0f;
+// The status task looks at the heap this often.
+constexpr uint32_t HEAP_CHECK_EVERY = 100;
+
+static_assert(sizeof(planner_t) + ROBOARM_PLANNER_COMMIT_BLOCKS * sizeof(motion_block_t) + sizeof(StaticQueue_t) + 16 <=
+                  ROBOARM_ARENA_PLANNER_BYTES,
+              "ROBOARM_ARENA_PLANNER_BYTES too small for the planner");
+static_assert(ROBOARM_LINK_MOVE_QUEUE * sizeof(link_move_command_t) + sizeof(StaticQueue_t) + 16 <= ROBOARM_ARENA_LINK_BYTES,
+              "ROBOARM_ARENA_LINK_BYTES too small for the move queue");
+
+static planner_t *s_planner;          // in ARENA_PLANNER
+static QueueHandle_t s_moves;         // link -> planner, link_move_command_t
+static QueueHandle_t s_blocks;        // planner -> feeder, motion_block_t
+static std::atomic<uint32_t> s_blocks_in_flight; // handed to the feeder, not yet in the engine
+static std::atomic<uint32_t> s_planned; // planner_count, published by the planner task for the others
+
+// Core 1. Owns the engine; a block that has to wait for the stream to drain
+// (reconnecting a step pin, or reversing without direction channels) waits
+// here, while the planner keeps planning.
+static void feeder_task(void *arg) {
+    motion_engine_config_t engine_config = {};
+    engine_config.resolution_hz = ROBOARM_TICKS_PER_S;
+    engine_config.axes = AXES;
+    engine_config.axis_count = AXIS_COUNT;
+    ESP_ERROR_CHECK(motion_engine_init(&engine_config));
+    ESP_ERROR_CHECK(motion_engine_stream_start());
+    xTaskNotifyGive(static_cast<TaskHandle_t>(arg));
+
+    while (true) {
+        motion_block_t block;
+        xQueueReceive(s_blocks, &block, portMAX_DELAY);
+        ESP_ERROR_CHECK(motion_engine_queue(&block, portMAX_DELAY));
+        machine_state_motion(true);
+        s_blocks_in_flight.fetch_sub(1);
+    }
+}
+
+static void hand_over(const motion_block_t &block) {
+    s_blocks_in_flight.fetch_add(1);
+    xQueueSend(s_blocks, &block, portMAX_DELAY);
+}
+
+static size_t blocks_pending(void) {
+    return s_blocks_in_flight.load() + motion_engine_queue_depth();
+}
+
+// Hands planned blocks to the feeder, keeping only ROBOARM_PLANNER_COMMIT_BLOCKS
+// committed so the rest can still be sped up by later lines.
+static void commit_blocks(bool flush) {
+    motion_block_t block;
+    while ((planner_full(*s_planner) || motion_engine_queue_depth() + s_blocks_in_flight.load() < ROBOARM_PLANNER_COMMIT_BLOCKS ||
+            flush) &&
+           planner_pop(*s_planner, block, flush)) {
+        hand_over(block);
+    }
+}
+
+// A block planned offline starts at rest or at the exit its predecessor in
+// the file planned for, so whatever the planner holds is flushed to rest
+// first. The planner then continues from where the block ends.
+static void run_precompiled(const motion_block_t &block) {
+    commit_blocks(true);
+    hand_over(block);
+    int32_t position[AXIS_COUNT];
+    for (size_t i = 0; i < AXIS_COUNT; i++) {
+        const int32_t steps = static_cast<int32_t>(block.steps[i]);
+        position[i] = s_planner->position[i] + (block.dir_bits & (1u << i) ? -steps : steps);
+    }
+    planner_set_position(*s_planner, position);
+}
+
+// Splits a tool-space line into joint segments as the planner takes them.
+// The tool feed along the line sets each segment's joint-space feed.
+static void run_tool_line(const link_move_command_t &command) {
+    float start[AXIS_COUNT];
+    axes_to_mm(s_planner->position, start);
+    kin_line_t line;
+    if (!kin_line_begin(line, ARM_GEOMETRY, start, command.tool_pose, command.joints, ARC_TOLERANCE_MM,
+                        KIN_MAX_SEGMENT_MM)) {
+        ESP_LOGW(TAG, "tool line starts at a singularity, running it as a joint move");
+        commit_blocks(false);
+        planner_buffer_line(*s_planner, command.target, command.feed / 60.0f);
+        return;
+    }
+    float joints[AXIS_COUNT];
+    float segment_mm;
+    while (kin_line_next(line, joints, segment_mm)) {
+        int32_t target[AXIS_COUNT];
+        float joint_mm_sqr = 0.0f;
+        for_each_axis([&](auto axis, size_t i) {
+            target[i] = axis.steps(joints[i]);
+            const float delta = axis.mm(target[i] - s_planner->position[i]);
+            joint_mm_sqr += delta * delta;
+        });
+        const float feed = command.feed > 0.0f && segment_mm > 0.0f ? command.feed / 60.0f * sqrtf(joint_mm_sqr) / segment_mm : 0.0f;
+        commit_blocks(false);
+        planner_buffer_line(*s_planner, target, feed);
+    }
+    if (line.singular) {
+        ESP_LOGW(TAG, "tool line crosses a singularity, finished as a joint move");
+    }
+}
+
+// Homing starts at rest and leaves the planner at the position it ends at,
+// successful or not.
+static void run_homing(const link_move_command_t &command) {
+    commit_blocks(true);
+    while (blocks_pending() || !motion_engine_idle()) {
+        vTaskDelay(1);
+    }
+    int32_t position[AXIS_COUNT];
+    memcpy(position, s_planner->position, sizeof(position));
+    homing_alarm_t alarm;
+    if (command.home_axes) {
+        const homing_step_t step = {HOMING_HOME, command.home_axes, {}};
+        alarm = homing_run(&step, 1, position);
+    } else {
+        alarm = homing_run(HOMING_PROGRAM, sizeof(HOMING_PROGRAM) / sizeof(HOMING_PROGRAM[0]), position);
+    }
+    planner_set_position(*s_planner, position);
+    motion_engine_set_position(position);
+    memcpy(command.home_position, position, sizeof(position));
+    xTaskNotify(command.waiter, alarm, eSetValueWithOverwrite);
+}
+
+static size_t planner_blocks(void) {
+    return s_planned.load();
+}
+
+// A command in, or blocks handed on: publish what the look-ahead holds. Goes
+// before machine_state_motion_done, and blocks reach s_blocks_in_flight
+// before they leave the count, so the status task always sees them somewhere.
+static void publish_planned(void) {
+    s_planned.store(planner_count(*s_planner));
+}
+
+static void planner_task(void *arg) {
+    planner_config_t config = {};
+    config.axis_count = AXIS_COUNT;
+    for_each_axis([&](auto axis, size_t i) {
+        config.mm_per_step[i] = axis.MM_PER_STEP;
+        config.max_rate[i] = AXES[i].max_rate_mm_per_min / 60.0f;
+        config.accel[i] = AXES[i].accel_mm_per_s2;
+    });
+    config.junction_deviation = JUNCTION_DEVIATION_MM;
+    config.stop_on_reversal = !motion_engine_dir_in_stream();
+    planner_init(*s_planner, config);
+
+    while (true) {
+        arena_fill(ARENA_PLANNER,
+                   planner_count(*s_planner) * sizeof(plan_block_t) + uxQueueMessagesWaiting(s_blocks) * sizeof(motion_block_t));
+        arena_fill(ARENA_LINK, uxQueueMessagesWaiting(s_moves) * sizeof(link_move_command_t));
+        link_move_command_t command;
+        if (xQueueReceive(s_moves, &command, PLANNER_IDLE_FLUSH) != pdTRUE) {
+            commit_blocks(true);
+            publish_planned();
+            continue;
+        }
+        if (command.kind == LINK_COMMAND_HOME) {
+            run_homing(command);
+            publish_planned();
+            continue;
+        }
+        if (command.kind == LINK_COMMAND_BLOCK) {
+            run_precompiled(command.block);
+        } else if (command.kind == LINK_COMMAND_TOOL_LINE) {
+            run_tool_line(command);
+        } else {
+            commit_blocks(false);
+            planner_buffer_line(*s_planner, command.target, command.feed / 60.0f);
+        }
+        publish_planned();
+        machine_state_motion_done();
+    }
+}
+
+// Nothing planned, in flight or in the engine, looked at in that order.
+static bool motion_stopped(void) {
+    return s_planned.load() == 0 && s_blocks_in_flight.load() == 0 && motion_engine_idle();
+}
+
+// Turns the end of motion into an Idle report as soon as it happens and logs
+// new underruns.
+static void status_task(void *arg) {
+    uint32_t reported_underruns = 0;
+    for (uint32_t round = 0;; round++) {
+        machine_state_motion_stopped(motion_stopped);
+        const uint32_t underruns = motion_engine_underruns();
+        if (underruns != reported_underruns) {
+            ESP_LOGW(TAG, "underruns %lu", static_cast<unsigned long>(underruns));
+            reported_underruns = underruns;
+        }
+        if (round % HEAP_CHECK_EVERY == 0) {
+            arena_watch_heap();
+        }
+        vTaskDelay(STATUS_CHECK_PERIOD);
+    }
+}
+
+static void create(const task_layout_t &layout, TaskFunction_t fn, void *arg = NULL) {
+    const BaseType_t ret = xTaskCreatePinnedToCore(fn, layout.name, layout.stack, arg, layout.priority, NULL, layout.core);
+    assert(ret == pdPASS);
+}
+
+// A FreeRTOS queue with its storage in `region`.
+static QueueHandle_t new_queue(arena_region_t region, size_t length, size_t item_size) {
+    StaticQueue_t *queue = arena_new<StaticQueue_t>(region);
+    uint8_t *storage = static_cast<uint8_t *>(arena_alloc(region, length * item_size, alignof(uint32_t), length * item_size));
+    return queue && storage ? xQueueCreateStatic(length, item_size, storage, queue) : NULL;
+}
+
+void tasks_start(void) {
+    s_planner = arena_new<planner_t>(ARENA_PLANNER, 1, sizeof(planner_t::blocks));
+    s_moves = new_queue(ARENA_LINK, ROBOARM_LINK_MOVE_QUEUE, sizeof(link_move_command_t));
+    s_blocks = new_queue(ARENA_PLANNER, ROBOARM_PLANNER_COMMIT_BLOCKS, sizeof(motion_block_t));
+    assert(s_planner && s_moves && s_blocks);
+
+    // the engine must be up before anything queries it
+    create(TASK_FEEDER, feeder_task, xTaskGetCurrentTaskHandle());
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    homing_io_t homing_io = {};
+    homing_io.queue_block = hand_over;
+    homing_io.blocks_pending = blocks_pending;
+    homing_io.idle = motion_engine_idle;
+    ESP_ERROR_CHECK(homing_init(AXES, &homing_io));
+    create(TASK_PLANNER, planner_task);
+    create(TASK_STATUS, status_task);
+
+    job_spool_config_t job_config = {};
+    job_config.moves = s_moves;
+    job_config.task_stack = TASK_JOB.stack;
+    job_config.task_priority = TASK_JOB.priority;
+    job_config.task_core = TASK_JOB.core;
+    job_config.reader_stack = TASK_JOB_READ.stack;
+    ESP_ERROR_CHECK(job_spool_start(&job_config));
+
+    serial_link_config_t link_config = {};
+    link_config.port = static_cast<uart_port_t>(ROBOARM_LINK_UART);
+    link_config.baud = ROBOARM_LINK_BAUD;
+    link_config.moves = s_moves;
+    link_config.axes = AXES;
+    link_config.task_stack = TASK_LINK.stack;
+    link_config.task_priority = TASK_LINK.priority;
+    link_config.task_core = TASK_LINK.core;
+    ESP_ERROR_CHECK(serial_link_start(&link_config));
+
+    telemetry_config_t telemetry_config = {};
+    telemetry_config.port = link_config.port;
+    telemetry_config.moves = s_moves;
+    telemetry_config.planner_blocks = planner_blocks;
+    telemetry_config.rate_hz = ROBOARM_TELEMETRY_HZ;
+    telemetry_config.task_stack = TASK_TELEMETRY.stack;
+    telemetry_config.task_priority = TASK_TELEMETRY.priority;
+    telemetry_config.task_core = TASK_TELEMETRY.core;
+    ESP_ERROR_CHECK(telemetry_start(&telemetry_config));
+    arena_report();
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+
+// Task and core layout of the firmware.
+//
+// Core 1 belongs to motion: the feeder task owns the motion engine, so the
+// RMT interrupt is allocated there too, and nothing else is pinned to it.
+// Core 0 runs the host link, the planner, stored jobs, telemetry and status
+// reporting. Priorities are ordered feeder > planner > link > job > telemetry
+// > status, and the RMT interrupt runs above every task, so neither
+// communication nor logging can delay step generation.
+
+struct task_layout_t {
+    const char *name;
+    uint32_t stack;
+    UBaseType_t priority;
+    BaseType_t core;
+};
+
+inline constexpr task_layout_t TASK_FEEDER = {"feeder", 4096, configMAX_PRIORITIES - 5, 1};
+inline constexpr task_layout_t TASK_PLANNER = {"planner", 4096, 10, 0};
+inline constexpr task_layout_t TASK_LINK = {"serial_link", 4096, 8, 0};
+inline constexpr task_layout_t TASK_JOB = {"job", 4096, 7, 0};
+inline constexpr task_layout_t TASK_JOB_READ = {"job_read", 2048, 7, 0};
+inline constexpr task_layout_t TASK_TELEMETRY = {"telemetry", 3072, 6, 0};
+inline constexpr task_layout_t TASK_STATUS = {"status", 3072, 3, 0};
+
+// Create every task. Call once from app_main.
+void tasks_start(void);